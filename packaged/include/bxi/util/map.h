@@ -16,6 +16,7 @@
 
 #ifndef BXICFFI
 #include <stddef.h>
+#include <stdint.h>
 #include <bxi/base/err.h>
 #endif
 
@@ -47,6 +48,127 @@
  * Finally ending the threads:
  * @snippet bximap.c STOP THREADS
  *
+ * ### Scheduling
+ * By default the threads fetch the tasks from a single shared counter
+ * (BXIMAP_SCHED_DYNAMIC). With BXIMAP_SCHED_STEAL, each thread starts with
+ * its own contiguous range of tasks and steals half of the range of another
+ * thread once its own is exhausted: this avoids the contention on the shared
+ * counter with many threads and a fine granularity.
+ * As with OpenMP, BXIMAP_SCHED_STATIC gives each thread a fixed share of
+ * the tasks, and BXIMAP_SCHED_GUIDED hands out chunks of the remaining
+ * iterations divided by the number of threads, so chunks shrink towards the
+ * end of the map; the granularity is then the smallest chunk.
+ * BXIMAP_SCHED_AUTO records the time per iteration of each map function
+ * and chooses the granularity of its next executions: tasks long enough to
+ * hide the dispatch overhead, but enough of them to balance the end of the
+ * map. A granularity given to bximap_new() is only used by the first
+ * execution.
+ * BXIMAP_SCHED_AFFINITY gives the same ranges of tasks to the same threads
+ * at each execution, so the data first touched by a thread stays on its
+ * NUMA node; idle threads steal from the threads of their own node before
+ * the remote ones.
+ * See bximap_set_schedule() and bximap_set_default_schedule().
+ *
+ * ### Irregular iterations
+ * All the schedules cut the range into tasks of the same number of
+ * iterations. When the cost of each iteration is known, bximap_set_weights()
+ * or bximap_set_cost() cut it into tasks of the same cost instead, so a few
+ * expensive iterations do not make the threads which got them run longer.
+ *
+ * ### Multi-dimensional maps
+ * bximap_new_nd() cuts a box of up to BXIMAP_ND_MAX dimensions into tiles
+ * and gives a tile to each call of the map function. The tiles are visited
+ * in Morton (Z) order: tiles close in that order are close in space, so
+ * the tiles run by a thread, and by the threads running at the same time,
+ * share more of the cache than rows of a flattened index would.
+ *
+ * ### Concurrent and nested executions
+ * Several contexts can be executed at the same time, either by different
+ * application threads or by calling bximap_execute() from inside a map
+ * function. The threads of the pool take part in the execution of their
+ * own maps, and help the other running maps while they wait for the end
+ * of a nested one. The thread index given to the map function is the index
+ * of the executing thread in the pool: a nested map runs on the same
+ * indexes as the map which started it. Threads outside the pool only wait
+ * for the end of their maps, unless the pool has a single thread: their
+ * maps are then run inline as the thread 0.
+ *
+ * ### Asynchronous executions
+ * bximap_execute_async() returns as soon as the tasks are handed to the
+ * threads of the pool, so the caller can do something else meanwhile.
+ * The execution is checked with bximap_test() and must be waited for with
+ * bximap_wait(), bximap_wait_any() or bximap_wait_all() before its context
+ * can be executed again. A callback set with bximap_set_callback() is called
+ * at the end of each execution of the context, by the thread which ran its
+ * last task: it can start the next map of a pipeline.
+ *
+ * ### Tasks
+ * bximap_submit() hands a single function call to the same threads as the
+ * maps, through a lock-free queue: a pool can then serve both a loop and
+ * independent requests. The threads run the tasks of the running maps
+ * first. The result of a task is given by bximap_future_wait(); threads of
+ * the pool run the other submitted tasks and maps while they wait, so a
+ * task can submit and wait for other tasks.
+ *
+ * ### Task graphs
+ * Phases which only depend on some of the others are described as a graph:
+ * its nodes are maps or single calls, its edges the dependencies between
+ * them. bximap_graph_execute() starts each node as soon as the nodes it
+ * depends on have returned, so independent phases overlap instead of
+ * waiting for each other at the end of every map.
+ *
+ * ### Pipelines
+ * A pipeline streams batches through a chain of stages, such as
+ * parse, transform and write: each stage runs on the threads of the pool as
+ * soon as it has a batch to process, so the stages overlap without the
+ * whole input being produced first. Stages are connected by bounded
+ * lock-free queues: a stage whose next queue is full waits for the next
+ * stage to catch up. See bximap_pipeline_execute().
+ *
+ * ### Cancellation
+ * bximap_cancel() stops a running map: the tasks already started end
+ * normally, the others are not run. It can be called from a map function,
+ * to end a search once a match is found, or from any other thread. Map
+ * functions can poll bximap_cancelled() to stop a long task early. With
+ * bximap_set_stop_on_error(), the first failed task cancels the map.
+ *
+ * ### Idle threads
+ * Threads waiting for work, or for the end of a map, poll for a while
+ * before they sleep, so successive small maps do not pay for a system call
+ * to wake the threads up. See bximap_set_spin_budget().
+ *
+ * ### Reductions
+ * bximap_reduce() gives each thread its own accumulator, on its own cache
+ * line, instead of the shared data updated with atomics by the map
+ * functions. The accumulators are initialized by an identity function and
+ * combined pairwise at the end, in an order which only depends on the
+ * number of threads.
+ *
+ * ### Sort and scan
+ * bximap_sort(), bximap_sort_by_key() and bximap_scan() sort and sum up
+ * arrays on the threads of the pool, between two maps: blocks of the array
+ * are processed by the threads, then combined. Small arrays are processed
+ * by the calling thread.
+ *
+ * ### Thread placement
+ * Threads can be bound to CPUs either from an explicit list given to
+ * bximap_set_cpumask(), or by a placement policy built from the topology
+ * found in /sys/devices/system/cpu: close to each other, spread over the
+ * sockets, or one per physical core. See bximap_set_placement() and
+ * bximap_get_cpu_map().
+ *
+ * ### Resizing
+ * bximap_resize() shrinks the pool while the cores are needed by someone
+ * else, and grows it back afterwards. Threads beyond the new size sleep
+ * without being woken up by the maps and keep their CPU.
+ *
+ * ### Statistics
+ * The threads time the tasks they run, so bximap_get_stats() can tell after
+ * an execution how the work was spread: time spent in the map function and
+ * waiting for the other threads, tasks run and stolen, imbalance. Timing
+ * costs two clock reads per task: the time stamp counter is cheaper, and
+ * timing can be turned off. See bximap_set_stats_mode().
+ *
  * ### Full Running Examples
  * - @link bximap.c map a loop iteration on several threads. @endlink
  */
@@ -87,6 +209,11 @@
  */
 #define BXIMAP_ARG_ERROR 42632202           // Leet speak of ARGERROR
 
+/**
+ * The largest number of dimensions of bximap_new_nd().
+ */
+#define BXIMAP_ND_MAX 4
+
 
 // *********************************************************************************
 // ********************************** Types   **************************************
@@ -96,6 +223,26 @@
  */
 typedef struct bximap_ctx_s_t * bximap_ctx_p;
 
+/**
+ * The handle on an execution started by bximap_execute_async()
+ */
+typedef struct bximap_ctx_s_t * bximap_handle_p;
+
+/**
+ * The future of a task submitted with bximap_submit()
+ */
+typedef struct bximap_future_s_t * bximap_future_p;
+
+/**
+ * The graph of maps and calls executed by bximap_graph_execute()
+ */
+typedef struct bximap_graph_s_t * bximap_graph_p;
+
+/**
+ * The chain of stages executed by bximap_pipeline_execute()
+ */
+typedef struct bximap_pipeline_s_t * bximap_pipeline_p;
+
 /* Type which can hold a number of threads (or index thereof),
  * or a number of errors (or index thereof).
  * We set a theoretical limit of 2^15-1 threads/errors for this purpose.
@@ -118,6 +265,77 @@ typedef long long bximap_task_idx_t;
 typedef int bximap_cpu_idx_t;
 #define CPU_IDX_FMT "%d"
 
+/**
+ * The policies used to distribute the tasks of a context among the threads.
+ */
+typedef enum {
+    BXIMAP_SCHED_DEFAULT,   /**< Use the library default schedule */
+    BXIMAP_SCHED_DYNAMIC,   /**< Threads fetch tasks from a single shared counter */
+    BXIMAP_SCHED_STEAL,     /**< Each thread owns a range of tasks and steals
+                                 half of another thread's range when idle */
+    BXIMAP_SCHED_STATIC,    /**< Each thread does its own range of tasks,
+                                 ranges of absent threads are taken whole */
+    BXIMAP_SCHED_GUIDED,    /**< Threads fetch chunks of decreasing size */
+    BXIMAP_SCHED_AUTO,      /**< The granularity is tuned from the previous
+                                 executions of the same function */
+    BXIMAP_SCHED_AFFINITY,  /**< As BXIMAP_SCHED_STEAL, stealing on the same
+                                 NUMA node first */
+} bximap_sched_e;
+
+/**
+ * A tile of a multi-dimensional map, see bximap_new_nd().
+ */
+typedef struct {
+    int dims;                                   /**< Number of dimensions */
+    bximap_task_idx_t start[BXIMAP_ND_MAX];     /**< First index of each dimension */
+    bximap_task_idx_t end[BXIMAP_ND_MAX];       /**< End of each dimension (excluded) */
+} bximap_tile_s;
+
+/**
+ * The policies used to bind the threads of the pool to the CPUs.
+ */
+typedef enum {
+    BXIMAP_PLACE_NONE,      /**< Only the cpu mask, if any, is used */
+    BXIMAP_PLACE_COMPACT,   /**< Fill the hardware threads of a core, then the
+                                 cores of a socket, then the next socket */
+    BXIMAP_PLACE_SCATTER,   /**< Round robin over the sockets, one hardware
+                                 thread per core before the SMT siblings */
+    BXIMAP_PLACE_PHYSCORE,  /**< One hardware thread of each physical core */
+} bximap_place_e;
+
+/**
+ * The timing of the tasks, for the statistics of the executions.
+ */
+typedef enum {
+    BXIMAP_STATS_OFF,       /**< No statistics */
+    BXIMAP_STATS_TSC,       /**< Time stamp counter, clock elsewhere */
+    BXIMAP_STATS_CLOCK,     /**< Monotonic clock */
+} bximap_stats_mode_e;
+
+/**
+ * The statistics of one thread during an execution.
+ */
+typedef struct {
+    double busy_time;               /**< Seconds spent in the map function */
+    double wait_time;               /**< Seconds spent in the execution without
+                                         task to run: scheduling, and waiting
+                                         for the other threads */
+    bximap_task_idx_t tasks;        /**< Tasks run */
+    bximap_task_idx_t iterations;   /**< Iterations of these tasks */
+    bximap_task_idx_t steals;       /**< Tasks taken from another thread */
+} bximap_thread_stats_s;
+
+/**
+ * The statistics of the last execution of a context.
+ */
+typedef struct {
+    double duration;                /**< Seconds from the start to the end
+                                         of the execution */
+    bximap_thrd_idx_t nb_threads;   /**< Size of threads, 0 without statistics */
+    bximap_thread_stats_s * threads;/**< Statistics of each thread */
+    double imbalance;               /**< Largest busy time over the mean */
+} bximap_stats_s;
+
 // *********************************************************************************
 // ********************************** Global Variables *****************************
 // *********************************************************************************
@@ -152,6 +370,8 @@ bxierr_p bximap_init(bximap_thrd_idx_t * nb_threads);
 /**
  * Clean all resources allocated by the library
  *
+ * BXIMAP_RUNNING is returned while some contexts or submitted calls are executed.
+ *
  * @return BXIERR_OK on error, anything else on error
  */
 bxierr_p bximap_finalize();
@@ -186,6 +406,34 @@ bxierr_p bximap_new(bximap_task_idx_t start,
                     void            * usr_data,
                     bximap_ctx_p    * ctx_p);
 
+/**
+ * Create a new multi-dimensional mapping.
+ *
+ * The box [start[0], end[0][ x ... x [start[dims-1], end[dims-1][ is cut
+ * into tiles of tile[k] indexes along the dimension k; tiles at the upper
+ * bounds may be smaller. The tiles are the iterations of the map, in
+ * Morton order: the schedules group neighbouring tiles into tasks.
+ *
+ * @param[in] dims the number of dimensions, from 1 to BXIMAP_ND_MAX
+ * @param[in] start the first index of each dimension
+ * @param[in] end the end of each dimension (excluded)
+ * @param[in] tile the size of the tiles along each dimension
+ * @param[in] func the function called on each tile
+ * @param[in] usr_data the data to pass to the function
+ * @param[out] ctx_p a pointer on the created context
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_new_nd(int dims,
+                       const bximap_task_idx_t * start,
+                       const bximap_task_idx_t * end,
+                       const bximap_task_idx_t * tile,
+                       bxierr_p       (* func)(const bximap_tile_s * tile,
+                                               bximap_thrd_idx_t thread,
+                                               void * usr_data),
+                       void            * usr_data,
+                       bximap_ctx_p    * ctx_p);
+
 /**
  * Release the given bximap context.
  *
@@ -200,15 +448,347 @@ bxierr_p bximap_destroy(bximap_ctx_p * ctx_p);
  *
  *  WARNING bximap_init_threads should be called before
  *
+ *  This function can be called concurrently by several threads, and from
+ *  a map function. BXIMAP_RUNNING is returned when the given context is
+ *  already being executed.
+ *
  *  @param[in] context the bximap context to use
  *
  *  @return BXIERR_OK on success, anything else on error
  */
 bxierr_p bximap_execute(bximap_ctx_p context);
 
+/**
+ * Set the number of polls done by an idle thread before it sleeps.
+ *
+ * A larger budget lowers the latency of maps issued in quick succession,
+ * at the cost of CPU time burnt by idle threads. With 0, idle threads sleep
+ * at once. The default can be set by the BXIMAP_SPIN environment variable
+ * when bximap_init() is called.
+ *
+ * @param[in] spins the number of polls
+ *
+ * @return BXIERR_OK on success, anything else on error.
+ */
+bxierr_p bximap_set_spin_budget(int spins);
+
+/**
+ * Start the execution of the work described by the context, without
+ * waiting for its end.
+ *
+ * The calling thread does not take part in the execution, unless the pool
+ * has a single thread: the work is then done before this function returns.
+ * The handle must be given to bximap_wait(), bximap_wait_any() or
+ * bximap_wait_all() to release the context.
+ *
+ * @param[in] context the bximap context to use
+ * @param[out] handle the handle on the started execution
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_execute_async(bximap_ctx_p context, bximap_handle_p * handle);
+
+/**
+ * Check whether an asynchronous execution is finished, without blocking.
+ *
+ * @param[in] handle the handle returned by bximap_execute_async()
+ * @param[out] done true if every task has been done
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_test(bximap_handle_p handle, bool * done);
+
+/**
+ * Wait for the end of an asynchronous execution and release its context.
+ *
+ * When called by a thread of the pool, tasks of the other running maps
+ * are done while waiting.
+ *
+ * @param[in] handle the handle returned by bximap_execute_async()
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_wait(bximap_handle_p handle);
+
+/**
+ * Wait for the end of one of the given asynchronous executions,
+ * and release its context. The other handles are left untouched.
+ *
+ * @param[in] handles the handles returned by bximap_execute_async()
+ * @param[in] n the number of handles
+ * @param[out] idx the index of the finished execution in handles
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_wait_any(bximap_handle_p * handles, size_t n, size_t * idx);
+
+/**
+ * Wait for the end of all the given asynchronous executions,
+ * and release their contexts.
+ *
+ * @param[in] handles the handles returned by bximap_execute_async()
+ * @param[in] n the number of handles
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_wait_all(bximap_handle_p * handles, size_t n);
+
+/**
+ * Submit a single call of func(arg) to the threads of the pool.
+ *
+ * The call is queued and run by the first idle thread. It is run before
+ * this function returns when the pool has a single thread, or when the
+ * queue is full. Without future, an error returned by func is only logged.
+ *
+ * @param[in] func the function to call
+ * @param[in] arg the argument given to func
+ * @param[out] future the future of the call, to give to bximap_future_wait(),
+ *             NULL if the result is not needed
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_submit(bxierr_p (*func)(void * arg), void * arg,
+                       bximap_future_p * future);
+
+/**
+ * Check whether a submitted call is finished, without blocking.
+ *
+ * @param[in] future the future given by bximap_submit()
+ * @param[out] done true if the call has returned
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_future_test(bximap_future_p future, bool * done);
+
+/**
+ * Wait for the end of a submitted call and release its future.
+ *
+ * When called by a thread of the pool, the other submitted calls and the
+ * tasks of the running maps are done while waiting.
+ *
+ * @param[in,out] future the future given by bximap_submit(), set to NULL
+ *
+ * @return the error returned by the call
+ */
+bxierr_p bximap_future_wait(bximap_future_p * future);
+
+/**
+ * Create an empty graph of maps and calls.
+ *
+ * @param[out] graph the new graph
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_graph_new(bximap_graph_p * graph);
+
+/**
+ * Release a graph. The contexts of its maps are not destroyed.
+ *
+ * @param[in,out] graph the graph to release, set to NULL
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_graph_destroy(bximap_graph_p * graph);
+
+/**
+ * Add the execution of a map to the graph.
+ *
+ * A context must not be in several nodes, nor be executed by someone else
+ * while the graph is executed.
+ *
+ * @param[in] graph the graph to use
+ * @param[in] context the map to execute
+ * @param[out] node the index of the new node
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_graph_add_map(bximap_graph_p graph, bximap_ctx_p context, size_t * node);
+
+/**
+ * Add a single call of func(arg) to the graph.
+ *
+ * @param[in] graph the graph to use
+ * @param[in] func the function to call
+ * @param[in] arg the argument given to func
+ * @param[out] node the index of the new node
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_graph_add_call(bximap_graph_p graph,
+                               bxierr_p (*func)(void * arg), void * arg,
+                               size_t * node);
+
+/**
+ * Add a dependency: the node to only starts once the node from has returned.
+ *
+ * @param[in] graph the graph to use
+ * @param[in] from the node to wait for
+ * @param[in] to the node which depends on from
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_graph_add_edge(bximap_graph_p graph, size_t from, size_t to);
+
+/**
+ * Execute every node of the graph once, each after the nodes it depends on,
+ * and wait for their end.
+ *
+ * The nodes are run by the threads of the pool. A failed node does not
+ * prevent the others from running: the errors of the calls, and of the
+ * executions of the maps, are returned chained. The errors of the tasks
+ * of a map are given by bximap_get_error().
+ *
+ * @param[in] graph the graph to execute
+ *
+ * @return BXIERR_OK on success, BXIMAP_ARG_ERROR if the graph has a cycle,
+ *         anything else on error
+ */
+bxierr_p bximap_graph_execute(bximap_graph_p graph);
+
+/**
+ * Create an empty pipeline.
+ *
+ * @param[in] depth the number of batches each queue between two stages
+ *            can hold, rounded up to a power of 2
+ * @param[out] pipeline the new pipeline
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_pipeline_new(size_t depth, bximap_pipeline_p * pipeline);
+
+/**
+ * Release a pipeline.
+ *
+ * @param[in,out] pipeline the pipeline to release, set to NULL
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_pipeline_destroy(bximap_pipeline_p * pipeline);
+
+/**
+ * Append a stage to the pipeline.
+ *
+ * The stage is called with each batch produced by the previous stage, in
+ * order, and sets out to the batch given to the next stage, or to NULL to
+ * drop it. The batches are owned by the stages: a stage frees the batches
+ * it does not pass on. A stage is never called by two threads at the same
+ * time.
+ *
+ * The first stage produces the batches: it is called with a NULL batch
+ * until it sets out to NULL. The out batch of the last stage is ignored.
+ *
+ * @param[in] pipeline the pipeline to use
+ * @param[in] func the function of the stage
+ * @param[in] usr_data the data given to func
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_pipeline_add_stage(bximap_pipeline_p pipeline,
+                                   bxierr_p (*func)(void * batch, void ** out,
+                                                    void * usr_data),
+                                   void * usr_data);
+
+/**
+ * Stream the batches of the first stage through the pipeline, and wait
+ * for the last stage to process them.
+ *
+ * The first error returned by a stage stops the first stage: the batches
+ * already produced are still processed by the next stages, so none of
+ * them is leaked. The errors are returned chained.
+ *
+ * @param[in] pipeline the pipeline to execute, with at least two stages
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_pipeline_execute(bximap_pipeline_p pipeline);
+
+/**
+ * Set the function called at the end of each execution of the context.
+ *
+ * The callback is called by the thread which ran the last task, before
+ * the waiters are woken up. It must not wait for the execution of its own
+ * context.
+ *
+ * @param[in] context the bximap context to use
+ * @param[in] callback the function to call, NULL to remove it
+ * @param[in] data the data given to the callback
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_set_callback(bximap_ctx_p context,
+                             void (*callback)(bximap_ctx_p context, void * data),
+                             void * data);
+
+/**
+ * Cancel the tasks of a running context not started yet.
+ *
+ * The execution still has to be waited for. It returns BXIERR_OK:
+ * bximap_cancelled() tells whether it was cancelled.
+ *
+ * @param[in] context the bximap context to use, NULL for the context of
+ *            the task run by the calling thread
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_cancel(bximap_ctx_p context);
+
+/**
+ * Return whether the running or last execution of the context was cancelled.
+ *
+ * @param[in] context the bximap context to use, NULL for the context of
+ *            the task run by the calling thread
+ *
+ * @return true if the execution was cancelled, false otherwise or without
+ *         context
+ */
+bool bximap_cancelled(bximap_ctx_p context);
+
+/**
+ * Cancel the executions of the context on the first failed task.
+ *
+ * @param[in] context the bximap context to use
+ * @param[in] stop true to stop on the first error
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_set_stop_on_error(bximap_ctx_p context, bool stop);
+
+/**
+ * Set the timing of the tasks of the next executions.
+ *
+ * BXIMAP_STATS_TSC falls back to the clock on processors without time stamp
+ * counter; it assumes the counter is synchronized between the cores.
+ * BXIMAP_SCHED_AUTO keeps timing its tasks with BXIMAP_STATS_OFF.
+ * The default is BXIMAP_STATS_CLOCK unless the BXIMAP_STATS environment
+ * variable is set to "off", "tsc" or "clock" when bximap_init() is called.
+ *
+ * @param[in] mode the timing to use
+ *
+ * @return BXIERR_OK on success, anything else on error.
+ */
+bxierr_p bximap_set_stats_mode(bximap_stats_mode_e mode);
+
+/**
+ * Return the statistics of the last execution of the context.
+ *
+ * The array of per-thread statistics belongs to the context: it is valid
+ * until the next call on the same context or bximap_destroy(). The wait time
+ * of the thread which waited for the execution is only known once it
+ * returned from bximap_execute() or bximap_wait().
+ *
+ * @param[in] context the bximap context to use
+ * @param[out] stats the statistics, zeroed if the tasks were not timed
+ *
+ * @return BXIERR_OK on success, anything else on error.
+ */
+bxierr_p bximap_get_stats(bximap_ctx_p context, bximap_stats_s * stats);
+
 /**
  * Return the error and the number of error
  *
+ * The errors belong to the context: they are released by the next
+ * bximap_execute() or by bximap_destroy().
+ *
  * @param[in] context the bximap context to use
  * @param[out] n a pointer on the number of errors
  * @param[out] err_p a pointer on an array of errors.
@@ -219,6 +799,164 @@ bxierr_p bximap_get_error(bximap_ctx_p context,
                           bximap_thrd_idx_t * n,
                           bxierr_p ** err_p);
 
+/**
+ * Set the schedule used by the given context.
+ *
+ * With BXIMAP_SCHED_DEFAULT, the library default schedule is used
+ * (see bximap_set_default_schedule()).
+ *
+ * @param[in] context the bximap context to use
+ * @param[in] sched the schedule to use
+ *
+ * @return BXIERR_OK on success, anything else on error.
+ */
+bxierr_p bximap_set_schedule(bximap_ctx_p context, bximap_sched_e sched);
+
+/**
+ * Cut the range of the context into tasks of the same total weight.
+ *
+ * The number of tasks is given by the granularity as without weights, but
+ * their bounds are chosen by one pass over the weights at each execution.
+ * The weights are read by the execution: they can be updated between two
+ * executions. With weights, BXIMAP_SCHED_GUIDED behaves as
+ * BXIMAP_SCHED_DYNAMIC. When all the weights are 0, the range is cut evenly;
+ * a negative or NaN weight makes the execution fail with BXIMAP_ARG_ERROR.
+ *
+ * @param[in] context the bximap context to use
+ * @param[in] weights the cost of each iteration, weights[i - start] for the
+ *            iteration i, non negative, NULL to cut the range evenly again
+ *
+ * @return BXIERR_OK on success, anything else on error.
+ */
+bxierr_p bximap_set_weights(bximap_ctx_p context, const double * weights);
+
+/**
+ * Cut the range of the context into tasks of the same cost, given by the
+ * cost of the first iterations.
+ *
+ * As bximap_set_weights(), when the costs are already summed up or can be
+ * computed: the bounds of each task are found by binary search.
+ *
+ * @param[in] context the bximap context to use
+ * @param[in] prefix the cost of the iterations [start, i[, non decreasing
+ *            in i, NULL to cut the range evenly again
+ * @param[in] data the data given to prefix
+ *
+ * @return BXIERR_OK on success, anything else on error.
+ */
+bxierr_p bximap_set_cost(bximap_ctx_p context,
+                         double (*prefix)(bximap_task_idx_t i, void * data),
+                         void * data);
+
+/**
+ * Set the schedule used by contexts which do not specify one.
+ *
+ * The default is BXIMAP_SCHED_DYNAMIC unless the BXIMAP_SCHEDULE
+ * environment variable is set to "dynamic", "steal", "static", "guided",
+ * "auto" or "affinity" when bximap_init() is called.
+ *
+ * @param[in] sched the schedule to use (BXIMAP_SCHED_DEFAULT is invalid)
+ *
+ * @return BXIERR_OK on success, anything else on error.
+ */
+bxierr_p bximap_set_default_schedule(bximap_sched_e sched);
+
+/**
+ * Reduce the iterations from start to end over the threads.
+ *
+ * Each thread owns an accumulator of acc_size bytes initialized with
+ * identity(). The function func accumulates the iterations from start to
+ * end into the accumulator of the executing thread. At the end, the
+ * accumulators are combined along a binary tree of the thread indexes:
+ * combine(acc, other) must fold other into acc. The final accumulator is
+ * copied into result.
+ *
+ * Accumulators are copied with memcpy(): resources they refer to must be
+ * released by the caller.
+ * A map function should not start a nested map while it holds a copy of
+ * its accumulator: the thread may accumulate other iterations meanwhile.
+ *
+ * @param[in] start the first iteration
+ * @param[in] end the last iteration (excluded)
+ * @param[in] granularity the number of iterations of each task, as in bximap_new()
+ * @param[in] func the function accumulating iterations
+ * @param[in] acc_size the size of an accumulator
+ * @param[in] identity the function initializing an accumulator
+ * @param[in] combine the function folding an accumulator into another
+ * @param[in] usr_data the data to pass to the functions
+ * @param[out] result the acc_size bytes where the result is copied
+ *
+ * @return BXIERR_OK on success, otherwise the errors of the failed tasks
+ *         chained, or any other error
+ */
+bxierr_p bximap_reduce(bximap_task_idx_t start,
+                       bximap_task_idx_t end,
+                       bximap_task_idx_t granularity,
+                       bxierr_p       (* func)(bximap_task_idx_t start,
+                                               bximap_task_idx_t end,
+                                               bximap_thrd_idx_t thread,
+                                               void * acc,
+                                               void * usr_data),
+                       size_t            acc_size,
+                       void           (* identity)(void * acc, void * usr_data),
+                       void           (* combine)(void * acc,
+                                                  const void * other,
+                                                  void * usr_data),
+                       void            * usr_data,
+                       void            * result);
+
+/**
+ * Sort an array as qsort(), on the threads of the pool.
+ *
+ * Blocks of the array are sorted by the threads, then merged in rounds:
+ * each merge is cut into pieces of the same size, so every round keeps
+ * all the threads busy. The sort is not stable. A temporary array of the
+ * same size is allocated.
+ *
+ * @param[in,out] base the array to sort
+ * @param[in] nmemb the number of elements
+ * @param[in] size the size of an element
+ * @param[in] compar the comparison function, as for qsort()
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_sort(void * base, size_t nmemb, size_t size,
+                     int (*compar)(const void * a, const void * b));
+
+/**
+ * Sort an array by the integer key of its elements, on the threads of the
+ * pool.
+ *
+ * A radix sort, 8 bits of the keys at a time: only the bytes up to the
+ * highest one set in some key cost a pass over the array. The key of each
+ * element is computed once. The sort is stable. Temporary arrays of the
+ * elements and of their keys are allocated.
+ *
+ * @param[in,out] base the array to sort
+ * @param[in] nmemb the number of elements
+ * @param[in] size the size of an element
+ * @param[in] key the function returning the key of an element
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_sort_by_key(void * base, size_t nmemb, size_t size,
+                            uint64_t (*key)(const void * elem));
+
+/**
+ * Compute the prefix sums of an array, on the threads of the pool.
+ *
+ * out[i] is the sum of in[0] to in[i] when inclusive, to in[i - 1]
+ * otherwise (0 for out[0]). in and out can be the same array.
+ *
+ * @param[in] in the array to sum up
+ * @param[out] out the array of the prefix sums
+ * @param[in] n the number of elements
+ * @param[in] inclusive whether out[i] includes in[i]
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bximap_scan(const int64_t * in, int64_t * out, size_t n, bool inclusive);
+
 /**
  * Bind the current thread on the provided cpu index.
  *
@@ -242,6 +980,61 @@ bxierr_p bximap_on_cpu(bximap_cpu_idx_t cpu);
  */
 bxierr_p bximap_set_cpumask(char * cpus);
 
+/**
+ * Set the placement policy of the threads created by bximap_init().
+ *
+ * The CPUs are the ones given to bximap_set_cpumask(), or else the CPUs the
+ * process may run on, ordered by the policy. Thread i is bound to the i-th
+ * CPU, cycling when there are more threads than CPUs. The calling thread of
+ * bximap_init() is the thread 0: it is bound until bximap_finalize(), which
+ * gives it back its previous affinity.
+ * The default is BXIMAP_PLACE_NONE unless the BXIMAP_PLACEMENT environment
+ * variable is set to "none", "compact", "scatter" or "physcore" when
+ * bximap_init() is called.
+ *
+ * @param[in] place the placement policy
+ *
+ * @returns BXIERR_OK on success, anything else on error.
+ */
+bxierr_p bximap_set_placement(bximap_place_e place);
+
+/**
+ * Change the number of threads of the pool without restarting it.
+ *
+ * Threads beyond the new size are parked, bound to their CPU, until the
+ * pool grows again; threads are only created when the pool grows beyond
+ * its largest size. A pool cannot be resized while maps or submitted calls
+ * are running, nor while other threads start maps or reductions.
+ *
+ * @param[in] nb_threads the new number of threads, the master included
+ *
+ * @returns BXIERR_OK on success, BXIMAP_RUNNING if maps or calls are running,
+ *          anything else on error.
+ */
+bxierr_p bximap_resize(bximap_thrd_idx_t nb_threads);
+
+/**
+ * Return the number of threads of the pool, the master included.
+ *
+ * The thread index given to the map functions is lower than this number,
+ * so it can size an array with one entry per thread.
+ *
+ * @param[out] nb_threads the number of threads
+ *
+ * @returns BXIERR_OK on success, anything else on error.
+ */
+bxierr_p bximap_get_nb_threads(bximap_thrd_idx_t * nb_threads);
+
+/**
+ * Return the CPU each thread of the pool is bound to.
+ *
+ * @param[out] cpus an array of n CPU indexes, -1 for threads not bound
+ * @param[in] n the size of cpus, threads beyond the pool are set to -1
+ *
+ * @returns BXIERR_OK on success, anything else on error.
+ */
+bxierr_p bximap_get_cpu_map(bximap_cpu_idx_t * cpus, bximap_thrd_idx_t n);
+
 /**
  * @example bximap.c
  * An example on how to use the module map.
@@ -18,6 +18,8 @@
 #ifndef BXICFFI
 #include <stdint.h>
 #include <stdlib.h>
+
+#include "bxi/base/err.h"
 #endif
 
 /**
@@ -47,6 +49,35 @@
  * Liberate the array:
  * @snippet bxistretch.c FREE STRETCH
  *
+ * A concurrent stretch, created by bxistretch_new_concurrent(), can be hit
+ * and appended to by several threads at once. Its chunks are found through
+ * a two-level directory which is never reallocated: the chunks are
+ * published with an atomic compare and swap, and bxistretch_get() never
+ * waits nor reads a stale meta array. The directory bounds the number of
+ * chunks to BXISTRETCH_DIRECTORY_SIZE squared.
+ *
+ * A reserved stretch, created by bxistretch_new_reserved(), reserves the
+ * virtual addresses of its largest size at once and commits the memory
+ * chunk by chunk while it grows. Its elements are contiguous: the whole
+ * array can be walked or copied from bxistretch_data().
+ *
+ * A file stretch, created by bxistretch_new_file(), stores its elements
+ * in a file mapped in memory. A header at the beginning of the file
+ * records the element size, the chunk size and the element count, so the
+ * array can be reopened by bxistretch_open_file() in a later run without
+ * being rebuilt. The capacity of a file stretch is fixed at its creation.
+ *
+ * A sparse stretch, created by bxistretch_new_sparse(), only allocates the
+ * chunks which are hit, through the same directory as a concurrent stretch.
+ * Hitting a large index doesn't allocate the chunks before it, and
+ * bxistretch_next_chunk() skips the chunks never hit.
+ *
+ * Loops over many elements should rather work on contiguous runs, given
+ * by bxistretch_next_span(), or copy them with bxistretch_write() and
+ * bxistretch_read(), than call bxistretch_get() for each element.
+ * A chunk size which is a power of 2, as the default one, saves the
+ * divisions needed to find an element.
+ *
  */
 
 // *********************************************************************************
@@ -56,6 +87,14 @@
 
 #define BXISTRETCH_ARRAY_SIZE 64
 #define BXISTRETCH_DEFAULT_CHUNK_SIZE 1024
+#define BXISTRETCH_DIRECTORY_SIZE 4096
+
+/**
+ * The error code returned when the header of a stretch file is invalid
+ *
+ * @see bxistretch_open_file()
+ */
+#define BXISTRETCH_HEADER_ERROR 4340322     // Leet speak of HEADERR
 
 // *********************************************************************************
 // ********************************** Types   **************************************
@@ -87,6 +126,94 @@ bxistretch_p bxistretch_new(size_t chunk_size,
                             size_t element_size,
                             size_t element_nb);
 
+/**
+ * Allocate a stretchable array which can be hit, appended to and read by
+ * several threads at the same time.
+ *
+ * If the chunk_size is 0, a default size is selected.
+ *
+ * @param chunk_size the overhead of allocated element
+ * @param element_size size of the element to store
+ * @param element_nb number of element at the initialization
+ *
+ * @returns   pointer on the newly allocated stretchable array
+ */
+bxistretch_p bxistretch_new_concurrent(size_t chunk_size,
+                                       size_t element_size,
+                                       size_t element_nb);
+
+/**
+ * Allocate a stretchable array whose elements are contiguous in memory.
+ *
+ * The address space of element_max elements is reserved but not committed,
+ * the memory is committed by chunks of chunk_size elements when the array
+ * grows. If the chunk_size is 0, a default size is selected.
+ *
+ * @param chunk_size the overhead of allocated element
+ * @param element_size size of the element to store
+ * @param element_nb number of element at the initialization
+ * @param element_max maximum number of element of the array
+ *
+ * @returns   pointer on the newly allocated stretchable array,
+ *            NULL if the address space can't be reserved
+ */
+bxistretch_p bxistretch_new_reserved(size_t chunk_size,
+                                     size_t element_size,
+                                     size_t element_nb,
+                                     size_t element_max);
+
+/**
+ * Allocate a stretchable array stored in a new file.
+ *
+ * The file holds a header and the space of element_max elements, it is
+ * written back by the kernel and is left read-only once created.
+ * If the chunk_size is 0, a default size is selected.
+ *
+ * @param filename path of the file to create, it must not exist
+ * @param chunk_size the overhead of allocated element
+ * @param element_size size of the element to store
+ * @param element_max maximum number of element of the array
+ * @param[out] result the newly allocated stretchable array
+ *
+ * @return BXIERR_OK on success, anything else on error
+ */
+bxierr_p bxistretch_new_file(const char * filename,
+                             size_t chunk_size,
+                             size_t element_size,
+                             size_t element_max,
+                             bxistretch_p * result);
+
+/**
+ * Open a stretchable array from a file created by bxistretch_new_file().
+ *
+ * The file is mapped privately: the elements can be read, changed and
+ * hit up to the capacity of the file, but the file itself is left unchanged.
+ *
+ * @param filename path of the file to open
+ * @param element_size expected size of the elements
+ * @param[out] result the opened stretchable array
+ *
+ * @return BXIERR_OK on success, BXISTRETCH_HEADER_ERROR if the header
+ *         doesn't match the file or the element_size, anything else on error
+ */
+bxierr_p bxistretch_open_file(const char * filename,
+                              size_t element_size,
+                              bxistretch_p * result);
+
+/**
+ * Allocate a stretchable array which only allocates the chunks hit.
+ *
+ * Like a concurrent array, it can be hit by several threads at once.
+ * If the chunk_size is 0, a default size is selected.
+ *
+ * @param chunk_size the overhead of allocated element
+ * @param element_size size of the element to store
+ *
+ * @returns   pointer on the newly allocated stretchable array
+ */
+bxistretch_p bxistretch_new_sparse(size_t chunk_size,
+                                   size_t element_size);
+
 /**
  * Destroy a stretchable array.
  *
@@ -101,7 +228,8 @@ void bxistretch_destroy(bxistretch_p *stretch_p);
  * @param self array on which the element has been store
  * @param index index of the wanted element
  *
- * @returns  pointer on the element
+ * @returns  pointer on the element, NULL if the element (or its chunk
+ *           for a sparse array) wasn't hit
  */
 void * bxistretch_get(bxistretch_p self, size_t index);
 
@@ -116,6 +244,101 @@ void * bxistretch_get(bxistretch_p self, size_t index);
  */
 void * bxistretch_hit(bxistretch_p self, size_t index);
 
+/**
+ * Allocate the memory space of a new element after all the elements
+ * hit or appended so far.
+ *
+ * On a concurrent stretch, each thread gets a different element.
+ *
+ * @param self array on which the element has to be store
+ * @param[out] index the index of the new element
+ * @returns pointer on the new element, NULL if the array can't grow
+ *
+ */
+void * bxistretch_append(bxistretch_p self, size_t * index);
+
+/**
+ * Return the first element of a reserved or file stretchable array.
+ *
+ * The elements of such an array are contiguous, so the returned pointer
+ * addresses all the elements up to the last one hit.
+ *
+ * @param self a stretchable array
+ * @returns the first element, NULL if the elements aren't contiguous
+ *
+ */
+void * bxistretch_data(bxistretch_p self);
+
+/**
+ * Return the elements of the first allocated chunk holding or following
+ * an index.
+ *
+ * The chunks of a sparse array which were never hit are skipped.
+ * All the allocated chunks are walked with:
+ * @code
+ * size_t index = 0, count;
+ * for (char * data = bxistretch_next_chunk(self, &index, &count);
+ *      NULL != data;
+ *      index += count, data = bxistretch_next_chunk(self, &index, &count)) {
+ *     // data holds the elements index to index + count - 1
+ * }
+ * @endcode
+ *
+ * @param self a stretchable array
+ * @param[in,out] index the index to start from, set to the index of the
+ *                first returned element
+ * @param[out] count the number of contiguous elements returned
+ * @returns the element at index, NULL if no chunk is allocated after index
+ *
+ */
+void * bxistretch_next_chunk(bxistretch_p self, size_t * index, size_t * count);
+
+/**
+ * Return the longest run of contiguous elements holding or following
+ * an index.
+ *
+ * It works as bxistretch_next_chunk() but a run isn't limited to a chunk:
+ * all the elements left in a reserved or file array are returned at once,
+ * and adjacent chunks are merged when they are adjacent in memory.
+ *
+ * @param self a stretchable array
+ * @param[in,out] index the index to start from, set to the index of the
+ *                first returned element
+ * @param[out] count the number of contiguous elements returned
+ * @returns the element at index, NULL if no element is allocated after index
+ *
+ */
+void * bxistretch_next_span(bxistretch_p self, size_t * index, size_t * count);
+
+/**
+ * Copy n elements into the array from index, hitting them.
+ *
+ * @param self a stretchable array
+ * @param index index of the first element to write
+ * @param n number of elements to write
+ * @param buf the n elements to copy
+ * @returns the number of elements written, less than n if the array
+ *          can't grow up to index + n
+ *
+ */
+size_t bxistretch_write(bxistretch_p self, size_t index, size_t n, const void * buf);
+
+/**
+ * Copy up to n elements of the array from index.
+ *
+ * The elements of the chunks of a sparse array which were never hit are
+ * read as zeros.
+ *
+ * @param self a stretchable array
+ * @param index index of the first element to read
+ * @param n number of elements to read
+ * @param[out] buf the buffer receiving the elements
+ * @returns the number of elements read, less than n if the array doesn't
+ *          hold index + n elements
+ *
+ */
+size_t bxistretch_read(bxistretch_p self, size_t index, size_t n, void * buf);
+
 /**
  * @example bxistretch.c
  * An example on how to use the module stretch.
@@ -130,4 +130,25 @@ bxierr_p bxivector_apply(bxivector_p self,
                          bxierr_p (*func)(void* elem, void* data),
                          void* data) ;
 
+/**
+ * Apply the provided function on all elements, in parallel on the threads
+ * of bximap.
+ *
+ * Each thread collects the errors of its elements, the lists are merged
+ * at the end: the errors are not in the order of the elements. Without
+ * bximap initialized, the elements are processed as by bxivector_apply().
+ *
+ * @param self a vector
+ * @param func a function, called by several threads at the same time
+ * @param data some data given as the last parameter of `func` for each element
+ *        in the given `vector`
+ * @return BXIERR_OK, bxierr(code=BXIVECTOR_APPLY_ERR) on error.
+ * @see bxierr_p
+ * @see bximap_init
+ *
+ */
+bxierr_p bxivector_apply_parallel(bxivector_p self,
+                                  bxierr_p (*func)(void* elem, void* data),
+                                  void* data);
+
 #endif /* BXIMISC_H_ */
@@ -10,17 +10,22 @@
 # Please contact Bull S. A. S. for details about its license.
 ###############################################################################
 */
-//#define ZMQ
-//#define FADD
 #define _GNU_SOURCE
 #include <sched.h>
 
+#include <stdio.h> // fopen
 #include <stdlib.h> // getenv
 #include <sys/sysinfo.h> // get_nprocs_conf
 #include <pthread.h>
 #include <math.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <bxi/base/log.h>
 
 
@@ -32,9 +37,6 @@
 #include <bxi/util/misc.h>
 
 #include <bxi/util/vector.h>
-#ifdef ZMQ
-#include <bxi/base/zmq.h>
-#endif
 
 #include "bxi/util/map.h"
 
@@ -48,63 +50,481 @@
 #define NO_CONTEXT_MSG "bximap got NULL context"
 #define NULL_PTR_MSG "bximap got NULL context pointer"
 #define ARG_ERROR_MSG "Argument Error"
+#define NOT_RUNNING_MSG "bximap context is not running"
+
+#define BXIMAP_CACHE_LINE 64
+#define BXIMAP_ERRORS_INIT_SIZE 8
+#define BXIMAP_SPIN_DEFAULT 4096   // Polls of an idle thread before it parks
+#define BXIMAP_AUTO_ENTRIES 64     // Map functions tracked by BXIMAP_SCHED_AUTO
+#define BXIMAP_AUTO_TASK_TIME 50e-6     // Seconds, hides the dispatch overhead
+#define BXIMAP_AUTO_TASKS_PER_THREAD 4  // Bounds the tail of the map
+#define BXIMAP_SYSFS_CPU "/sys/devices/system/cpu"
+#define BXIMAP_QUEUE_SIZE 4096     // Cells of the queue of bximap_submit(), power of 2
+#define BXIMAP_SORT_BLOCK 16384    // Least elements of a block of sort and scan
+#define BXIMAP_SORT_BLOCKS 4       // Blocks of sort and scan per thread
+#define BXIMAP_RADIX_BITS 8        // Bits of the keys sorted by a radix pass
+#define BXIMAP_RADIX (1 << BXIMAP_RADIX_BITS)
 
 typedef enum {
     MAPPER_UNSET,
     MAPPER_INITIALIZED,
-    MAPPER_FORKED,
-    MAPPER_FOLLOW_FORKED,
+    MAPPER_FORKED,          // Child of a fork, the workers are not started yet
 } _state_mapper;
 
 // *********************************************************************************
 // ********************************** Types ****************************************
 // *********************************************************************************
 
+/* Job whose task is being run by a thread, see _do_job() */
+typedef struct _active_job_s_t {
+    bximap_ctx_p                    job;
+    const struct _active_job_s_t  * outer;
+} _active_job_s;
+
+/* Range of tasks owned by one thread with the BXIMAP_SCHED_STEAL schedule.
+ * The owner pops tasks from the front, thieves take the second half.
+ * Each deque sits on its own cache line. While the job runs, next and end
+ * are written under the lock with atomic stores, as they are read
+ * without it to skip empty deques. */
+typedef struct {
+    volatile int       lock;  // See _spin_lock()
+    bximap_task_idx_t  next;  // Next task to be done by the owner
+    bximap_task_idx_t  end;   // End of the owned range (excluded)
+} __attribute__((aligned(BXIMAP_CACHE_LINE))) _task_deque_s;
+
+/* Statistics of one thread, on its own cache line */
+typedef struct {
+    bximap_thread_stats_s s;
+} __attribute__((aligned(BXIMAP_CACHE_LINE))) _thread_stats_s;
+
+/* Counters of a thread while it works on a job */
+typedef struct {
+    uint64_t           busy;         // Timer ticks spent in func
+    bximap_task_idx_t  tasks;
+    bximap_task_idx_t  iterations;
+    bximap_task_idx_t  steals;
+} _work_s;
+
+/* A context is also the job describing its running execution:
+ * several contexts can be executed at the same time by the pool. */
 typedef struct bximap_ctx_s_t {
     bximap_task_idx_t  start;
     bximap_task_idx_t  end;
     bximap_task_idx_t  granularity;
-    bximap_task_idx_t  id;
     bxierr_p        (* func)(bximap_task_idx_t start,
                              bximap_task_idx_t end,
                              bximap_thrd_idx_t thread,
                              void * usr_data);
     void             * usr_data;
-    bxierr_p         * tasks_error;
+    bxierr_p         * tasks_error;  // Only grows when tasks fail
     bximap_thrd_idx_t  next_error;
+    bximap_thrd_idx_t  errors_size;
+    volatile int       errors_lock;
+    bximap_sched_e     sched;
+    void            (* callback)(bximap_ctx_p context, void * data);
+    void             * callback_data;
+    bool               stop_on_error;
+    void             * nd;           // _nd_s of bximap_new_nd()
+    const double     * weights;      // See bximap_set_weights()
+    double          (* cost)(bximap_task_idx_t i, void * data);
+    void             * cost_data;
+    // Execution state, only meaningful while the context is running
+    volatile int       running;      // Set while the context is executed
+    volatile int       cancelled;    // No more tasks are claimed
+    bximap_sched_e     run_sched;    // Schedule of the running execution
+    bximap_thrd_idx_t  nb_threads;   // Size of the pool when it started
+    bximap_task_idx_t  nb_tasks;
+    bximap_task_idx_t  task_size;    // Iterations of each task
+    bximap_task_idx_t  spread;       // Additional iterations of each task
+    bximap_task_idx_t  spread_rest;  // Tasks with one more iteration
+    bximap_task_idx_t * bounds;      // First iteration of each weighted task
+    bximap_task_idx_t  bounds_size;
+    _task_deque_s    * deques;       // One per thread, allocated on first steal
+    bximap_thrd_idx_t  deques_nb;
+    // Statistics of the last execution, see bximap_get_stats()
+    bximap_stats_mode_e timer;       // Timing of the running execution
+    _thread_stats_s  * stats;        // One per thread, allocated on first use
+    bximap_thrd_idx_t  stats_nb;
+    bximap_thread_stats_s * stats_out; // Returned by bximap_get_stats()
+    uint64_t           start_ticks;
+    double             duration;
+    // Protected by shared_info.jobs_mutex
+    bximap_thrd_idx_t  workers;      // Threads currently running its tasks
+    double             busy_time;    // Time spent in func by all the threads
+    bool               listed;       // Tasks may remain to be claimed
+    bool               done;         // All tasks ended, callback called
+    bximap_ctx_p       next_job;     // Next job in shared_info.jobs
+    bximap_ctx_p       parent_job;   // Job whose task executes it synchronously
+    // Shared counter of BXIMAP_SCHED_DYNAMIC, away from the fields above
+    char               pad[BXIMAP_CACHE_LINE];
+    bximap_task_idx_t  next_task;
 } bximap_ctx_s;
 
+/* Internal data of bximap_reduce() given to _reduce_func() */
+typedef struct {
+    bxierr_p        (* func)(bximap_task_idx_t start,
+                             bximap_task_idx_t end,
+                             bximap_thrd_idx_t thread,
+                             void * acc,
+                             void * usr_data);
+    void            (* identity)(void * acc, void * usr_data);
+    char             * accs;         // One accumulator per thread of the job
+    bximap_thrd_idx_t  nb_threads;   // Set with accs by the first task
+    size_t             acc_stride;   // Accumulators sit on their own cache lines
+    void             * usr_data;
+} _reduce_s;
+
+/* Internal data of bximap_sort() and bximap_sort_by_key(), the elements
+ * go from src to dst at each round */
+typedef struct {
+    char             * src;
+    char             * dst;
+    size_t             size;
+    size_t             n;
+    size_t             block;        // Elements of a block
+    int             (* compar)(const void * a, const void * b);
+    size_t             width;        // Elements of the sorted runs to merge
+    size_t             pieces;       // Pieces of each merge
+    uint64_t        (* key)(const void * elem);
+    uint64_t         * keys_src;
+    uint64_t         * keys_dst;
+    uint64_t         * max_keys;     // Largest key of each block
+    size_t           * counts;       // Radix counts, then offsets, of each block
+    unsigned int       shift;        // First bit of the radix pass
+} _sort_s;
+
+/* Internal data of bximap_scan() */
+typedef struct {
+    const int64_t    * in;
+    int64_t          * out;
+    size_t             n;
+    size_t             block;        // Elements of a block
+    int64_t          * sums;         // Sum of each block, then its offset
+    bool               inclusive;
+} _scan_s;
+
+/* Multi-dimensional map of bximap_new_nd(), the tiles are the iterations
+ * of a 1-D map run by _nd_func() */
+typedef struct {
+    bxierr_p        (* func)(const bximap_tile_s * tile,
+                             bximap_thrd_idx_t thread,
+                             void * usr_data);
+    void             * usr_data;
+    int                dims;
+    bximap_task_idx_t  start[BXIMAP_ND_MAX];
+    bximap_task_idx_t  end[BXIMAP_ND_MAX];
+    bximap_task_idx_t  tile[BXIMAP_ND_MAX];
+    bximap_task_idx_t  tiles[BXIMAP_ND_MAX]; // Number of tiles of each dimension
+    unsigned int       bits[BXIMAP_ND_MAX];  // Bits of the tile coordinates
+    unsigned int       max_bits;
+} _nd_s;
+
+/* Execution statistics of a map function, used by BXIMAP_SCHED_AUTO */
+typedef struct {
+    bxierr_p        (* func)(bximap_task_idx_t start,
+                             bximap_task_idx_t end,
+                             bximap_thrd_idx_t thread,
+                             void * usr_data);
+    double             iteration_time;  // Smoothed time of one iteration
+} _auto_entry_s;
+
+/* Result of a call given to bximap_submit() */
+typedef struct bximap_future_s_t {
+    volatile int       done;
+    bxierr_p           result;
+} bximap_future_s;
+
+/* Call given to bximap_submit() */
+typedef struct {
+    bxierr_p        (* func)(void * arg);
+    void             * arg;
+    bximap_future_p    future;       // NULL if nobody waits for the result
+    volatile int     * calls;        // Decremented once not pending, may be NULL
+} _pool_task_s;
+
+/* Cell of the queue of submitted calls: its sequence number tells whether
+ * the cell is ready to be pushed or popped at a given position */
+typedef struct {
+    volatile size_t    seq;
+    _pool_task_s       task;
+} _queue_cell_s;
+
+/* Node of a graph: a map or a single call, and the nodes waiting for it */
+typedef struct {
+    struct bximap_graph_s_t * graph;
+    bximap_ctx_p       map;          // NULL for a call
+    bxierr_p        (* func)(void * arg);
+    void             * arg;
+    size_t           * next;         // Nodes depending on this one
+    size_t             next_nb;
+    size_t             next_size;
+    size_t             preds;        // Number of nodes this one depends on
+    volatile size_t    preds_left;   // Not yet returned, during the execution
+} _graph_node_s;
+
+typedef struct bximap_graph_s_t {
+    _graph_node_s    * nodes;
+    size_t             nodes_nb;
+    size_t             nodes_size;
+    // Execution state, only meaningful while the graph is executed
+    volatile int       running;
+    volatile size_t    nodes_left;   // Nodes not yet returned
+    volatile int       calls;        // Submitted calls still pending
+    volatile int       done;
+    volatile int       errors_lock;
+    bxierr_p           err;          // Errors of the nodes, chained
+} bximap_graph_s;
+
+/* Stage of a pipeline and the queue of its input batches.
+ * A single activation of the stage runs at a time: the queue has a single
+ * producer, the previous stage, and a single consumer. */
+typedef struct {
+    struct bximap_pipeline_s_t * pipeline;
+    size_t             index;
+    bxierr_p        (* func)(void * batch, void ** out, void * usr_data);
+    void             * usr_data;
+    void            ** ring;         // Input batches, NULL for the first stage
+    volatile int       scheduled;    // An activation is submitted or running
+    volatile int       ended;        // No more batch will be pushed to the next stage
+    char               pad0[BXIMAP_CACHE_LINE];
+    volatile size_t    head;         // Next batch to pop, by this stage
+    char               pad1[BXIMAP_CACHE_LINE];
+    volatile size_t    tail;         // Next batch to push, by the previous stage
+} _stage_s;
+
+typedef struct bximap_pipeline_s_t {
+    _stage_s        ** stages;
+    size_t             stages_nb;
+    size_t             depth;        // Size of the queues, power of 2
+    // Execution state, only meaningful while the pipeline is executed
+    volatile int       running;
+    volatile int       stopping;     // The first stage must end
+    volatile int       finished;     // The last stage has ended
+    volatile int       active;       // Activations not returned yet
+    volatile int       calls;        // Submitted activations still pending
+    volatile int       done;
+    volatile int       errors_lock;
+    bxierr_p           err;          // Errors of the stages, chained
+} bximap_pipeline_s;
+
+/* Position of a CPU in the topology, see _place_cpus() */
+typedef struct {
+    bximap_cpu_idx_t   cpu;
+    int                package;      // Socket
+    int                core;         // Core id, unique within the socket
+    int                core_rank;    // Rank of the core within the socket
+    int                smt;          // Rank of the CPU within the core
+} _cpu_topo_s;
 
 typedef struct {
-    bximap_ctx_p        global_task;
-    bximap_ctx_s      * tasks;
-    bximap_thrd_idx_t   nb_threads;
-    bximap_task_idx_t   nb_tasks;
-    bximap_thrd_idx_t   ended; // Number of ended threads
+    bximap_thrd_idx_t   nb_threads;  // Active threads, see bximap_resize()
+    bximap_thrd_idx_t   nb_created;  // Threads started, the master included
     pthread_t         * threads_id;
-    bximap_thrd_idx_t * threads_args;
+    bximap_cpu_idx_t  * threads_cpu; // CPU of each thread, -1 if not bound
+    int               * threads_node;// NUMA node of each thread, 0 if unknown
+    // Cpus the process could run on before the master was bound to its cpu
+    bximap_cpu_idx_t  * allowed_cpus;
+    size_t              allowed_nb;
+    // Affinity of the master before it was bound, restored by bximap_finalize()
+    cpu_set_t         * master_mask;
+    size_t              master_mask_size;
     _state_mapper       state;
-#ifndef ZMQ
-    bximap_task_idx_t   next_task;
-#else
-    void              * context;
-    void              * zocket_pub;
-    void              * zocket_tasks;
-    void              * zocket_result;
-#endif
+    pthread_t           master;      // Thread which initialized the pool
+    pthread_mutex_t     jobs_mutex;  // Protects the fields below
+    bximap_ctx_p        jobs;        // Jobs which may have tasks to claim
+    bximap_thrd_idx_t   running;     // Number of running jobs
+    bool                stopping;    // The workers must exit
+    // Doorbell rung when a job starts or ends, see _doorbell_wait()
+    volatile int        epoch;
+    volatile int        sleepers;    // Threads parked on epoch
+    // Rung when the number of active threads changes
+    volatile int        resize_epoch;
+    volatile int        pending;     // Submitted calls not yet returned
+    // Bounded queue of the submitted calls, see _queue_push()
+    _queue_cell_s     * queue;
+    // Pushers and poppers update their position on separate cache lines
+    volatile size_t     queue_tail __attribute__((aligned(BXIMAP_CACHE_LINE)));
+    volatile size_t     queue_head __attribute__((aligned(BXIMAP_CACHE_LINE)));
 } _intern_info;
 
 // *********************************************************************************
 // **************************** Static function declaration ************************
 // *********************************************************************************
+/* Short critical sections only: waiters spin */
+static inline void _spin_lock(volatile int * lock) {
+    while (__sync_lock_test_and_set(lock, 1)) {
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED)) continue;
+    }
+}
+
+static inline void _spin_unlock(volatile int * lock) {
+    __sync_lock_release(lock);
+}
+
+static inline bool _cancelled(bximap_ctx_p job) {
+    return __atomic_load_n(&job->cancelled, __ATOMIC_RELAXED);
+}
+
+static inline void _cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static void _doorbell_wait(int epoch, unsigned int * spins);
+static void _doorbell_ring(void);
+
 static void _mapper_parent_before_fork(void);
 static void _mapper_parent_after_fork(void);
 static void _mapper_once(void);
-static bxierr_p _do_job(bximap_ctx_p task, bximap_thrd_idx_t thread_id);
+static void _mapper_child_after_fork(void);
+static bxierr_p _check_pool(void);
+static bximap_thrd_idx_t _current_thread(void);
+static bxierr_p _prepare_job(bximap_ctx_p job);
+static bxierr_p _start_job(bximap_ctx_p job, bool participate, bximap_ctx_p parent);
+static void _submit_job(bximap_ctx_p job, bool participate);
+static void _leave_job(bximap_ctx_p job, double working_time);
+static void _end_job(bximap_ctx_p job);
+static bxierr_p _wait_jobs(bximap_ctx_p * jobs, size_t n,
+                           bximap_thrd_idx_t thread_id, size_t * idx);
+static bxierr_p _work_on(bximap_ctx_p job, bximap_thrd_idx_t thread_id);
+static bxierr_p _do_job(bximap_ctx_p job,
+                        bximap_task_idx_t start,
+                        bximap_task_idx_t end,
+                        bximap_thrd_idx_t thread_id);
+static bxierr_p _weighted_bounds(bximap_ctx_p job);
+static bxierr_p _even_weighted_bounds(bximap_ctx_p job);
+static void _even_bounds(bximap_ctx_p job,
+                         bximap_task_idx_t task_idx,
+                         bximap_task_idx_t * start,
+                         bximap_task_idx_t * end);
+static void _task_bounds(bximap_ctx_p job,
+                         bximap_task_idx_t task_idx,
+                         bximap_task_idx_t * start,
+                         bximap_task_idx_t * end);
+static void _append_error(bximap_ctx_p context, bxierr_p err);
+static bxierr_p _run_tasks(bximap_ctx_p job,
+                           bximap_thrd_idx_t thread_id,
+                           _work_s * work);
+static void _run_task(bximap_ctx_p job,
+                      bximap_task_idx_t start,
+                      bximap_task_idx_t end,
+                      bximap_thrd_idx_t thread_id,
+                      _work_s * work);
+static uint64_t _timer_now(bximap_stats_mode_e timer);
+static double _timer_seconds(bximap_stats_mode_e timer, uint64_t ticks);
+static void _tsc_calibrate(void);
+static void _add_wait_time(bximap_ctx_p job, bximap_thrd_idx_t thread_id,
+                           uint64_t since);
+static bool _deque_pop(_task_deque_s * deque, bximap_task_idx_t * task_idx);
+static bool _deque_steal_from(bximap_ctx_p job,
+                              bximap_thrd_idx_t thread_id,
+                              bximap_thrd_idx_t victim_id,
+                              bximap_task_idx_t * task_idx);
+static bool _deque_steal(bximap_ctx_p job,
+                         bximap_thrd_idx_t thread_id,
+                         bximap_task_idx_t * task_idx);
+static bool _deque_take(_task_deque_s * deque,
+                        bximap_task_idx_t * first,
+                        bximap_task_idx_t * end);
+static bool _guided_next(bximap_ctx_p job,
+                         bximap_task_idx_t * start,
+                         bximap_task_idx_t * end);
+static bximap_task_idx_t _auto_granularity(bximap_ctx_p job,
+                                           bximap_task_idx_t granularity);
+static void _auto_record(bximap_ctx_p job);
+static bxierr_p _reduce_func(bximap_task_idx_t start,
+                             bximap_task_idx_t end,
+                             bximap_thrd_idx_t thread,
+                             void * usr_data);
+static bxierr_p _run_blocks(size_t nb_blocks,
+                            bxierr_p (*func)(bximap_task_idx_t start,
+                                             bximap_task_idx_t end,
+                                             bximap_thrd_idx_t thread,
+                                             void * usr_data),
+                            void * usr_data);
+static size_t _nb_blocks(size_t n);
+static bxierr_p _sort_block_func(bximap_task_idx_t start,
+                                 bximap_task_idx_t end,
+                                 bximap_thrd_idx_t thread,
+                                 void * usr_data);
+static bxierr_p _merge_func(bximap_task_idx_t start,
+                            bximap_task_idx_t end,
+                            bximap_thrd_idx_t thread,
+                            void * usr_data);
+static size_t _merge_corank(_sort_s * sort, size_t k,
+                            const char * left, size_t nl,
+                            const char * right, size_t nr);
+static bxierr_p _copy_func(bximap_task_idx_t start,
+                           bximap_task_idx_t end,
+                           bximap_thrd_idx_t thread,
+                           void * usr_data);
+static bxierr_p _key_func(bximap_task_idx_t start,
+                          bximap_task_idx_t end,
+                          bximap_thrd_idx_t thread,
+                          void * usr_data);
+static bxierr_p _radix_count_func(bximap_task_idx_t start,
+                                  bximap_task_idx_t end,
+                                  bximap_thrd_idx_t thread,
+                                  void * usr_data);
+static bxierr_p _radix_scatter_func(bximap_task_idx_t start,
+                                    bximap_task_idx_t end,
+                                    bximap_thrd_idx_t thread,
+                                    void * usr_data);
+static bxierr_p _scan_sum_func(bximap_task_idx_t start,
+                               bximap_task_idx_t end,
+                               bximap_thrd_idx_t thread,
+                               void * usr_data);
+static bxierr_p _scan_write_func(bximap_task_idx_t start,
+                                 bximap_task_idx_t end,
+                                 bximap_thrd_idx_t thread,
+                                 void * usr_data);
+static bxierr_p _nd_func(bximap_task_idx_t start,
+                         bximap_task_idx_t end,
+                         bximap_thrd_idx_t thread,
+                         void * usr_data);
+static void _nd_tile(const _nd_s * nd, bximap_task_idx_t rank, bximap_task_idx_t * coords);
+static void _nd_free(_nd_s ** nd);
+static bxierr_p _parse_schedule(const char * str, bximap_sched_e * sched);
 static void * _start_function(void * arg);
+static bxierr_p _create_threads(bximap_thrd_idx_t first, bximap_thrd_idx_t last);
+static bximap_ctx_p _join_next(bximap_thrd_idx_t thread_id,
+                               bximap_ctx_p * awaited, size_t n);
+static bool _is_active(bximap_ctx_p job);
+static bool _descends(bximap_ctx_p job, bximap_ctx_p * awaited, size_t n);
+static void _resize_ring(void);
+static void _queue_reset(void);
+static bool _queue_push(const _pool_task_s * task);
+static bool _queue_pop(_pool_task_s * task);
+static void _run_pool_task(_pool_task_s * task);
+static bxierr_p _wait_flag(volatile int * flag, int value);
+static void _submit_call(bxierr_p (*func)(void * arg), void * arg,
+                         bximap_future_p future, volatile int * calls);
+static bxierr_p _graph_run(void * arg);
+static bool _graph_acyclic(bximap_graph_p graph);
+static bool _stage_ready(_stage_s * stage);
+static void _stage_schedule(_stage_s * stage);
+static void _stage_end(_stage_s * stage);
+static bxierr_p _stage_run(void * arg);
+static void _pipeline_release(bximap_pipeline_p pipeline);
 static bxierr_p _fill_vector_with_cpu(bximap_cpu_idx_t first_cpu,
                                       bximap_cpu_idx_t last_cpu,
                                       bxivector_p vcpu);
+static bxierr_p _map_threads(bximap_thrd_idx_t nb_threads,
+                             bximap_cpu_idx_t * threads_cpu);
+static bxierr_p _read_allowed(bximap_cpu_idx_t ** cpus, size_t * nb_cpus);
+static bxierr_p _read_affinity(cpu_set_t ** mask, size_t * size);
+static bxierr_p _place_cpus(bximap_place_e place,
+                            const bximap_cpu_idx_t * cpus,
+                            size_t nb_cpus,
+                            bximap_cpu_idx_t * placed,
+                            size_t * nb_placed);
+static void _read_topology(bximap_cpu_idx_t cpu, _cpu_topo_s * topo);
+static int _read_node(bximap_cpu_idx_t cpu);
+static int _compare_compact(const void * a, const void * b);
+static int _compare_scatter(const void * a, const void * b);
 
 // *********************************************************************************
 // ********************************** Global Variables *****************************
@@ -115,37 +535,33 @@ SET_LOGGER(MAPPER_LOGGER, BXILOG_LIB_PREFIX "bxiutil.map");
 pthread_once_t mapper_once_control = PTHREAD_ONCE_INIT;
 
 
-#ifndef ZMQ
-#ifdef FADD
-pthread_mutex_t cond_mutex;
-pthread_cond_t wait_work;
-#else
-pthread_barrier_t barrier;
-#endif
-#else
-pthread_barrier_t zmq_barrier;
-#define MAP_TASK_ZMQ_URL "inproc://map_tasks"
-#define MAP_RESULT_ZMQ_URL "inproc://map_results"
-#define MAP_PUB_ZMQ_URL "inproc://map_pub"
-#endif
-
-
-struct bximap_ctx_s_t last_task = {
-    .start = 0,
-    .end = 0,
-    .granularity = 0,
-    .func = NULL,
-    .usr_data = NULL};
-
-
 _intern_info shared_info = {
-    NULL,
-    .state = MAPPER_UNSET,
     .nb_threads = 0,
+    .state = MAPPER_UNSET,
 };
 
+// Index of the pool thread, -1 outside the workers
+static __thread bximap_thrd_idx_t worker_id = -1;
+// Job whose task the thread is running, see bximap_cancel()
+static __thread bximap_ctx_p current_job = NULL;
+// Jobs whose tasks are on the stack of the thread, innermost first
+static __thread const _active_job_s * active_jobs = NULL;
+
 bxivector_p vcpus = NULL;
 
+bximap_place_e placement = BXIMAP_PLACE_NONE;
+const char * sysfs_cpu = BXIMAP_SYSFS_CPU;    // Root of the topology
+
+bximap_sched_e default_sched = BXIMAP_SCHED_DYNAMIC;
+
+unsigned int spin_budget = BXIMAP_SPIN_DEFAULT;
+
+_auto_entry_s auto_table[BXIMAP_AUTO_ENTRIES];
+volatile int auto_lock = 0;
+
+bximap_stats_mode_e stats_mode = BXIMAP_STATS_CLOCK;
+double tsc_hz = 0;    // Time stamp counter ticks per second
+
 
 /* Initialize a new mapping
  * Map the iteration from start to end over the threads
@@ -166,6 +582,10 @@ bxierr_p bximap_new(bximap_task_idx_t start,
 
     if (*task_p == NULL) *task_p = bximem_calloc(sizeof(**task_p));
     bximap_ctx_p task = *task_p;
+    // The tiles of a previous bximap_new_nd() on the same context
+    _nd_s * nd = task->nd;
+    _nd_free(&nd);
+    task->nd = NULL;
     task->start = start;
     task->end = end;
     task->func = func;
@@ -174,13 +594,90 @@ bxierr_p bximap_new(bximap_task_idx_t start,
     return BXIERR_OK;
 }
 
+/* Affinity of the calling thread, to be released with CPU_FREE(). The mask
+ * is grown until the kernel accepts its size, so cpus beyond CPU_SETSIZE
+ * are kept */
+bxierr_p _read_affinity(cpu_set_t ** mask, size_t * size) {
+    size_t max = CPU_SETSIZE;
+    while (true) {
+        *mask = CPU_ALLOC(max);
+        if (NULL == *mask) return bxierr_errno("Calling CPU_ALLOC() failed");
+        *size = CPU_ALLOC_SIZE(max);
+        CPU_ZERO_S(*size, *mask);
+        errno = 0;
+        if (0 == sched_getaffinity(0, *size, *mask)) return BXIERR_OK;
+        CPU_FREE(*mask);
+        *mask = NULL;
+        if (EINVAL != errno) return bxierr_errno("Calling sched_getaffinity() failed");
+        max *= 2;
+    }
+}
+
+bxierr_p bximap_new_nd(int dims,
+                       const bximap_task_idx_t * start,
+                       const bximap_task_idx_t * end,
+                       const bximap_task_idx_t * tile,
+                       bxierr_p (*func)(const bximap_tile_s * tile,
+                                        bximap_thrd_idx_t thread,
+                                        void * usr_data),
+                       void * usr_data,
+                       bximap_ctx_p * task_p) {
+    bxiassert(NULL != task_p);
+    bxiassert(NULL != start && NULL != end && NULL != tile && NULL != func);
+
+    if (dims < 1 || dims > BXIMAP_ND_MAX) {
+        return bxierr_new(BXIMAP_ARG_ERROR, NULL, NULL, NULL, NULL,
+                          "Invalid number of dimensions %d", dims);
+    }
+    _nd_s * nd = bximem_calloc(sizeof(*nd));
+    nd->func = func;
+    nd->usr_data = usr_data;
+    nd->dims = dims;
+    bximap_task_idx_t nb_tiles = 1;
+    for (int k = 0; k < dims; k++) {
+        if (start[k] > end[k] || tile[k] <= 0) {
+            _nd_free(&nd);
+            return bxierr_new(BXIMAP_ARG_ERROR, NULL, NULL, NULL, NULL,
+                              "Invalid dimension %d: ["TASK_IDX_FMT", "TASK_IDX_FMT"[ "
+                              "by tiles of "TASK_IDX_FMT,
+                              k, start[k], end[k], tile[k]);
+        }
+        nd->start[k] = start[k];
+        nd->end[k] = end[k];
+        nd->tile[k] = tile[k];
+        nd->tiles[k] = (end[k] - start[k] + tile[k] - 1) / tile[k];
+        // The Z curve spans up to twice the tiles of each dimension
+        if (nd->tiles[k] > LLONG_MAX / 2
+            || (0 != nd->tiles[k] && nb_tiles > LLONG_MAX / nd->tiles[k])) {
+            _nd_free(&nd);
+            return bxierr_simple(BXIMAP_ARG_ERROR, "Too many tiles");
+        }
+        nb_tiles *= nd->tiles[k];
+        while (((bximap_task_idx_t)1 << nd->bits[k]) < nd->tiles[k]) nd->bits[k]++;
+        if (nd->bits[k] > nd->max_bits) nd->max_bits = nd->bits[k];
+    }
+
+    bxierr_p err = bximap_new(0, nb_tiles, 0, _nd_func, nd, task_p);
+    if (bxierr_isko(err)) {
+        _nd_free(&nd);
+        return err;
+    }
+    (*task_p)->nd = nd;
+    return BXIERR_OK;
+}
+
 bxierr_p bximap_destroy(bximap_ctx_p *ctx) {
 
     for (bximap_thrd_idx_t i = 0; i < (*ctx)->next_error; i++) {
-        bxierr_p err = (*ctx)->tasks_error[i];
-        bxierr_destroy(&err);
+        bxierr_destroy(&(*ctx)->tasks_error[i]);
     }
     BXIFREE((*ctx)->tasks_error);
+    BXIFREE((*ctx)->deques);
+    BXIFREE((*ctx)->stats);
+    BXIFREE((*ctx)->stats_out);
+    BXIFREE((*ctx)->bounds);
+    _nd_s * nd = (*ctx)->nd;
+    _nd_free(&nd);
     BXIFREE(*ctx);
     return BXIERR_OK;
 }
@@ -194,281 +691,696 @@ bxierr_p bximap_get_error(bximap_ctx_p context, bximap_thrd_idx_t *n, bxierr_p *
     return BXIERR_OK;
 }
 
-/* execute the work describe by the context */
-bxierr_p bximap_execute(bximap_ctx_p context) {
-    int rc = 0;
-    UNUSED(rc);
+bxierr_p bximap_set_schedule(bximap_ctx_p context, bximap_sched_e sched) {
     bxiassert(NULL != context);
 
-    if (shared_info.state != MAPPER_INITIALIZED) {
-        return bxierr_simple(BXIMAP_NOT_INITIALIZED, NOT_INITIALIZED_MSG);
+    if (sched > BXIMAP_SCHED_AFFINITY) {
+        return bxierr_simple(BXIMAP_ARG_ERROR, ARG_ERROR_MSG);
     }
+    context->sched = sched;
+    return BXIERR_OK;
+}
 
-    if (shared_info.global_task != &last_task
-        && shared_info.global_task != NULL) {
-        return bxierr_new(BXIMAP_RUNNING,
-                          NULL, NULL, NULL, NULL,
-                          RUNNING_MSG);
+bxierr_p bximap_set_weights(bximap_ctx_p context, const double * weights) {
+    bxiassert(NULL != context);
+
+    if (context->running) return bxierr_simple(BXIMAP_RUNNING, RUNNING_MSG);
+    context->weights = weights;
+    context->cost = NULL;
+    context->cost_data = NULL;
+    return BXIERR_OK;
+}
+
+bxierr_p bximap_set_cost(bximap_ctx_p context,
+                         double (*prefix)(bximap_task_idx_t i, void * data),
+                         void * data) {
+    bxiassert(NULL != context);
+
+    if (context->running) return bxierr_simple(BXIMAP_RUNNING, RUNNING_MSG);
+    context->weights = NULL;
+    context->cost = prefix;
+    context->cost_data = data;
+    return BXIERR_OK;
+}
+
+bxierr_p bximap_set_default_schedule(bximap_sched_e sched) {
+    if (BXIMAP_SCHED_DEFAULT == sched || sched > BXIMAP_SCHED_AFFINITY) {
+        return bxierr_simple(BXIMAP_ARG_ERROR, ARG_ERROR_MSG);
     }
+    default_sched = sched;
+    return BXIERR_OK;
+}
+
+/* execute the work describe by the context
+ * The calling thread takes part in the execution when it belongs to the pool,
+ * then helps the other running jobs until its own one is finished */
+bxierr_p bximap_execute(bximap_ctx_p context) {
+    bxiassert(NULL != context);
 
     struct timespec mapping_time;
-    bxitime_get(CLOCK_MONOTONIC, &mapping_time);
-    double running_duration = 0, mapping_duration = 0, tmp = 0;
-    UNUSED(running_duration);
-    UNUSED(tmp);
-
-    // Split the work between the threads.
-    shared_info.global_task = context;
-    bximap_task_idx_t cur_start = context->start;
-    bximap_task_idx_t granularity = context->granularity;
-    if (granularity == 0) {
-        granularity = (context->end - context->start) / (shared_info.nb_threads);
-        granularity /= 10;
-        if (granularity == 0) {
-            granularity++;
-        }
+    bxierr_p err = BXIERR_OK, err2;
+    err2 = bxitime_get(CLOCK_MONOTONIC, &mapping_time);
+    BXIERR_CHAIN(err, err2);
+    double mapping_duration = 0;
+
+    bximap_thrd_idx_t thread_id = _current_thread();
+    err2 = _start_job(context, thread_id >= 0, current_job);
+    if (bxierr_isko(err2)) {
+        BXIERR_CHAIN(err, err2);
+        return err;
     }
-    shared_info.nb_tasks = (context->end - context->start) / granularity;
-    if (shared_info.global_task->tasks_error != NULL) {
-        BXIFREE(shared_info.global_task->tasks_error);
+    if (thread_id >= 0 && !context->done) {
+        err2 = _work_on(context, thread_id);
+        BXIERR_CHAIN(err, err2);
     }
+    err2 = bximap_wait(context);
+    BXIERR_CHAIN(err, err2);
 
-    TRACE(MAPPER_LOGGER,
-          "tasks_error allocate "TASK_IDX_FMT" errors",
-          shared_info.nb_tasks);
-    shared_info.global_task->tasks_error = bximem_calloc((size_t)shared_info.nb_tasks *
-                                                         sizeof(*shared_info.global_task->tasks_error));
-    shared_info.global_task->next_error = 0;
+    err2 = bxitime_duration(CLOCK_MONOTONIC,
+                            mapping_time,
+                            &mapping_duration);
+    BXIERR_CHAIN(err, err2);
+    INFO(MAPPER_LOGGER, "Global map timing %f seconds", mapping_duration);
+    return err;
+}
 
-    bximap_task_idx_t remaining_work = (context->end - context->start) % granularity;
-    if (remaining_work != 0) {
-        // With this granularity some work remain
-        if (shared_info.nb_tasks % shared_info.nb_threads != 0) {
-            // Considering that each iteration takes the same time
-            // if the number of task isn't proportional to the number of threads
-            // the remaining work is done in an additional task
-            // this task will be done in parallel of other larger tasks
-            shared_info.nb_tasks++;
-            remaining_work = 0;
-        }
+bxierr_p bximap_set_spin_budget(int spins) {
+    if (spins < 0) return bxierr_simple(BXIMAP_ARG_ERROR, ARG_ERROR_MSG);
+    __atomic_store_n(&spin_budget, (unsigned int)spins, __ATOMIC_RELAXED);
+    return BXIERR_OK;
+}
+
+/* Start the execution without waiting for its end.
+ * Without worker, the calling thread runs all the tasks before returning */
+bxierr_p bximap_execute_async(bximap_ctx_p context, bximap_handle_p * handle) {
+    bxiassert(NULL != context);
+    bxiassert(NULL != handle);
+
+    bool inline_run = 1 == shared_info.nb_threads;
+    // The job may outlive the task starting it: it has no parent
+    bxierr_p err = _start_job(context, inline_run, NULL);
+    if (bxierr_isko(err)) return err;
+    if (inline_run && !context->done) {
+        err = _work_on(context, 0);
     }
+    *handle = context;
+    return err;
+}
 
-    shared_info.tasks = bximem_calloc((size_t)shared_info.nb_tasks * sizeof(*shared_info.tasks));
-    for (bximap_task_idx_t i = 0; i < shared_info.nb_tasks; i++) {
+bxierr_p bximap_test(bximap_handle_p handle, bool * done) {
+    bxiassert(NULL != handle);
+    bxiassert(NULL != done);
 
-        // Spread the remaining work among all
-        // First tasks could have less
-        // It's mandatory to have less work inside some tasks
-        bximap_task_idx_t additional_work = remaining_work / (shared_info.nb_tasks - i);
-        if (remaining_work % (shared_info.nb_tasks - i) != 0) {
-            additional_work++;
-        }
-        remaining_work -= additional_work;
+    if (!handle->running) return bxierr_simple(BXIMAP_ARG_ERROR, NOT_RUNNING_MSG);
+    *done = __atomic_load_n(&handle->done, __ATOMIC_ACQUIRE);
+    return BXIERR_OK;
+}
 
-        shared_info.tasks[i].granularity = granularity + additional_work;
+bxierr_p bximap_wait(bximap_handle_p handle) {
+    size_t idx;
+    return bximap_wait_any(&handle, 1, &idx);
+}
 
-        shared_info.tasks[i].func = shared_info.global_task->func;
-        shared_info.tasks[i].usr_data = shared_info.global_task->usr_data;
-        shared_info.tasks[i].start = cur_start;
-        shared_info.tasks[i].end = cur_start + shared_info.tasks[i].granularity;
-        if (shared_info.tasks[i].end > shared_info.global_task->end) {
-            shared_info.tasks[i].end = shared_info.global_task->end;
-        }
+bxierr_p bximap_wait_any(bximap_handle_p * handles, size_t n, size_t * idx) {
+    bxiassert(NULL != handles && 0 < n);
+    bxiassert(NULL != idx);
 
-        shared_info.tasks[i].id = i;
-        TRACE(MAPPER_LOGGER,
-              "Task: "                  TASK_IDX_FMT " "
-              "start: "                 TASK_IDX_FMT " "
-              "end: "                   TASK_IDX_FMT " "
-              "granularity: "           TASK_IDX_FMT " "
-              "granularity requested: " TASK_IDX_FMT,
-              i, shared_info.tasks[i].start, shared_info.tasks[i].end,
-              shared_info.tasks[i].granularity, granularity);
-        cur_start += shared_info.tasks[i].granularity;
+    for (size_t i = 0; i < n; i++) {
+        bxiassert(NULL != handles[i]);
+        if (!handles[i]->running) {
+            return bxierr_simple(BXIMAP_ARG_ERROR, NOT_RUNNING_MSG);
+        }
     }
-
-    TRACE(MAPPER_LOGGER,
-          "last task end: "    TASK_IDX_FMT " "
-          "global task end: "  TASK_IDX_FMT " "
-          "task granularity: " TASK_IDX_FMT " "
-          "nb tasks: "         TASK_IDX_FMT,
-          shared_info.tasks[shared_info.nb_tasks - 1].end,
-          shared_info.global_task->end,
-          shared_info.tasks[shared_info.nb_tasks - 1].granularity,
-          shared_info.nb_tasks);
-
-
-#ifndef ZMQ
-    shared_info.next_task  = shared_info.nb_threads;
-    shared_info.ended  = 0;
-#ifdef FADD
-    //start the task with all the threads
-    bxierr_p perr = BXIERR_OK;
-    rc = 0;
-    errno = 0;
-    rc = pthread_mutex_lock(&cond_mutex);
-    if (0 != rc) {
-        perr = bxierr_errno("Error on pthread mutex lock");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, perr, "Error");
+    bximap_thrd_idx_t thread_id = _current_thread();
+    uint64_t since = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (BXIMAP_STATS_OFF != handles[i]->timer) {
+            since = _timer_now(handles[i]->timer);
+            break;
+        }
     }
-    errno = 0;
-    rc = pthread_cond_broadcast(&wait_work);
-    if (0 != rc) {
-        perr = bxierr_errno("Error on pthread cond broadcast");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, perr, "Error");
+    bxierr_p err = _wait_jobs(handles, n, thread_id, idx);
+    _add_wait_time(handles[*idx], thread_id, since);
+    __sync_lock_release(&handles[*idx]->running);
+    return err;
+}
+
+bxierr_p bximap_wait_all(bximap_handle_p * handles, size_t n) {
+    bxiassert(NULL != handles);
+
+    bxierr_p err = BXIERR_OK, err2;
+    for (size_t i = 0; i < n; i++) {
+        err2 = bximap_wait(handles[i]);
+        BXIERR_CHAIN(err, err2);
     }
-    errno = 0;
-    rc = pthread_mutex_unlock(&cond_mutex);
-    if (0 != rc) {
-        perr = bxierr_errno("Error on pthread mutex unlock");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, perr, "Error");
+    return err;
+}
+
+bxierr_p bximap_set_callback(bximap_ctx_p context,
+                             void (*callback)(bximap_ctx_p context, void * data),
+                             void * data) {
+    bxiassert(NULL != context);
+
+    if (context->running) {
+        return bxierr_new(BXIMAP_RUNNING,
+                          NULL, NULL, NULL, NULL,
+                          RUNNING_MSG);
     }
-#else
-    __sync_synchronize();
-    errno = 0;
-    TRACE(MAPPER_LOGGER, "Enter barrier")
-    rc = pthread_barrier_wait(&barrier);
-    TRACE(MAPPER_LOGGER, "Leave barrier")
-    if (0 != rc && PTHREAD_BARRIER_SERIAL_THREAD != rc) {
-        bxierr_p perr = bxierr_errno("Error on pthread barrier wait");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, perr, "Error");
+    context->callback = callback;
+    context->callback_data = data;
+    return BXIERR_OK;
+}
+
+/* The call is run inline when no worker would pop it, or when the queue
+ * is full: the submitter is slowed down instead of failing */
+bxierr_p bximap_submit(bxierr_p (*func)(void * arg), void * arg,
+                       bximap_future_p * future) {
+    bxiassert(NULL != func);
+
+    bxierr_p err = _check_pool();
+    if (bxierr_isko(err)) return err;
+
+    bximap_future_p result = NULL;
+    if (NULL != future) {
+        result = bximem_calloc(sizeof(*result));
+        *future = result;
     }
-#endif
+    _submit_call(func, arg, result, NULL);
+    return BXIERR_OK;
+}
+
+bxierr_p bximap_future_test(bximap_future_p future, bool * done) {
+    bxiassert(NULL != future);
+    bxiassert(NULL != done);
 
-    struct timespec running_time;
+    *done = __atomic_load_n(&future->done, __ATOMIC_ACQUIRE);
+    return BXIERR_OK;
+}
 
-    bximap_task_idx_t nb_iterations = shared_info.tasks[0].end
-                                      - shared_info.tasks[0].start;
+bxierr_p bximap_future_wait(bximap_future_p * future) {
+    bxiassert(NULL != future);
+    bxiassert(NULL != *future);
 
-    bxierr_p err = bxitime_get(CLOCK_MONOTONIC, &running_time);
-    bxierr_p task_err = _do_job( &shared_info.tasks[0], 0);
-    bxierr_p err2 = bxitime_duration(CLOCK_MONOTONIC, running_time, &tmp);
+    bxierr_p err = _wait_flag(&(*future)->done, 1);
+    bxierr_p err2 = (*future)->result;
     BXIERR_CHAIN(err, err2);
-    running_duration += tmp;
-    if (bxierr_isko(task_err)) {
-        bximap_thrd_idx_t next_error = __sync_fetch_and_add(&shared_info.global_task->next_error, 1);
-        TRACE(MAPPER_LOGGER,
-              "thread:"THRD_IDX_FMT" next_error:"THRD_IDX_FMT,
-              (bximap_thrd_idx_t)0, next_error);
-        shared_info.global_task->tasks_error[next_error] = task_err;
-    }
+    BXIFREE(*future);
+    return err;
+}
 
-    bximap_task_idx_t next_task = __sync_fetch_and_add (&shared_info.next_task, 1);
-    while (next_task < shared_info.nb_tasks) {
-        nb_iterations += shared_info.tasks[next_task].end
-                         - shared_info.tasks[next_task].start;
-        err2 = bxitime_get(CLOCK_MONOTONIC, &running_time);
-        task_err = _do_job(&shared_info.tasks[next_task], 0);
-        BXIERR_CHAIN(err, err2);
-        double tmp_duration;
-        err2 = bxitime_duration(CLOCK_MONOTONIC, running_time, &tmp_duration);
-        BXIERR_CHAIN(err, err2);
-        running_duration += tmp_duration;
-        if (bxierr_isko(task_err)) {
-            bximap_thrd_idx_t next_error = __sync_fetch_and_add(&shared_info.global_task->next_error, 1);
-            TRACE(MAPPER_LOGGER,
-                  "thread:"THRD_IDX_FMT" next_error:"THRD_IDX_FMT,
-                  (bximap_thrd_idx_t)0, next_error);
-            shared_info.global_task->tasks_error[next_error] = task_err;
-        }
-        next_task = __sync_fetch_and_add (&shared_info.next_task, 1);
+bxierr_p bximap_graph_new(bximap_graph_p * graph) {
+    bxiassert(NULL != graph);
+
+    *graph = bximem_calloc(sizeof(**graph));
+    (*graph)->err = BXIERR_OK;
+    return BXIERR_OK;
+}
+
+bxierr_p bximap_graph_destroy(bximap_graph_p * graph) {
+    bxiassert(NULL != graph);
+    if (NULL == *graph) return BXIERR_OK;
+
+    for (size_t i = 0; i < (*graph)->nodes_nb; i++) BXIFREE((*graph)->nodes[i].next);
+    BXIFREE((*graph)->nodes);
+    BXIFREE(*graph);
+    return BXIERR_OK;
+}
+
+bxierr_p bximap_graph_add_map(bximap_graph_p graph, bximap_ctx_p context, size_t * node) {
+    bxiassert(NULL != context);
+
+    bxierr_p err = bximap_graph_add_call(graph, NULL, NULL, node);
+    if (bxierr_isko(err)) return err;
+    graph->nodes[*node].map = context;
+    return BXIERR_OK;
+}
+
+bxierr_p bximap_graph_add_call(bximap_graph_p graph,
+                               bxierr_p (*func)(void * arg), void * arg,
+                               size_t * node) {
+    bxiassert(NULL != graph);
+    bxiassert(NULL != node);
+
+    if (graph->running) return bxierr_simple(BXIMAP_RUNNING, RUNNING_MSG);
+    if (graph->nodes_nb == graph->nodes_size) {
+        size_t size = 0 == graph->nodes_size ? BXIMAP_ERRORS_INIT_SIZE : 2 * graph->nodes_size;
+        graph->nodes = bximem_realloc(graph->nodes,
+                                      graph->nodes_size * sizeof(*graph->nodes),
+                                      size * sizeof(*graph->nodes));
+        graph->nodes_size = size;
     }
-    INFO(MAPPER_LOGGER,
-         "Timing thread:"THRD_IDX_FMT" worked %f seconds "
-         "for "TASK_IDX_FMT" iterations",
-         (bximap_thrd_idx_t)0, running_duration, nb_iterations);
+    *node = graph->nodes_nb++;
+    _graph_node_s * new = &graph->nodes[*node];
+    memset(new, 0, sizeof(*new));
+    new->graph = graph;
+    new->func = func;
+    new->arg = arg;
+    return BXIERR_OK;
+}
 
-#ifdef FADD
-    while (shared_info.ended < shared_info.nb_threads - 1) {
-        __sync_synchronize();
+bxierr_p bximap_graph_add_edge(bximap_graph_p graph, size_t from, size_t to) {
+    bxiassert(NULL != graph);
+
+    if (graph->running) return bxierr_simple(BXIMAP_RUNNING, RUNNING_MSG);
+    if (from >= graph->nodes_nb || to >= graph->nodes_nb || from == to) {
+        return bxierr_simple(BXIMAP_ARG_ERROR, ARG_ERROR_MSG);
     }
-#else
-    __sync_synchronize();
-    errno = 0;
-    TRACE(MAPPER_LOGGER, "Enter barrier")
-    rc = pthread_barrier_wait(&barrier);
-    TRACE(MAPPER_LOGGER, "Leave barrier")
-    if (0 != rc && PTHREAD_BARRIER_SERIAL_THREAD != rc) {
-        err2 = bxierr_errno("Error on pthread barrier wait");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
+    _graph_node_s * node = &graph->nodes[from];
+    if (node->next_nb == node->next_size) {
+        size_t size = 0 == node->next_size ? BXIMAP_ERRORS_INIT_SIZE : 2 * node->next_size;
+        node->next = bximem_realloc(node->next,
+                                    node->next_size * sizeof(*node->next),
+                                    size * sizeof(*node->next));
+        node->next_size = size;
     }
-#endif
-#else
+    node->next[node->next_nb++] = to;
+    graph->nodes[to].preds++;
+    return BXIERR_OK;
+}
 
-    struct timespec sending_time, receiving_time;
-    double sending_duration, receiving_duration;
-    bxierr_p err = bxitime_get(CLOCK_MONOTONIC, &sending_time);
-    for (bximap_task_idx_t i = 0; i < shared_info.nb_tasks; i++) {
-        bxierr_p err2 = bxizmq_data_snd_zc(&shared_info.tasks[i],
-                                           sizeof(shared_info.tasks[i]),
-                                           shared_info.zocket_tasks, 0, 10, 10000,
-                                           NULL, NULL);
-        BXIERR_CHAIN(err, err2);
-    }
-    bxierr_p err2 = bxitime_duration(CLOCK_MONOTONIC,
-                                     sending_time,
-                                     &sending_duration);
-    BXIERR_CHAIN(err, err2);
-    err2 = bxitime_get(CLOCK_MONOTONIC, &receiving_time);
-    BXIERR_CHAIN(err, err2);
-    for (bximap_task_idx_t i = 0; i < shared_info.nb_tasks; i++) {
-        bxierr_p task_err = NULL;
-        bxierr_p * task_err_p = &task_err;
-        size_t received_size = 0;
-        err2 = bxizmq_data_rcv((void **)&task_err_p, sizeof(task_err),
-                               shared_info.zocket_result, 0, false,
-                               &received_size);
-        BXIERR_CHAIN(err, err2);
-        if (bxierr_isko(task_err)) {
-            bximap_thrd_idx_t next_error = shared_info.global_task->next_error++;
+/* Nodes without dependency are submitted, the others are submitted by the
+ * last node they depend on, see _graph_run() */
+bxierr_p bximap_graph_execute(bximap_graph_p graph) {
+    bxiassert(NULL != graph);
 
-            shared_info.global_task->tasks_error[next_error] = task_err;
-        }
+    bxierr_p err = _check_pool();
+    if (bxierr_isko(err)) return err;
+    if (__sync_lock_test_and_set(&graph->running, 1)) {
+        return bxierr_simple(BXIMAP_RUNNING, RUNNING_MSG);
     }
-    err2 = bxitime_duration(CLOCK_MONOTONIC,
-                            receiving_time,
-                            &receiving_duration);
+    if (!_graph_acyclic(graph)) {
+        __sync_lock_release(&graph->running);
+        return bxierr_new(BXIMAP_ARG_ERROR, NULL, NULL, NULL, NULL,
+                          "The graph of %zu nodes has a cycle", graph->nodes_nb);
+    }
+    if (0 == graph->nodes_nb) {
+        __sync_lock_release(&graph->running);
+        return BXIERR_OK;
+    }
+    graph->err = BXIERR_OK;
+    graph->done = 0;
+    for (size_t i = 0; i < graph->nodes_nb; i++) {
+        graph->nodes[i].preds_left = graph->nodes[i].preds;
+    }
+    __atomic_store_n(&graph->nodes_left, graph->nodes_nb, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < graph->nodes_nb; i++) {
+        if (0 != graph->nodes[i].preds) continue;
+        __atomic_add_fetch(&graph->calls, 1, __ATOMIC_SEQ_CST);
+        _submit_call(&_graph_run, &graph->nodes[i], NULL, &graph->calls);
+    }
+    // The last node sets done before its call stops being pending
+    err = _wait_flag(&graph->done, 1);
+    bxierr_p err2 = _wait_flag(&graph->calls, 0);
     BXIERR_CHAIN(err, err2);
-    INFO(MAPPER_LOGGER,
-         "Timing ZMQ send %f seconds, recv %f seconds",
-         sending_duration, receiving_duration);
-#endif
-    err2 = bxitime_duration(CLOCK_MONOTONIC,
-                            mapping_time,
-                            &mapping_duration);
+    err2 = graph->err;
     BXIERR_CHAIN(err, err2);
-    INFO(MAPPER_LOGGER, "Global map timing %f seconds", mapping_duration);
-
-    shared_info.global_task = NULL;
-    BXIFREE(shared_info.tasks);
+    graph->err = BXIERR_OK;
+    __sync_lock_release(&graph->running);
     return err;
 }
 
-/* Initialize the nb_threads threads
- * if nb_threads is equal to 0 then
- *      test the BXIMAP_NB_THREADS environnement variable
- *      if the variable isn't valid or is equal to 0
- *      the number of physical cpu will be used
- */
-bxierr_p bximap_init(bximap_thrd_idx_t * nb_threads) {
-    if (shared_info.state == MAPPER_INITIALIZED) {
-        return bxierr_simple(BXIMAP_INITIALIZE, INITIALIZE_MSG);
-    }
-    bximap_thrd_idx_t thr_nb = nb_threads == NULL ? 0 : *nb_threads;
+bxierr_p bximap_pipeline_new(size_t depth, bximap_pipeline_p * pipeline) {
+    bxiassert(NULL != pipeline);
 
-    struct timespec creation_time;
-    bxierr_p err = BXIERR_OK;
-    bxierr_p err2 = bxitime_get(CLOCK_MONOTONIC, &creation_time);
-    BXIERR_CHAIN(err, err2);
-    if (shared_info.state == MAPPER_FOLLOW_FORKED
-        && shared_info.nb_threads != 0) {
-        thr_nb = shared_info.nb_threads;
+    if (0 == depth) return bxierr_simple(BXIMAP_ARG_ERROR, ARG_ERROR_MSG);
+    size_t size = 1;
+    while (size < depth) size *= 2;
+    *pipeline = bximem_calloc(sizeof(**pipeline));
+    (*pipeline)->depth = size;
+    (*pipeline)->err = BXIERR_OK;
+    return BXIERR_OK;
+}
+
+bxierr_p bximap_pipeline_destroy(bximap_pipeline_p * pipeline) {
+    bxiassert(NULL != pipeline);
+    if (NULL == *pipeline) return BXIERR_OK;
+
+    for (size_t i = 0; i < (*pipeline)->stages_nb; i++) {
+        BXIFREE((*pipeline)->stages[i]->ring);
+        BXIFREE((*pipeline)->stages[i]);
     }
+    BXIFREE((*pipeline)->stages);
+    BXIFREE(*pipeline);
+    return BXIERR_OK;
+}
 
-    if (thr_nb == 0) {
-        char * nb_threads_s = getenv("BXIMAP_NB_THREADS");
-        bximap_cpu_idx_t sys_cpu = 0;
-        if (nb_threads_s != NULL) {
+bxierr_p bximap_pipeline_add_stage(bximap_pipeline_p pipeline,
+                                   bxierr_p (*func)(void * batch, void ** out,
+                                                    void * usr_data),
+                                   void * usr_data) {
+    bxiassert(NULL != pipeline);
+    bxiassert(NULL != func);
+
+    if (pipeline->running) return bxierr_simple(BXIMAP_RUNNING, RUNNING_MSG);
+    size_t nb = pipeline->stages_nb;
+    pipeline->stages = bximem_realloc(pipeline->stages,
+                                      nb * sizeof(*pipeline->stages),
+                                      (nb + 1) * sizeof(*pipeline->stages));
+    _stage_s * stage = bximem_calloc(sizeof(*stage));
+    stage->pipeline = pipeline;
+    stage->index = nb;
+    stage->func = func;
+    stage->usr_data = usr_data;
+    if (0 < nb) stage->ring = bximem_calloc(pipeline->depth * sizeof(*stage->ring));
+    pipeline->stages[nb] = stage;
+    pipeline->stages_nb = nb + 1;
+    return BXIERR_OK;
+}
+
+/* The stages are activated by the stages they exchange batches with,
+ * the caller only holds an activation until the first stage is started */
+bxierr_p bximap_pipeline_execute(bximap_pipeline_p pipeline) {
+    bxiassert(NULL != pipeline);
+
+    bxierr_p err = _check_pool();
+    if (bxierr_isko(err)) return err;
+    if (pipeline->stages_nb < 2) return bxierr_simple(BXIMAP_ARG_ERROR, ARG_ERROR_MSG);
+    if (__sync_lock_test_and_set(&pipeline->running, 1)) {
+        return bxierr_simple(BXIMAP_RUNNING, RUNNING_MSG);
+    }
+    for (size_t i = 0; i < pipeline->stages_nb; i++) {
+        _stage_s * stage = pipeline->stages[i];
+        stage->head = 0;
+        stage->tail = 0;
+        stage->scheduled = 0;
+        stage->ended = 0;
+    }
+    pipeline->stopping = 0;
+    pipeline->finished = 0;
+    pipeline->done = 0;
+    pipeline->err = BXIERR_OK;
+    __atomic_store_n(&pipeline->active, 1, __ATOMIC_SEQ_CST);
+    _stage_schedule(pipeline->stages[0]);
+    _pipeline_release(pipeline);
+
+    // The last activation sets done before its call stops being pending
+    err = _wait_flag(&pipeline->done, 1);
+    bxierr_p err2 = _wait_flag(&pipeline->calls, 0);
+    BXIERR_CHAIN(err, err2);
+    err2 = pipeline->err;
+    BXIERR_CHAIN(err, err2);
+    pipeline->err = BXIERR_OK;
+    __sync_lock_release(&pipeline->running);
+    return err;
+}
+
+bxierr_p bximap_set_stop_on_error(bximap_ctx_p context, bool stop) {
+    bxiassert(NULL != context);
+
+    if (context->running) {
+        return bxierr_new(BXIMAP_RUNNING,
+                          NULL, NULL, NULL, NULL,
+                          RUNNING_MSG);
+    }
+    context->stop_on_error = stop;
+    return BXIERR_OK;
+}
+
+bxierr_p bximap_cancel(bximap_ctx_p context) {
+    if (NULL == context) context = current_job;
+    if (NULL == context) return bxierr_simple(BXIMAP_NO_CONTEXT, NO_CONTEXT_MSG);
+    if (!context->running) return bxierr_simple(BXIMAP_ARG_ERROR, NOT_RUNNING_MSG);
+
+    __atomic_store_n(&context->cancelled, 1, __ATOMIC_RELAXED);
+    return BXIERR_OK;
+}
+
+bool bximap_cancelled(bximap_ctx_p context) {
+    if (NULL == context) context = current_job;
+    if (NULL == context) return false;
+    return _cancelled(context);
+}
+
+bxierr_p bximap_set_stats_mode(bximap_stats_mode_e mode) {
+    if (mode > BXIMAP_STATS_CLOCK) return bxierr_simple(BXIMAP_ARG_ERROR, ARG_ERROR_MSG);
+#if defined(__x86_64__) || defined(__i386__)
+    if (BXIMAP_STATS_TSC == mode && 0 == tsc_hz) _tsc_calibrate();
+#else
+    // No time stamp counter
+    if (BXIMAP_STATS_TSC == mode) mode = BXIMAP_STATS_CLOCK;
+#endif
+    stats_mode = mode;
+    return BXIERR_OK;
+}
+
+bxierr_p bximap_get_stats(bximap_ctx_p context, bximap_stats_s * stats) {
+    bxiassert(NULL != context);
+    bxiassert(NULL != stats);
+
+    if (context->running && !context->done) {
+        return bxierr_new(BXIMAP_RUNNING,
+                          NULL, NULL, NULL, NULL,
+                          RUNNING_MSG);
+    }
+    memset(stats, 0, sizeof(*stats));
+    if (NULL == context->stats || BXIMAP_STATS_OFF == context->timer) return BXIERR_OK;
+
+    bximap_thrd_idx_t nb = context->nb_threads;
+    double max_busy = 0, total_busy = 0;
+    for (bximap_thrd_idx_t i = 0; i < nb; i++) {
+        context->stats_out[i] = context->stats[i].s;
+        total_busy += context->stats[i].s.busy_time;
+        if (context->stats[i].s.busy_time > max_busy) {
+            max_busy = context->stats[i].s.busy_time;
+        }
+    }
+    stats->duration = context->duration;
+    stats->nb_threads = nb;
+    stats->threads = context->stats_out;
+    if (total_busy > 0) stats->imbalance = max_busy * (double)nb / total_busy;
+    return BXIERR_OK;
+}
+
+/* Each thread accumulates into its own accumulator, then the accumulators
+ * are combined pairwise along a binary tree of the thread indexes:
+ * the combine order only depends on the number of threads */
+bxierr_p bximap_reduce(bximap_task_idx_t start,
+                       bximap_task_idx_t end,
+                       bximap_task_idx_t granularity,
+                       bxierr_p (*func)(bximap_task_idx_t start,
+                                        bximap_task_idx_t end,
+                                        bximap_thrd_idx_t thread,
+                                        void * acc,
+                                        void * usr_data),
+                       size_t acc_size,
+                       void (*identity)(void * acc, void * usr_data),
+                       void (*combine)(void * acc, const void * other, void * usr_data),
+                       void * usr_data,
+                       void * result) {
+    bxiassert(start <= end && NULL != func);
+    bxiassert(NULL != identity && NULL != combine && NULL != result);
+
+    if (0 == acc_size) return bxierr_simple(BXIMAP_ARG_ERROR, ARG_ERROR_MSG);
+    bxierr_p check = _check_pool();
+    if (bxierr_isko(check)) return check;
+
+    // The accumulators are allocated by the first task: the pool may grow
+    // until the job starts
+    _reduce_s reduce = {
+        .func = func,
+        .identity = identity,
+        .accs = NULL,
+        .nb_threads = 0,
+        .acc_stride = (acc_size + BXIMAP_CACHE_LINE - 1)
+                      / BXIMAP_CACHE_LINE * BXIMAP_CACHE_LINE,
+        .usr_data = usr_data,
+    };
+
+    bximap_ctx_p context = NULL;
+    bxierr_p err = bximap_new(start, end, granularity, &_reduce_func, &reduce, &context);
+    bxierr_p err2 = bximap_execute(context);
+    BXIERR_CHAIN(err, err2);
+    // The errors of the failed tasks are returned chained
+    for (bximap_thrd_idx_t i = 0; i < context->next_error; i++) {
+        BXIERR_CHAIN(err, context->tasks_error[i]);
+    }
+    context->next_error = 0;
+    bximap_destroy(&context);
+
+    if (NULL == reduce.accs) {
+        // No task was run
+        identity(result, usr_data);
+        return err;
+    }
+    bximap_thrd_idx_t nb_threads = reduce.nb_threads;
+    for (bximap_thrd_idx_t step = 1; step < nb_threads; step *= 2) {
+        for (bximap_thrd_idx_t i = 0; i + step < nb_threads; i += 2 * step) {
+            combine(reduce.accs + (size_t)i * reduce.acc_stride,
+                    reduce.accs + (size_t)(i + step) * reduce.acc_stride,
+                    usr_data);
+        }
+    }
+    memcpy(result, reduce.accs, acc_size);
+    BXIFREE(reduce.accs);
+    return err;
+}
+
+/* Blocks are sorted, then runs twice as long are merged at each round.
+ * The elements go back and forth between base and a temporary array */
+bxierr_p bximap_sort(void * base, size_t nmemb, size_t size,
+                     int (*compar)(const void * a, const void * b)) {
+    bxiassert(NULL != base || 0 == nmemb);
+    bxiassert(NULL != compar);
+
+    // The temporary array holds all the elements
+    if (0 == size || nmemb > SIZE_MAX / size) {
+        return bxierr_simple(BXIMAP_ARG_ERROR, ARG_ERROR_MSG);
+    }
+    bxierr_p err = _check_pool();
+    if (bxierr_isko(err)) return err;
+    if (nmemb < 2) return BXIERR_OK;
+
+    size_t nb_blocks = _nb_blocks(nmemb);
+    _sort_s sort = {
+        .src = base,
+        .size = size,
+        .n = nmemb,
+        .block = (nmemb + nb_blocks - 1) / nb_blocks,
+        .compar = compar,
+    };
+    err = _run_blocks(nb_blocks, &_sort_block_func, &sort);
+    if (bxierr_isko(err) || 1 == nb_blocks) return err;
+
+    char * tmp = bximem_calloc(nmemb * size);
+    sort.dst = tmp;
+    for (sort.width = sort.block; sort.width < nmemb; sort.width *= 2) {
+        size_t merges = (nmemb + 2 * sort.width - 1) / (2 * sort.width);
+        sort.pieces = (nb_blocks + merges - 1) / merges;
+        err = _run_blocks(merges * sort.pieces, &_merge_func, &sort);
+        if (bxierr_isko(err)) break;
+        char * swap = sort.src;
+        sort.src = sort.dst;
+        sort.dst = swap;
+    }
+    if (bxierr_isok(err) && sort.src != (char *)base) {
+        sort.dst = base;
+        err = _run_blocks(nb_blocks, &_copy_func, &sort);
+    }
+    BXIFREE(tmp);
+    return err;
+}
+
+/* Least significant digit first: each pass counts the digits of each block,
+ * then moves the elements to the offset of their digit and block */
+bxierr_p bximap_sort_by_key(void * base, size_t nmemb, size_t size,
+                            uint64_t (*key)(const void * elem)) {
+    bxiassert(NULL != base || 0 == nmemb);
+    bxiassert(NULL != key);
+
+    // The temporary arrays hold all the elements and all the keys
+    if (0 == size || nmemb > SIZE_MAX / size || nmemb > SIZE_MAX / sizeof(uint64_t)) {
+        return bxierr_simple(BXIMAP_ARG_ERROR, ARG_ERROR_MSG);
+    }
+    bxierr_p err = _check_pool();
+    if (bxierr_isko(err)) return err;
+    if (nmemb < 2) return BXIERR_OK;
+
+    size_t nb_blocks = _nb_blocks(nmemb);
+    _sort_s sort = {
+        .src = base,
+        .size = size,
+        .n = nmemb,
+        .block = (nmemb + nb_blocks - 1) / nb_blocks,
+        .key = key,
+    };
+    char * tmp = bximem_calloc(nmemb * size);
+    sort.keys_src = bximem_calloc(nmemb * sizeof(*sort.keys_src));
+    sort.keys_dst = bximem_calloc(nmemb * sizeof(*sort.keys_dst));
+    sort.max_keys = bximem_calloc(nb_blocks * sizeof(*sort.max_keys));
+    sort.counts = bximem_calloc(nb_blocks * BXIMAP_RADIX * sizeof(*sort.counts));
+    sort.dst = tmp;
+    err = _run_blocks(nb_blocks, &_key_func, &sort);
+    uint64_t max_key = 0;
+    for (size_t b = 0; b < nb_blocks; b++) max_key |= sort.max_keys[b];
+    for (sort.shift = 0;
+         bxierr_isok(err) && sort.shift < 64 && 0 != max_key >> sort.shift;
+         sort.shift += BXIMAP_RADIX_BITS) {
+        err = _run_blocks(nb_blocks, &_radix_count_func, &sort);
+        if (bxierr_isko(err)) break;
+        // Elements of a lower digit first, then of a lower block
+        size_t offset = 0;
+        for (size_t d = 0; d < BXIMAP_RADIX; d++) {
+            for (size_t b = 0; b < nb_blocks; b++) {
+                size_t count = sort.counts[b * BXIMAP_RADIX + d];
+                sort.counts[b * BXIMAP_RADIX + d] = offset;
+                offset += count;
+            }
+        }
+        err = _run_blocks(nb_blocks, &_radix_scatter_func, &sort);
+        if (bxierr_isko(err)) break;
+        char * swap = sort.src;
+        sort.src = sort.dst;
+        sort.dst = swap;
+        uint64_t * keys = sort.keys_src;
+        sort.keys_src = sort.keys_dst;
+        sort.keys_dst = keys;
+    }
+    if (bxierr_isok(err) && sort.src != (char *)base) {
+        sort.dst = base;
+        err = _run_blocks(nb_blocks, &_copy_func, &sort);
+    }
+    BXIFREE(tmp);
+    BXIFREE(sort.keys_src);
+    BXIFREE(sort.keys_dst);
+    BXIFREE(sort.max_keys);
+    BXIFREE(sort.counts);
+    return err;
+}
+
+/* The blocks are summed up, the sums are scanned,
+ * then each block is scanned from the sum of the previous ones */
+bxierr_p bximap_scan(const int64_t * in, int64_t * out, size_t n, bool inclusive) {
+    bxiassert(NULL != in || 0 == n);
+    bxiassert(NULL != out || 0 == n);
+
+    bxierr_p err = _check_pool();
+    if (bxierr_isko(err)) return err;
+    if (0 == n) return BXIERR_OK;
+
+    size_t nb_blocks = _nb_blocks(n);
+    _scan_s scan = {
+        .in = in,
+        .out = out,
+        .n = n,
+        .block = (n + nb_blocks - 1) / nb_blocks,
+        .sums = bximem_calloc(nb_blocks * sizeof(*scan.sums)),
+        .inclusive = inclusive,
+    };
+    if (1 < nb_blocks) {
+        err = _run_blocks(nb_blocks, &_scan_sum_func, &scan);
+        int64_t sum = 0;
+        for (size_t b = 0; b < nb_blocks; b++) {
+            int64_t block_sum = scan.sums[b];
+            scan.sums[b] = sum;
+            sum += block_sum;
+        }
+    }
+    if (bxierr_isok(err)) err = _run_blocks(nb_blocks, &_scan_write_func, &scan);
+    BXIFREE(scan.sums);
+    return err;
+}
+
+/* Initialize the nb_threads threads
+ * if nb_threads is equal to 0 then
+ *      test the BXIMAP_NB_THREADS environnement variable
+ *      if the variable isn't valid or is equal to 0
+ *      the number of physical cpu will be used
+ */
+bxierr_p bximap_init(bximap_thrd_idx_t * nb_threads) {
+    if (shared_info.state == MAPPER_INITIALIZED || shared_info.state == MAPPER_FORKED) {
+        return bxierr_simple(BXIMAP_INITIALIZE, INITIALIZE_MSG);
+    }
+    bximap_thrd_idx_t thr_nb = nb_threads == NULL ? 0 : *nb_threads;
+
+    struct timespec creation_time;
+    bxierr_p err = BXIERR_OK;
+    bxierr_p err2 = bxitime_get(CLOCK_MONOTONIC, &creation_time);
+    BXIERR_CHAIN(err, err2);
+
+    if (thr_nb == 0) {
+        char * nb_threads_s = getenv("BXIMAP_NB_THREADS");
+        bximap_cpu_idx_t sys_cpu = 0;
+        if (nb_threads_s != NULL) {
             int sys_cpu_int;
             bxierr_p err2 = bximisc_strtoi(nb_threads_s, 10, &sys_cpu_int);
             BXIERR_CHAIN(err, err2);
@@ -494,103 +1406,108 @@ bxierr_p bximap_init(bximap_thrd_idx_t * nb_threads) {
         thr_nb = (bximap_thrd_idx_t)sys_cpu;
     }
     if (nb_threads != NULL) *nb_threads = thr_nb;
+
+    char * sched_s = getenv("BXIMAP_SCHEDULE");
+    if (sched_s != NULL) {
+        err2 = _parse_schedule(sched_s, &default_sched);
+        BXIERR_CHAIN(err, err2);
+        if (bxierr_isko(err)) return err;
+    }
+    char * stats_s = getenv("BXIMAP_STATS");
+    if (stats_s != NULL) {
+        bximap_stats_mode_e mode;
+        if (0 == strcmp(stats_s, "off")) {
+            mode = BXIMAP_STATS_OFF;
+        } else if (0 == strcmp(stats_s, "tsc")) {
+            mode = BXIMAP_STATS_TSC;
+        } else if (0 == strcmp(stats_s, "clock")) {
+            mode = BXIMAP_STATS_CLOCK;
+        } else {
+            return bxierr_new(BXIMAP_ARG_ERROR, strdup(stats_s), free, NULL, NULL,
+                              "Unknown statistics mode '%s'", stats_s);
+        }
+        err2 = bximap_set_stats_mode(mode);
+        BXIERR_CHAIN(err, err2);
+        if (bxierr_isko(err)) return err;
+    }
+    char * place_s = getenv("BXIMAP_PLACEMENT");
+    if (place_s != NULL) {
+        if (0 == strcmp(place_s, "none")) {
+            placement = BXIMAP_PLACE_NONE;
+        } else if (0 == strcmp(place_s, "compact")) {
+            placement = BXIMAP_PLACE_COMPACT;
+        } else if (0 == strcmp(place_s, "scatter")) {
+            placement = BXIMAP_PLACE_SCATTER;
+        } else if (0 == strcmp(place_s, "physcore")) {
+            placement = BXIMAP_PLACE_PHYSCORE;
+        } else {
+            return bxierr_new(BXIMAP_ARG_ERROR, strdup(place_s), free, NULL, NULL,
+                              "Unknown placement '%s'", place_s);
+        }
+    }
+    char * spin_s = getenv("BXIMAP_SPIN");
+    if (spin_s != NULL) {
+        int spin;
+        err2 = bximisc_strtoi(spin_s, 10, &spin);
+        BXIERR_CHAIN(err, err2);
+        if (bxierr_isko(err)) return err;
+        err2 = bximap_set_spin_budget(spin);
+        BXIERR_CHAIN(err, err2);
+        if (bxierr_isko(err)) return err;
+    }
     INFO(MAPPER_LOGGER, "Mapper initialized "THRD_IDX_FMT" threads", thr_nb);
 
-    shared_info.threads_args = bximem_calloc((size_t)thr_nb * sizeof(*shared_info.threads_args));
+    int rc = 0;
+    errno = 0;
+    rc = pthread_mutex_init(&shared_info.jobs_mutex, NULL);
+    if (0 != rc) return bxierr_fromidx(rc, NULL, "Calling pthread_mutex_init() failed");
+    shared_info.jobs = NULL;
+    shared_info.running = 0;
+    shared_info.stopping = false;
+    shared_info.sleepers = 0;
+    shared_info.master = pthread_self();
+    shared_info.queue = bximem_calloc(BXIMAP_QUEUE_SIZE * sizeof(*shared_info.queue));
+    _queue_reset();
 
     shared_info.threads_id = bximem_calloc((size_t)thr_nb * sizeof(*shared_info.threads_id));
+    shared_info.threads_cpu = bximem_calloc((size_t)thr_nb * sizeof(*shared_info.threads_cpu));
+    shared_info.threads_node = bximem_calloc((size_t)thr_nb * sizeof(*shared_info.threads_node));
     shared_info.nb_threads = thr_nb;
-    shared_info.ended = 0;
-    bximap_thrd_idx_t first = 0;
-    int rc = 0;
-
-#ifndef ZMQ
-    first++;
-    //condition use between to set of task to avoid keep the thread wake up
-#ifdef FADD
-    rc = 0;
-    errno = 0;
-    rc = pthread_mutex_init(&cond_mutex, NULL);
-    if (0 != rc) {
-        err2 = bxierr_errno("Error on pthread mutex init");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
-    }
-    errno = 0;
-    rc = pthread_cond_init(&wait_work, NULL);
-    if (0 != rc) {
-        err2 = bxierr_errno("Error on pthread cond init");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
+    shared_info.nb_created = 1;
+    // Read once: binding the master below restricts its own mask
+    shared_info.allowed_cpus = NULL;
+    shared_info.allowed_nb = 0;
+    err2 = _read_allowed(&shared_info.allowed_cpus, &shared_info.allowed_nb);
+    if (bxierr_isko(err2)) {
+        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2,
+                      "Threads won't be placed on the allowed cpus");
     }
-#else
-    errno = 0;
-    rc = pthread_barrier_init(&barrier, NULL, (unsigned)thr_nb);
-    if (0 != rc) {
-        err2 = bxierr_errno("Error on pthread barrier init");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
+    err2 = _map_threads(thr_nb, shared_info.threads_cpu);
+    if (bxierr_isko(err2)) {
+        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2,
+                      "Threads won't be bound to cpus");
+        for (bximap_thrd_idx_t i = 0; i < thr_nb; i++) shared_info.threads_cpu[i] = -1;
     }
-#endif
-#else
-    TRACE(MAPPER_LOGGER, "Master start zmq");
-    errno = 0;
-    rc = pthread_barrier_init(&zmq_barrier, NULL, (unsigned) (thr_nb + 1));
-    if (0 != rc) {
-        err2 = bxierr_errno("Error on pthread barrier init");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
+    for (bximap_thrd_idx_t i = 0; i < thr_nb; i++) {
+        shared_info.threads_node[i] = _read_node(shared_info.threads_cpu[i]);
     }
-    err2 = bxizmq_context_new(&shared_info.context);
-    shared_info.zocket_pub = NULL;
-    shared_info.zocket_tasks = NULL;
-    shared_info.zocket_result = NULL;
-    BXIERR_CHAIN(err, err2);
-    err2 = bxizmq_zocket_bind(shared_info.context, ZMQ_PUB, MAP_PUB_ZMQ_URL,
-                              NULL, &shared_info.zocket_pub);
-    BXIERR_CHAIN(err, err2);
-    err2 = bxizmq_zocket_bind(shared_info.context, ZMQ_PUSH, MAP_TASK_ZMQ_URL,
-                              NULL, &shared_info.zocket_tasks);
-    BXIERR_CHAIN(err, err2);
-    err2 = bxizmq_zocket_bind(shared_info.context, ZMQ_PULL, MAP_RESULT_ZMQ_URL,
-                              NULL, &shared_info.zocket_result);
-    BXIERR_CHAIN(err, err2);
-#endif
-
-    for (bximap_thrd_idx_t i = first; i < shared_info.nb_threads; i++) {
-        shared_info.threads_args[i] = i;
-
-        errno = 0;
-        int rc = pthread_create(&shared_info.threads_id[i], NULL,
-                                &_start_function,
-                                &shared_info.threads_args[i]);
-        if (0 != rc) {
-            err2 = bxierr_errno("Error on pthread create");
-            BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
+    shared_info.master_mask = NULL;
+    shared_info.master_mask_size = 0;
+    if (placement != BXIMAP_PLACE_NONE && shared_info.threads_cpu[0] >= 0) {
+        err2 = _read_affinity(&shared_info.master_mask, &shared_info.master_mask_size);
+        if (bxierr_isok(err2)) err2 = bximap_on_cpu(shared_info.threads_cpu[0]);
+        if (bxierr_isko(err2)) {
+            BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2,
+                          "Can't be mapped on cpu "CPU_IDX_FMT,
+                          shared_info.threads_cpu[0]);
+            shared_info.threads_cpu[0] = -1;
         }
-        TRACE(MAPPER_LOGGER, "Creation of one thread:"THRD_IDX_FMT, i);
-    }
-
-#ifndef ZMQ
-#ifdef FADD
-    while (shared_info.ended < thr_nb - 1) __sync_synchronize();
-#else
-    __sync_synchronize();
-    errno = 0;
-    TRACE(MAPPER_LOGGER, "Enter barrier")
-    rc = pthread_barrier_wait(&barrier);
-    TRACE(MAPPER_LOGGER, "Leave barrier")
-    if (0 != rc && PTHREAD_BARRIER_SERIAL_THREAD != rc) {
-        err2 = bxierr_errno("Error on pthread barrier wait");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
     }
-#endif
-#else
-    errno = 0;
-    TRACE(MAPPER_LOGGER, "Enter barrier")
-    rc = pthread_barrier_wait(&zmq_barrier);
-    TRACE(MAPPER_LOGGER, "Leave barrier")
-    if (0 != rc && PTHREAD_BARRIER_SERIAL_THREAD != rc) {
-        err2 = bxierr_errno("Error on pthread barrier wait");
+    // The master thread is the thread 0 of the pool
+    err2 = _create_threads(1, thr_nb);
+    if (bxierr_isko(err2)) {
         BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
     }
-#endif
 
     rc = pthread_once( &mapper_once_control , _mapper_once);
     BXIASSERT(MAPPER_LOGGER, rc == 0);
@@ -608,7 +1525,8 @@ bxierr_p bximap_init(bximap_thrd_idx_t * nb_threads) {
 /* clean properly the threads and liberate the memory */
 bxierr_p bximap_finalize() {
     int rc = 0;
-    if (shared_info.state != MAPPER_INITIALIZED) {
+    // A forked child has no worker to join
+    if (shared_info.state != MAPPER_INITIALIZED && shared_info.state != MAPPER_FORKED) {
         return bxierr_simple(BXIMAP_NOT_INITIALIZED, NOT_INITIALIZED_MSG);
     }
     struct timespec stop_time;
@@ -616,71 +1534,24 @@ bxierr_p bximap_finalize() {
     bxierr_p err2 = bxitime_get(CLOCK_MONOTONIC, &stop_time);
     BXIERR_CHAIN(err, err2);
 
-    shared_info.global_task = &last_task;
-    bximap_thrd_idx_t first = 0;
-
-#ifndef ZMQ
-    first++;
-#ifdef FADD
-    while (shared_info.ended < shared_info.nb_threads - 1) __sync_synchronize();
-    rc = 0;
-    errno = 0;
-    rc = pthread_mutex_lock(&cond_mutex);
-    if (0 != rc) {
-        err2 = bxierr_errno("Error on pthread cond init");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
-    }
-    errno = 0;
-    rc = pthread_cond_broadcast(&wait_work);
-    if (0 != rc) {
-        err2 = bxierr_errno("Error on pthread cond init");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
-    }
-    errno = 0;
-    rc = pthread_mutex_unlock(&cond_mutex);
-    if (0 != rc) {
-        err2 = bxierr_errno("Error on pthread cond init");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
-    }
-    errno = 0;
-    rc = pthread_mutex_destroy(&cond_mutex);
-    if (0 != rc) {
-        err2 = bxierr_errno("Error on pthread cond init");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
-    }
-    errno = 0;
-    rc = pthread_cond_destroy(&wait_work);
-    if (0 != rc) {
-        err2 = bxierr_errno("Error on pthread cond init");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
-    }
-#else
-    errno = 0;
-    TRACE(MAPPER_LOGGER, "Enter barrier")
-    rc = pthread_barrier_wait(&barrier);
-    TRACE(MAPPER_LOGGER, "Leave barrier")
-    if (0 != rc && PTHREAD_BARRIER_SERIAL_THREAD != rc) {
-        err2 = bxierr_errno("Error on pthread barrier wait");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
-    }
-    errno = 0;
-    rc = pthread_barrier_destroy(&barrier);
-    if (0 != rc) {
-        err2 = bxierr_errno("Error on pthread barrier destroy");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
-    }
-#endif
-#else
-    TRACE(MAPPER_LOGGER, "Master sends last task");
-    for (bximap_thrd_idx_t i = 0; i < shared_info.nb_threads; i++) {
-        err2 = bxizmq_data_snd_zc(&last_task,  sizeof(last_task),
-                                  shared_info.zocket_pub,
-                                  0, 10, 10000, NULL, NULL);
-        BXIERR_CHAIN(err, err2);
+    // Workers are only stopped once every execution is over
+    rc = pthread_mutex_lock(&shared_info.jobs_mutex);
+    bxiassert(0 == rc);
+    if (0 != shared_info.running
+        || 0 != __atomic_load_n(&shared_info.pending, __ATOMIC_ACQUIRE)) {
+        rc = pthread_mutex_unlock(&shared_info.jobs_mutex);
+        bxiassert(0 == rc);
+        return bxierr_new(BXIMAP_RUNNING,
+                          NULL, NULL, NULL, NULL,
+                          RUNNING_MSG);
     }
-#endif
+    __atomic_store_n(&shared_info.stopping, true, __ATOMIC_RELEASE);
+    rc = pthread_mutex_unlock(&shared_info.jobs_mutex);
+    bxiassert(0 == rc);
+    _doorbell_ring();
+    _resize_ring();
 
-    for (bximap_thrd_idx_t i = first; i < shared_info.nb_threads; i++) {
+    for (bximap_thrd_idx_t i = 1; i < shared_info.nb_created; i++) {
         void * retval;
         TRACE(MAPPER_LOGGER, "Master joins thread:"THRD_IDX_FMT, i);
         errno = 0;
@@ -705,28 +1576,29 @@ bxierr_p bximap_finalize() {
     }
 
     BXIFREE(shared_info.threads_id);
-    BXIFREE(shared_info.threads_args);
-    shared_info.state = MAPPER_UNSET;
-
-#ifdef ZMQ
-    TRACE(MAPPER_LOGGER, "Master cleans zmq");
-    err2 = bxizmq_zocket_destroy(shared_info.zocket_pub);
-    BXIERR_CHAIN(err, err2);
-    err2 = bxizmq_zocket_destroy(shared_info.zocket_tasks);
-    BXIERR_CHAIN(err, err2);
-    err2 = bxizmq_zocket_destroy(shared_info.zocket_result);
-    BXIERR_CHAIN(err, err2);
+    BXIFREE(shared_info.threads_cpu);
+    BXIFREE(shared_info.threads_node);
+    BXIFREE(shared_info.allowed_cpus);
+    BXIFREE(shared_info.queue);
+    if (NULL != shared_info.master_mask) {
+        // The master isn't left bound to the cpu of the thread 0
+        rc = pthread_setaffinity_np(shared_info.master, shared_info.master_mask_size,
+                                    shared_info.master_mask);
+        if (0 != rc) {
+            err2 = bxierr_fromidx(rc, NULL, "Calling pthread_setaffinity_np() failed");
+            BXIERR_CHAIN(err, err2);
+        }
+        CPU_FREE(shared_info.master_mask);
+        shared_info.master_mask = NULL;
+    }
     errno = 0;
-    rc = pthread_barrier_destroy(&zmq_barrier);
+    rc = pthread_mutex_destroy(&shared_info.jobs_mutex);
     if (0 != rc) {
-        err2 = bxierr_errno("Error on pthread barrier destroy");
+        err2 = bxierr_fromidx(rc, NULL, "Calling pthread_mutex_destroy() failed");
         BXIERR_CHAIN(err, err2);
     }
-    TRACE(MAPPER_LOGGER, "Master destroy ctx");
-    do{
-        rc = zmq_ctx_destroy(shared_info.context);
-    } while (rc == -1 && zmq_errno() == EINTR);
-#endif
+    shared_info.state = MAPPER_UNSET;
+
 
     if (vcpus != NULL) {
         bxivector_destroy(&vcpus, NULL);
@@ -740,13 +1612,118 @@ bxierr_p bximap_finalize() {
 }
 
 bxierr_p bximap_on_cpu(bximap_cpu_idx_t cpu) {
-    cpu_set_t cpu_mask;
+    if (cpu < 0) {
+        return bxierr_new(BXIMAP_NEGATIVE_INTEGER, NULL, NULL, NULL, NULL,
+                          "Negative cpu number "CPU_IDX_FMT, cpu);
+    }
+    // Sized for the cpu, which may be beyond CPU_SETSIZE
+    cpu_set_t * cpu_mask = CPU_ALLOC((size_t)cpu + 1);
+    if (NULL == cpu_mask) return bxierr_errno("Calling CPU_ALLOC() failed");
+    size_t size = CPU_ALLOC_SIZE((size_t)cpu + 1);
 
-    CPU_ZERO(&cpu_mask);
-    CPU_SET((size_t)cpu, &cpu_mask);
+    CPU_ZERO_S(size, cpu_mask);
+    CPU_SET_S((size_t)cpu, size, cpu_mask);
     errno = 0;
-    if (sched_setaffinity(0, 1, &cpu_mask) != 0) {
-        return bxierr_errno("Process binding on the cpu failed (sched_setaffinity)");
+    int rc = sched_setaffinity(0, size, cpu_mask);
+    CPU_FREE(cpu_mask);
+    if (rc != 0) {
+        return bxierr_errno("Process binding on the cpu "CPU_IDX_FMT" failed "
+                            "(sched_setaffinity)", cpu);
+    }
+    return BXIERR_OK;
+}
+
+bxierr_p bximap_set_placement(bximap_place_e place) {
+    if (shared_info.state == MAPPER_INITIALIZED || shared_info.state == MAPPER_FORKED) {
+        return bxierr_simple(BXIMAP_INITIALIZE, INITIALIZE_MSG);
+    }
+    if (place > BXIMAP_PLACE_PHYSCORE) {
+        return bxierr_simple(BXIMAP_ARG_ERROR, ARG_ERROR_MSG);
+    }
+    placement = place;
+    return BXIERR_OK;
+}
+
+/* Workers beyond the new size park until the pool grows again,
+ * they keep their cpu */
+bxierr_p bximap_resize(bximap_thrd_idx_t nb_threads) {
+    if (nb_threads < 1) return bxierr_simple(BXIMAP_ARG_ERROR, ARG_ERROR_MSG);
+    bxierr_p check = _check_pool();
+    if (bxierr_isko(check)) return check;
+
+    // No job may use the thread arrays meanwhile, and queued calls
+    // must not be left without active worker
+    int rc = pthread_mutex_lock(&shared_info.jobs_mutex);
+    bxiassert(0 == rc);
+    if (0 != shared_info.running
+        || 0 != __atomic_load_n(&shared_info.pending, __ATOMIC_ACQUIRE)) {
+        rc = pthread_mutex_unlock(&shared_info.jobs_mutex);
+        bxiassert(0 == rc);
+        return bxierr_new(BXIMAP_RUNNING,
+                          NULL, NULL, NULL, NULL,
+                          RUNNING_MSG);
+    }
+    bxierr_p err = BXIERR_OK;
+    bximap_thrd_idx_t created = shared_info.nb_created;
+    if (nb_threads > created) {
+        shared_info.threads_id = bximem_realloc(shared_info.threads_id,
+                                                (size_t)created
+                                                * sizeof(*shared_info.threads_id),
+                                                (size_t)nb_threads
+                                                * sizeof(*shared_info.threads_id));
+        shared_info.threads_cpu = bximem_realloc(shared_info.threads_cpu,
+                                                 (size_t)created
+                                                 * sizeof(*shared_info.threads_cpu),
+                                                 (size_t)nb_threads
+                                                 * sizeof(*shared_info.threads_cpu));
+        shared_info.threads_node = bximem_realloc(shared_info.threads_node,
+                                                  (size_t)created
+                                                  * sizeof(*shared_info.threads_node),
+                                                  (size_t)nb_threads
+                                                  * sizeof(*shared_info.threads_node));
+        // The mapping is the one bximap_init() would have chosen
+        bximap_cpu_idx_t * cpus = bximem_calloc((size_t)nb_threads * sizeof(*cpus));
+        bxierr_p err2 = _map_threads(nb_threads, cpus);
+        if (bxierr_isko(err2)) {
+            BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2,
+                          "Threads won't be bound to cpus");
+            for (bximap_thrd_idx_t i = 0; i < nb_threads; i++) cpus[i] = -1;
+        }
+        for (bximap_thrd_idx_t i = created; i < nb_threads; i++) {
+            shared_info.threads_cpu[i] = cpus[i];
+            shared_info.threads_node[i] = _read_node(cpus[i]);
+        }
+        BXIFREE(cpus);
+        err = _create_threads(created, nb_threads);
+        if (bxierr_isko(err)) nb_threads = shared_info.nb_created;
+    }
+    INFO(MAPPER_LOGGER, "Mapper resized from "THRD_IDX_FMT" to "THRD_IDX_FMT" threads",
+         shared_info.nb_threads, nb_threads);
+    __atomic_store_n(&shared_info.nb_threads, nb_threads, __ATOMIC_RELEASE);
+    rc = pthread_mutex_unlock(&shared_info.jobs_mutex);
+    bxiassert(0 == rc);
+    _resize_ring();
+    return err;
+}
+
+bxierr_p bximap_get_nb_threads(bximap_thrd_idx_t * nb_threads) {
+    if (shared_info.state != MAPPER_INITIALIZED && shared_info.state != MAPPER_FORKED) {
+        return bxierr_simple(BXIMAP_NOT_INITIALIZED, NOT_INITIALIZED_MSG);
+    }
+    if (NULL == nb_threads) return bxierr_simple(BXIMAP_ARG_ERROR, ARG_ERROR_MSG);
+    *nb_threads = __atomic_load_n(&shared_info.nb_threads, __ATOMIC_ACQUIRE);
+    return BXIERR_OK;
+}
+
+bxierr_p bximap_get_cpu_map(bximap_cpu_idx_t * cpus, bximap_thrd_idx_t n) {
+    if (shared_info.state != MAPPER_INITIALIZED && shared_info.state != MAPPER_FORKED) {
+        return bxierr_simple(BXIMAP_NOT_INITIALIZED, NOT_INITIALIZED_MSG);
+    }
+    if (NULL == cpus || n < 0) return bxierr_simple(BXIMAP_ARG_ERROR, ARG_ERROR_MSG);
+    for (bximap_thrd_idx_t i = 0; i < n; i++) {
+        cpus[i] = i < shared_info.nb_threads
+            ? __atomic_load_n(&shared_info.threads_cpu[i], __ATOMIC_RELAXED)
+            : -1;
     }
     return BXIERR_OK;
 }
@@ -802,7 +1779,7 @@ bxierr_p bximap_translate_cpumask(const char * cpus, bxivector_p * vcpus) {
 }
 
 bxierr_p bximap_set_cpumask(char * cpus) {
-    if (shared_info.state == MAPPER_INITIALIZED) {
+    if (shared_info.state == MAPPER_INITIALIZED || shared_info.state == MAPPER_FORKED) {
         return bxierr_simple(BXIMAP_INITIALIZE, INITIALIZE_MSG);
     }
     if (cpus == NULL || strcmp(cpus, "") == 0) {
@@ -843,265 +1820,1531 @@ bxierr_p bximap_set_cpumask(char * cpus) {
 // ********************************** Static Functions  ****************************
 // *********************************************************************************
 
+/* Quiesce the pool: no job can start or end while the jobs mutex is held,
+ * idle workers keep waiting and are neither joined nor recreated.
+ * The global spin locks are held too, no worker can own them in the child */
 void _mapper_parent_before_fork(void) {
     TRACE(MAPPER_LOGGER, "%s state:%d", __func__, shared_info.state);
-    bxierr_p err = bximap_finalize();
-    if (BXIMAP_NOT_INITIALIZED != err->code) {
-        shared_info.state = MAPPER_FORKED;
+    if (shared_info.state != MAPPER_INITIALIZED && shared_info.state != MAPPER_FORKED) return;
+    int rc = pthread_mutex_lock(&shared_info.jobs_mutex);
+    bxiassert(0 == rc);
+    if (0 != shared_info.running) {
+        WARNING(MAPPER_LOGGER,
+                "Forking while "THRD_IDX_FMT" maps are running: "
+                "they can't be waited for in the child",
+                shared_info.running);
+    }
+    int pending = __atomic_load_n(&shared_info.pending, __ATOMIC_ACQUIRE);
+    if (0 != pending) {
+        WARNING(MAPPER_LOGGER,
+                "Forking while %d submitted calls are pending: "
+                "they are not run in the child",
+                pending);
     }
+    _spin_lock(&auto_lock);
 }
 
 void _mapper_once(void) {
     TRACE(MAPPER_LOGGER, "%s state:%d", __func__, shared_info.state);
-    pthread_atfork(_mapper_parent_before_fork, _mapper_parent_after_fork, NULL);
+    pthread_atfork(_mapper_parent_before_fork,
+                   _mapper_parent_after_fork,
+                   _mapper_child_after_fork);
 }
 
 void _mapper_parent_after_fork(void) {
     TRACE(MAPPER_LOGGER, "%s state:%d", __func__, shared_info.state);
-    if (shared_info.state != MAPPER_FORKED) return;
-    shared_info.state = MAPPER_FOLLOW_FORKED;
-    TRACE(MAPPER_LOGGER, "%s state:%d call init thread", __func__, shared_info.state);
-    bxierr_p rc = bximap_init(0);
-    BXIASSERT(MAPPER_LOGGER, rc == BXIERR_OK);
+    if (shared_info.state != MAPPER_INITIALIZED && shared_info.state != MAPPER_FORKED) return;
+    _spin_unlock(&auto_lock);
+    int rc = pthread_mutex_unlock(&shared_info.jobs_mutex);
+    bxiassert(0 == rc);
 }
 
-bxierr_p _do_job(bximap_ctx_p task, bximap_thrd_idx_t thread_id) {
-    bximap_task_idx_t start = task->start;
-    bximap_task_idx_t end = task->end ;
-    TRACE(MAPPER_LOGGER,
-          "start "     TASK_IDX_FMT ", "
-          "end "       TASK_IDX_FMT ", "
-          "thread_id " THRD_IDX_FMT,
-          start, end, thread_id);
-    bxierr_p err = task->func(start, end, thread_id, task->usr_data);
-    return err;
+/* Only the forking thread exists in the child: the workers are started
+ * by the first execution, see _check_pool() */
+void _mapper_child_after_fork(void) {
+    if (shared_info.state != MAPPER_INITIALIZED && shared_info.state != MAPPER_FORKED) return;
+    int rc = pthread_mutex_init(&shared_info.jobs_mutex, NULL);
+    bxiassert(0 == rc);
+    _spin_unlock(&auto_lock);
+    shared_info.jobs = NULL;
+    shared_info.running = 0;
+    shared_info.stopping = false;
+    shared_info.sleepers = 0;
+    shared_info.pending = 0;
+    _queue_reset();
+    shared_info.nb_created = 1;
+    shared_info.master = pthread_self();
+    worker_id = -1;
+    current_job = NULL;
+    shared_info.state = MAPPER_FORKED;
 }
 
-void * __start_function(void *arg) {
-    bximap_thrd_idx_t thread_id = *(bximap_thrd_idx_t *)arg;
-    bximap_ctx_p current_task = NULL;
-    bxierr_p err = BXIERR_OK, err2;
-    struct timespec starting_time;
-    double working_time = 0;
-    bximap_task_idx_t nb_iterations = 0;
-    int rc = 0;
-    TRACE(MAPPER_LOGGER, "thread:"THRD_IDX_FMT" start", thread_id);
-    if (vcpus != NULL) {
-        bximap_cpu_idx_t nb_cpus = (bximap_cpu_idx_t)bxivector_get_size(vcpus);
-        bximap_cpu_idx_t my_cpu = (bximap_cpu_idx_t)(thread_id % (bximap_thrd_idx_t)nb_cpus);
-        bximap_cpu_idx_t cpu = (bximap_cpu_idx_t)(intptr_t)bxivector_get_elem(vcpus, (size_t)my_cpu);
-        TRACE(MAPPER_LOGGER,
-              "Schedule on cpu="CPU_IDX_FMT" "
-              "thread_id="THRD_IDX_FMT,
-              cpu, thread_id);
-        bxierr_p err = bximap_on_cpu(cpu);
-        if (bxierr_isko(err)) {
-            BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err,
-                          "Can't be mapped on cpu "CPU_IDX_FMT, cpu);
-        }
-    }
-#ifdef ZMQ
-    TRACE(MAPPER_LOGGER, "thread:"THRD_IDX_FMT" start zmq", thread_id);
-    void *  zocket_sub_end = NULL;
-    err2 = bxizmq_zocket_connect(shared_info.context, ZMQ_SUB, MAP_PUB_ZMQ_URL,
-                                 &zocket_sub_end);
-    BXIERR_CHAIN(err, err2);
-    err2 = bxizmq_zocket_setopt(zocket_sub_end, ZMQ_SUBSCRIBE, "", 0);
-    BXIERR_CHAIN(err, err2);
-    void *  zocket_pull_tasks = NULL;
-    err2 = bxizmq_zocket_connect(shared_info.context, ZMQ_PULL, MAP_TASK_ZMQ_URL,
-                                 &zocket_pull_tasks);
-    BXIERR_CHAIN(err, err2);
-    void *  zocket_push_result = NULL;
-    err2 = bxizmq_zocket_connect(shared_info.context, ZMQ_PUSH, MAP_RESULT_ZMQ_URL,
-                                 &zocket_push_result);
-    BXIERR_CHAIN(err, err2);
-    zmq_pollitem_t items [] = { {zocket_pull_tasks, 0, ZMQ_POLLIN, 0 },
-        {zocket_sub_end, 0, ZMQ_POLLIN, 0 }};
-    errno = 0;
-    TRACE(MAPPER_LOGGER, "Enter barrier")
-    rc = pthread_barrier_wait(&zmq_barrier);
-    TRACE(MAPPER_LOGGER, "Leave barrier")
-    if (0 != rc && PTHREAD_BARRIER_SERIAL_THREAD != rc) {
-        err = bxierr_errno("Error on pthread barrier wait");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err, "Error");
+/* Check the pool can run jobs, starting the workers of a forked child */
+bxierr_p _check_pool(void) {
+    _state_mapper state = __atomic_load_n(&shared_info.state, __ATOMIC_ACQUIRE);
+    if (MAPPER_INITIALIZED == state) return BXIERR_OK;
+    if (MAPPER_FORKED != state) {
+        return bxierr_simple(BXIMAP_NOT_INITIALIZED, NOT_INITIALIZED_MSG);
     }
-#else
-#ifndef FADD
-    errno = 0;
-    TRACE(MAPPER_LOGGER, "Enter barrier")
-    rc = pthread_barrier_wait(&barrier);
-    TRACE(MAPPER_LOGGER, "Leave barrier")
-    if (0 != rc && PTHREAD_BARRIER_SERIAL_THREAD != rc) {
-        err2 = bxierr_errno("Error on pthread barrier wait");
-        BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
+    bxierr_p err = BXIERR_OK;
+    int rc = pthread_mutex_lock(&shared_info.jobs_mutex);
+    bxiassert(0 == rc);
+    if (MAPPER_FORKED == shared_info.state) {
+        TRACE(MAPPER_LOGGER, "Starting the workers of the forked pool");
+        err = _create_threads(1, shared_info.nb_threads);
+        if (bxierr_isko(err)) shared_info.nb_threads = shared_info.nb_created;
+        __atomic_store_n(&shared_info.state, MAPPER_INITIALIZED, __ATOMIC_RELEASE);
     }
-#endif
-#endif
+    rc = pthread_mutex_unlock(&shared_info.jobs_mutex);
+    bxiassert(0 == rc);
+    return err;
+}
 
-    TRACE(MAPPER_LOGGER, "started");
+/* Index of the calling thread in the pool, -1 if it does not belong to it.
+ * When the pool has no worker, any thread runs the maps as the thread 0. */
+bximap_thrd_idx_t _current_thread(void) {
+    if (worker_id >= 0) return worker_id;
+    if (pthread_equal(pthread_self(), shared_info.master)) return 0;
+    if (1 == shared_info.nb_threads) return 0;
+    return -1;
+}
 
-    while (true) {
+/* Split the work of the context between the tasks.
+ * Task bounds are computed from their index by _task_bounds() */
+bxierr_p _prepare_job(bximap_ctx_p job) {
+    job->nb_threads = shared_info.nb_threads;
+    job->run_sched = job->sched;
+    if (job->run_sched == BXIMAP_SCHED_DEFAULT) job->run_sched = default_sched;
+    bool weighted = NULL != job->weights || NULL != job->cost;
+    // Guided chunks are counted in iterations, not in tasks
+    if (weighted && job->run_sched == BXIMAP_SCHED_GUIDED) {
+        job->run_sched = BXIMAP_SCHED_DYNAMIC;
+    }
+    bximap_task_idx_t granularity = job->granularity;
+    if (granularity == 0) {
+        granularity = (job->end - job->start) / (job->nb_threads);
+        granularity /= 10;
+        if (granularity == 0) {
+            granularity++;
+        }
+    }
+    if (job->run_sched == BXIMAP_SCHED_AUTO) {
+        granularity = _auto_granularity(job, granularity);
+    }
+    job->nb_tasks = (job->end - job->start) / granularity;
 
-#ifndef ZMQ
-#ifdef FADD
-        errno = 0;
-        rc = pthread_mutex_lock(&cond_mutex);
-        if (0 != rc) {
-            err2 = bxierr_errno("Error on pthread mutex lock");
-            BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
+    // Errors of a previous execution are released, the array is kept
+    for (bximap_thrd_idx_t i = 0; i < job->next_error; i++) {
+        bxierr_destroy(&job->tasks_error[i]);
+    }
+    job->next_error = 0;
+
+    bximap_task_idx_t remaining_work = (job->end - job->start) % granularity;
+    if (remaining_work != 0) {
+        // With this granularity some work remain
+        if (job->nb_tasks == 0 || job->nb_tasks % job->nb_threads != 0) {
+            // Considering that each iteration takes the same time
+            // if the number of task isn't proportional to the number of threads
+            // the remaining work is done in an additional task
+            // this task will be done in parallel of other larger tasks
+            job->nb_tasks++;
+            remaining_work = 0;
         }
-        shared_info.ended++;
-        __sync_synchronize();
-        errno = 0;
-        rc = pthread_cond_wait(&wait_work, &cond_mutex);
-        if (0 != rc) {
-            err2 = bxierr_errno("Error on pthread cond wait");
-            BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
+    }
+    // Otherwise the remaining work is spread among all the tasks:
+    // the first (remaining_work % nb_tasks) tasks get one more iteration
+    job->task_size = granularity;
+    job->spread = 0;
+    job->spread_rest = 0;
+    if (remaining_work != 0) {
+        job->spread = remaining_work / job->nb_tasks;
+        job->spread_rest = remaining_work % job->nb_tasks;
+    }
+
+    TRACE(MAPPER_LOGGER,
+          "global task start: "  TASK_IDX_FMT " "
+          "global task end: "    TASK_IDX_FMT " "
+          "task granularity: "   TASK_IDX_FMT " "
+          "spread: "             TASK_IDX_FMT "+" TASK_IDX_FMT " "
+          "nb tasks: "           TASK_IDX_FMT,
+          job->start, job->end, granularity,
+          job->spread, job->spread_rest,
+          job->nb_tasks);
+    if (weighted) {
+        bxierr_p err = _weighted_bounds(job);
+        if (bxierr_isko(err)) return err;
+    }
+
+    if (job->run_sched == BXIMAP_SCHED_STEAL
+        || job->run_sched == BXIMAP_SCHED_STATIC
+        || job->run_sched == BXIMAP_SCHED_AFFINITY) {
+        if (job->deques_nb < job->nb_threads) {
+            BXIFREE(job->deques);
+            job->deques_nb = 0;
+            int rc = posix_memalign((void **)&job->deques, BXIMAP_CACHE_LINE,
+                                    (size_t)job->nb_threads * sizeof(*job->deques));
+            if (0 != rc) {
+                job->deques = NULL;
+                return bxierr_fromidx(rc, NULL, "Calling posix_memalign() failed");
+            }
+            memset(job->deques, 0, (size_t)job->nb_threads * sizeof(*job->deques));
+            job->deques_nb = job->nb_threads;
         }
-        errno = 0;
-        rc = pthread_mutex_unlock(&cond_mutex);
-        if (0 != rc) {
-            err2 = bxierr_errno("Error on pthread mutex unlock");
-            BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
+        // Each thread starts with an equal share of contiguous tasks
+        for (bximap_thrd_idx_t i = 0; i < job->nb_threads; i++) {
+            job->deques[i].next = job->nb_tasks * i / job->nb_threads;
+            job->deques[i].end = job->nb_tasks * (i + 1) / job->nb_threads;
         }
-#else
-        errno = 0;
-        TRACE(MAPPER_LOGGER, "Enter barrier")
-        rc = pthread_barrier_wait(&barrier);
-        TRACE(MAPPER_LOGGER, "Leave barrier")
-        if (0 != rc && PTHREAD_BARRIER_SERIAL_THREAD != rc) {
-            err2 = bxierr_errno("Error on pthread barrier wait");
-            BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
+    }
+    // The guided schedule counts iterations instead of tasks
+    job->next_task = job->run_sched == BXIMAP_SCHED_GUIDED ? job->start : 0;
+    job->busy_time = 0;
+
+    // The auto schedule needs the time spent in the tasks
+    job->timer = stats_mode;
+    if (BXIMAP_STATS_OFF == job->timer && BXIMAP_SCHED_AUTO == job->run_sched) {
+        job->timer = BXIMAP_STATS_CLOCK;
+    }
+    job->duration = 0;
+    if (BXIMAP_STATS_OFF != job->timer) {
+        if (job->stats_nb < job->nb_threads) {
+            BXIFREE(job->stats);
+            job->stats_nb = 0;
+            int rc = posix_memalign((void **)&job->stats, BXIMAP_CACHE_LINE,
+                                    (size_t)job->nb_threads * sizeof(*job->stats));
+            if (0 != rc) {
+                job->stats = NULL;
+                return bxierr_fromidx(rc, NULL, "Calling posix_memalign() failed");
+            }
+            job->stats_out = bximem_realloc(job->stats_out, 0,
+                                            (size_t)job->nb_threads
+                                            * sizeof(*job->stats_out));
+            job->stats_nb = job->nb_threads;
         }
-#endif
-#else
-        int rc = zmq_poll(items, 2, -1); // -1 -> wait infinitely
-        if (rc == -1) {
-            if (zmq_errno() == EINTR) continue;
-            return bxierr_errno("Calling zmq_poll failed.");
-        }
-        if (items [0].revents & ZMQ_POLLIN) {
-            zmq_msg_t zmsg;
-            errno = 0;
-            int rc = zmq_msg_init(&zmsg);
-            if (rc == -1) {
-                return bxierr_errno("Calling zmq_msg_init() failed.");
+        memset(job->stats, 0, (size_t)job->nb_threads * sizeof(*job->stats));
+        job->start_ticks = _timer_now(job->timer);
+    }
+    return BXIERR_OK;
+}
+
+/* Reserve the context and make its tasks available to the pool.
+ * The context is released by bximap_wait(). The parent is the job
+ * executing it from one of its tasks, it outlives the context */
+bxierr_p _start_job(bximap_ctx_p job, bool participate, bximap_ctx_p parent) {
+    bxierr_p err = _check_pool();
+    if (bxierr_isko(err)) return err;
+
+    if (__sync_lock_test_and_set(&job->running, 1)) {
+        return bxierr_new(BXIMAP_RUNNING,
+                          NULL, NULL, NULL, NULL,
+                          RUNNING_MSG);
+    }
+
+    job->done = false;
+    job->cancelled = 0;
+    job->parent_job = parent;
+    err = _prepare_job(job);
+    if (bxierr_isko(err)) {
+        __sync_lock_release(&job->running);
+        return err;
+    }
+    if (0 == job->nb_tasks) {
+        if (NULL != job->callback) job->callback(job, job->callback_data);
+        __atomic_store_n(&job->done, true, __ATOMIC_RELEASE);
+        return BXIERR_OK;
+    }
+    _submit_job(job, participate);
+    return BXIERR_OK;
+}
+
+/* Make the job visible to the idle threads of the pool */
+void _submit_job(bximap_ctx_p job, bool participate) {
+    int rc = pthread_mutex_lock(&shared_info.jobs_mutex);
+    bxiassert(0 == rc);
+    job->workers = participate ? 1 : 0;
+    job->listed = true;
+    job->next_job = NULL;
+    bximap_ctx_p * last = &shared_info.jobs;
+    while (NULL != *last) last = &(*last)->next_job;
+    __atomic_store_n(last, job, __ATOMIC_RELEASE);
+    shared_info.running++;
+    rc = pthread_mutex_unlock(&shared_info.jobs_mutex);
+    bxiassert(0 == rc);
+    _doorbell_ring();
+}
+
+/* Called by a thread which found no more task to claim in the job.
+ * The remaining tasks are owned by the threads still working on it,
+ * so the job is finished once the last of them leaves. */
+void _leave_job(bximap_ctx_p job, double working_time) {
+    int rc = pthread_mutex_lock(&shared_info.jobs_mutex);
+    bxiassert(0 == rc);
+    job->busy_time += working_time;
+    if (job->listed) {
+        bximap_ctx_p * prev = &shared_info.jobs;
+        while (*prev != job) prev = &(*prev)->next_job;
+        __atomic_store_n(prev, job->next_job, __ATOMIC_RELAXED);
+        job->listed = false;
+    }
+    job->workers--;
+    bool last = 0 == job->workers;
+    rc = pthread_mutex_unlock(&shared_info.jobs_mutex);
+    bxiassert(0 == rc);
+    if (last) _end_job(job);
+}
+
+/* Call the completion callback then wake up the waiters.
+ * The context may be released as soon as it is marked done. */
+void _end_job(bximap_ctx_p job) {
+    if (BXIMAP_STATS_OFF != job->timer) {
+        job->duration = _timer_seconds(job->timer,
+                                       _timer_now(job->timer) - job->start_ticks);
+    }
+    if (BXIMAP_SCHED_AUTO == job->run_sched) _auto_record(job);
+    if (NULL != job->callback) job->callback(job, job->callback_data);
+
+    int rc = pthread_mutex_lock(&shared_info.jobs_mutex);
+    bxiassert(0 == rc);
+    __atomic_store_n(&job->done, true, __ATOMIC_RELEASE);
+    shared_info.running--;
+    rc = pthread_mutex_unlock(&shared_info.jobs_mutex);
+    bxiassert(0 == rc);
+    _doorbell_ring();
+}
+
+/* Wait for the end of one of the jobs, its index is returned in idx.
+ * Threads of the pool run the tasks of these jobs, or of the maps nested
+ * in them, meanwhile: an unrelated job could hold the thread long after
+ * the awaited ones ended. */
+bxierr_p _wait_jobs(bximap_ctx_p * jobs, size_t n,
+                    bximap_thrd_idx_t thread_id, size_t * idx) {
+    bxierr_p err = BXIERR_OK, err2;
+    unsigned int spins = 0;
+    while (true) {
+        int epoch = __atomic_load_n(&shared_info.epoch, __ATOMIC_ACQUIRE);
+        for (size_t i = 0; i < n; i++) {
+            if (__atomic_load_n(&jobs[i]->done, __ATOMIC_ACQUIRE)) {
+                *idx = i;
+                return err;
             }
+        }
+        if (thread_id >= 0 && NULL != __atomic_load_n(&shared_info.jobs, __ATOMIC_ACQUIRE)) {
+            bximap_ctx_p other = _join_next(thread_id, jobs, n);
+            if (NULL != other) {
+                err2 = _work_on(other, thread_id);
+                BXIERR_CHAIN(err, err2);
+                spins = 0;
+                continue;
+            }
+        }
+        _doorbell_wait(epoch, &spins);
+    }
+}
 
-            rc = zmq_msg_recv(&zmsg, zocket_pull_tasks, 0);
-            if (rc == -1) {
-                while (rc == -1 && zmq_errno() == EINTR) {
-                    rc = zmq_msg_recv(&zmsg, zocket_pull_tasks, 0);
-                }
-                if (rc == -1) {
-                    return bxierr_errno("Can't receive a msg through zsocket: %p",
-                                        zocket_pull_tasks);
+/* Join the first listed job the thread can work on: jobs started before
+ * the pool grew have no room for the new threads, and a thread never
+ * enters again a job whose task it is running. If awaited is not NULL,
+ * only the n awaited jobs and the jobs nested in them are joined. */
+bximap_ctx_p _join_next(bximap_thrd_idx_t thread_id,
+                        bximap_ctx_p * awaited, size_t n) {
+    int rc = pthread_mutex_lock(&shared_info.jobs_mutex);
+    bxiassert(0 == rc);
+    bximap_ctx_p job = shared_info.jobs;
+    while (NULL != job
+           && (thread_id >= job->nb_threads
+               || _is_active(job)
+               || (NULL != awaited && !_descends(job, awaited, n)))) {
+        job = job->next_job;
+    }
+    if (NULL != job) job->workers++;
+    rc = pthread_mutex_unlock(&shared_info.jobs_mutex);
+    bxiassert(0 == rc);
+    return job;
+}
+
+/* Wake up the parked workers to check the number of active threads */
+void _resize_ring(void) {
+    __atomic_add_fetch(&shared_info.resize_epoch, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &shared_info.resize_epoch, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Empty the queue: the cell i is ready to be pushed at the position i */
+void _queue_reset(void) {
+    for (size_t i = 0; i < BXIMAP_QUEUE_SIZE; i++) shared_info.queue[i].seq = i;
+    shared_info.queue_tail = 0;
+    shared_info.queue_head = 0;
+}
+
+/* Bounded multi-producer multi-consumer queue (D. Vyukov): a thread claims
+ * a position with a compare and swap, then publishes the cell through its
+ * sequence number. Return false if the queue is full. */
+bool _queue_push(const _pool_task_s * task) {
+    size_t pos = __atomic_load_n(&shared_info.queue_tail, __ATOMIC_RELAXED);
+    while (true) {
+        _queue_cell_s * cell = &shared_info.queue[pos & (BXIMAP_QUEUE_SIZE - 1)];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (0 == diff) {
+            // On failure, pos is updated to the current tail
+            if (__atomic_compare_exchange_n(&shared_info.queue_tail, &pos, pos + 1,
+                                            true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->task = *task;
+                __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if (diff < 0) {
+            // The cell has not been popped since the previous round
+            return false;
+        } else {
+            pos = __atomic_load_n(&shared_info.queue_tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Pop the oldest call, return false if the queue is empty */
+bool _queue_pop(_pool_task_s * task) {
+    size_t pos = __atomic_load_n(&shared_info.queue_head, __ATOMIC_RELAXED);
+    while (true) {
+        _queue_cell_s * cell = &shared_info.queue[pos & (BXIMAP_QUEUE_SIZE - 1)];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (0 == diff) {
+            if (__atomic_compare_exchange_n(&shared_info.queue_head, &pos, pos + 1,
+                                            true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *task = cell->task;
+                // Ready to be pushed at the next round
+                __atomic_store_n(&cell->seq, pos + BXIMAP_QUEUE_SIZE, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&shared_info.queue_head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Wait for the flag to be set to value by another thread.
+ * Threads of the pool run the submitted calls and the maps meanwhile:
+ * a call waiting for the calls it submitted never blocks a thread */
+bxierr_p _wait_flag(volatile int * flag, int value) {
+    bximap_thrd_idx_t thread_id = _current_thread();
+    bxierr_p err = BXIERR_OK, err2;
+    unsigned int spins = 0;
+    while (true) {
+        int epoch = __atomic_load_n(&shared_info.epoch, __ATOMIC_ACQUIRE);
+        if (value == __atomic_load_n(flag, __ATOMIC_ACQUIRE)) return err;
+        if (thread_id >= 0) {
+            _pool_task_s task;
+            if (_queue_pop(&task)) {
+                _run_pool_task(&task);
+                spins = 0;
+                continue;
+            }
+            if (NULL != __atomic_load_n(&shared_info.jobs, __ATOMIC_ACQUIRE)) {
+                bximap_ctx_p job = _join_next(thread_id, NULL, 0);
+                if (NULL != job) {
+                    err2 = _work_on(job, thread_id);
+                    BXIERR_CHAIN(err, err2);
+                    spins = 0;
+                    continue;
                 }
             }
-            current_task = zmq_msg_data(&zmsg);
-            zmq_msg_close(&zmsg);
         }
-        // Any waiting controller command acts as 'KILL'
-        if (items[1].revents & ZMQ_POLLIN) {
-            break; // Exit loop
+        _doorbell_wait(epoch, &spins);
+    }
+}
+
+/* Run a node of a graph, then the nodes it was the last dependency of:
+ * the first of them is run by the same thread, on a warm cache, the
+ * others are submitted. The graph may be released once it is done. */
+bxierr_p _graph_run(void * arg) {
+    _graph_node_s * node = arg;
+    bximap_graph_p graph = node->graph;
+    while (NULL != node) {
+        bxierr_p err = NULL != node->map ? bximap_execute(node->map)
+                                         : node->func(node->arg);
+        if (bxierr_isko(err)) {
+            _spin_lock(&graph->errors_lock);
+            BXIERR_CHAIN(graph->err, err);
+            _spin_unlock(&graph->errors_lock);
         }
-#endif
+        _graph_node_s * next = NULL;
+        for (size_t i = 0; i < node->next_nb; i++) {
+            _graph_node_s * ready = &graph->nodes[node->next[i]];
+            if (0 != __atomic_sub_fetch(&ready->preds_left, 1, __ATOMIC_ACQ_REL)) continue;
+            if (NULL == next) {
+                next = ready;
+                continue;
+            }
+            __atomic_add_fetch(&graph->calls, 1, __ATOMIC_SEQ_CST);
+            _submit_call(&_graph_run, ready, NULL, &graph->calls);
+        }
+        if (0 == __atomic_sub_fetch(&graph->nodes_left, 1, __ATOMIC_ACQ_REL)) {
+            __atomic_store_n(&graph->done, 1, __ATOMIC_RELEASE);
+            _doorbell_ring();
+        }
+        node = next;
+    }
+    return BXIERR_OK;
+}
 
-        if (shared_info.global_task == &last_task) {
-            TRACE(MAPPER_LOGGER,
-                  "thread:"THRD_IDX_FMT" got last task", thread_id);
+/* Whether the stage has something to do: a batch to process with room for
+ * its result, or its end to propagate */
+bool _stage_ready(_stage_s * stage) {
+    bximap_pipeline_p pipeline = stage->pipeline;
+    if (__atomic_load_n(&stage->ended, __ATOMIC_SEQ_CST)) return false;
+    bool empty = false;
+    if (0 == stage->index) {
+        if (__atomic_load_n(&pipeline->stopping, __ATOMIC_SEQ_CST)) return true;
+    } else {
+        _stage_s * prev = pipeline->stages[stage->index - 1];
+        bool prev_ended = __atomic_load_n(&prev->ended, __ATOMIC_SEQ_CST);
+        empty = __atomic_load_n(&stage->head, __ATOMIC_SEQ_CST)
+                == __atomic_load_n(&stage->tail, __ATOMIC_SEQ_CST);
+        if (empty) return prev_ended;
+    }
+    if (stage->index + 1 == pipeline->stages_nb) return true;
+    _stage_s * next = pipeline->stages[stage->index + 1];
+    return __atomic_load_n(&next->tail, __ATOMIC_SEQ_CST)
+           - __atomic_load_n(&next->head, __ATOMIC_SEQ_CST) < pipeline->depth;
+}
+
+/* Submit an activation of the stage, unless one is already pending.
+ * Only called by a holder of an activation, so the pipeline is not
+ * released meanwhile. */
+void _stage_schedule(_stage_s * stage) {
+    if (!_stage_ready(stage)) return;
+    if (!__sync_bool_compare_and_swap(&stage->scheduled, 0, 1)) return;
+    __atomic_add_fetch(&stage->pipeline->active, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&stage->pipeline->calls, 1, __ATOMIC_SEQ_CST);
+    _submit_call(&_stage_run, stage, NULL, &stage->pipeline->calls);
+}
+
+/* No more batch will be pushed by the stage */
+void _stage_end(_stage_s * stage) {
+    bximap_pipeline_p pipeline = stage->pipeline;
+    __atomic_store_n(&stage->ended, 1, __ATOMIC_SEQ_CST);
+    if (stage->index + 1 == pipeline->stages_nb) {
+        __atomic_store_n(&pipeline->finished, 1, __ATOMIC_SEQ_CST);
+    } else {
+        _stage_schedule(pipeline->stages[stage->index + 1]);
+    }
+}
+
+/* Activation of a stage: process batches until the input queue is empty
+ * or the output queue is full */
+bxierr_p _stage_run(void * arg) {
+    _stage_s * stage = arg;
+    bximap_pipeline_p pipeline = stage->pipeline;
+    size_t mask = pipeline->depth - 1;
+    _stage_s * prev = 0 == stage->index ? NULL : pipeline->stages[stage->index - 1];
+    _stage_s * next = stage->index + 1 == pipeline->stages_nb ? NULL
+                      : pipeline->stages[stage->index + 1];
+    while (true) {
+        if (NULL == prev && __atomic_load_n(&pipeline->stopping, __ATOMIC_SEQ_CST)) {
+            _stage_end(stage);
             break;
         }
-        if (shared_info.global_task == NULL) {
-            TRACE(MAPPER_LOGGER,
-                  "thread:"THRD_IDX_FMT" got null pointer", thread_id);
+        // Only this stage pushes to the next queue: the room can only grow
+        if (NULL != next && __atomic_load_n(&next->tail, __ATOMIC_SEQ_CST)
+                            - __atomic_load_n(&next->head, __ATOMIC_SEQ_CST)
+                            == pipeline->depth) break;
+        void * batch = NULL;
+        if (NULL != prev) {
+            // Read before the queue: the last batch is pushed before the end
+            bool prev_ended = __atomic_load_n(&prev->ended, __ATOMIC_SEQ_CST);
+            size_t head = stage->head;
+            if (head == __atomic_load_n(&stage->tail, __ATOMIC_SEQ_CST)) {
+                if (prev_ended) _stage_end(stage);
+                break;
+            }
+            batch = stage->ring[head & mask];
+            __atomic_store_n(&stage->head, head + 1, __ATOMIC_SEQ_CST);
+            _stage_schedule(prev);
+        }
+        void * out = NULL;
+        bxierr_p err = stage->func(batch, &out, stage->usr_data);
+        if (bxierr_isko(err)) {
+            _spin_lock(&pipeline->errors_lock);
+            BXIERR_CHAIN(pipeline->err, err);
+            _spin_unlock(&pipeline->errors_lock);
+            __atomic_store_n(&pipeline->stopping, 1, __ATOMIC_SEQ_CST);
+        }
+        if (NULL == prev && NULL == out) {
+            _stage_end(stage);
             break;
         }
+        if (NULL != next && NULL != out) {
+            size_t tail = next->tail;
+            next->ring[tail & mask] = out;
+            __atomic_store_n(&next->tail, tail + 1, __ATOMIC_SEQ_CST);
+            _stage_schedule(next);
+        }
+    }
+    // A batch pushed after the last check finds the stage still scheduled
+    __atomic_store_n(&stage->scheduled, 0, __ATOMIC_SEQ_CST);
+    _stage_schedule(stage);
+    _pipeline_release(pipeline);
+    return BXIERR_OK;
+}
+
+/* Drop an activation: the pipeline is done once the last stage has ended
+ * and no activation remains */
+void _pipeline_release(bximap_pipeline_p pipeline) {
+    if (0 != __atomic_sub_fetch(&pipeline->active, 1, __ATOMIC_SEQ_CST)) return;
+    if (!__atomic_load_n(&pipeline->finished, __ATOMIC_SEQ_CST)) return;
+    __atomic_store_n(&pipeline->done, 1, __ATOMIC_RELEASE);
+    _doorbell_ring();
+}
+
+/* Kahn's algorithm: every node is reached from the nodes without
+ * dependency unless some of them are in a cycle */
+bool _graph_acyclic(bximap_graph_p graph) {
+    if (0 == graph->nodes_nb) return true;
+    size_t * left = bximem_calloc(graph->nodes_nb * sizeof(*left));
+    size_t * ready = bximem_calloc(graph->nodes_nb * sizeof(*ready));
+    size_t ready_nb = 0, reached = 0;
+    for (size_t i = 0; i < graph->nodes_nb; i++) {
+        left[i] = graph->nodes[i].preds;
+        if (0 == left[i]) ready[ready_nb++] = i;
+    }
+    while (0 < ready_nb) {
+        _graph_node_s * node = &graph->nodes[ready[--ready_nb]];
+        reached++;
+        for (size_t i = 0; i < node->next_nb; i++) {
+            if (0 == --left[node->next[i]]) ready[ready_nb++] = node->next[i];
+        }
+    }
+    BXIFREE(left);
+    BXIFREE(ready);
+    return reached == graph->nodes_nb;
+}
+
+/* Run a submitted call and publish its result.
+ * The future may be released as soon as it is marked done. */
+/* Queue a call, or run it if the queue is full or the pool has no worker */
+void _submit_call(bxierr_p (*func)(void * arg), void * arg,
+                  bximap_future_p future, volatile int * calls) {
+    _pool_task_s task = {.func = func, .arg = arg, .future = future, .calls = calls};
+    __atomic_add_fetch(&shared_info.pending, 1, __ATOMIC_SEQ_CST);
+    if (1 == __atomic_load_n(&shared_info.nb_threads, __ATOMIC_ACQUIRE)
+        || !_queue_push(&task)) {
+        _run_pool_task(&task);
+        return;
+    }
+    _doorbell_ring();
+}
 
-#ifndef ZMQ
-        working_time = 0;
-        nb_iterations = 0;
-        if (thread_id < shared_info.nb_tasks) {
-            current_task = &shared_info.tasks[thread_id];
+void _run_pool_task(_pool_task_s * task) {
+    // The call does not belong to the map the thread may be waiting for
+    bximap_ctx_p saved_job = current_job;
+    current_job = NULL;
+    bxierr_p err = task->func(task->arg);
+    current_job = saved_job;
+    if (NULL == task->future) {
+        if (bxierr_isko(err)) {
+            BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err, "Submitted call failed");
+        }
+        __atomic_sub_fetch(&shared_info.pending, 1, __ATOMIC_SEQ_CST);
+        // The owner of the counter may be released once it reaches 0
+        if (NULL != task->calls
+            && 0 == __atomic_sub_fetch(task->calls, 1, __ATOMIC_SEQ_CST)) {
+            _doorbell_ring();
+        }
+        return;
+    }
+    // Not pending anymore once the waiter can see the result
+    __atomic_sub_fetch(&shared_info.pending, 1, __ATOMIC_SEQ_CST);
+    task->future->result = err;
+    __atomic_store_n(&task->future->done, 1, __ATOMIC_RELEASE);
+    _doorbell_ring();
+}
+
+/* Create the workers [first, last[, bound to their cpu from the start */
+bxierr_p _create_threads(bximap_thrd_idx_t first, bximap_thrd_idx_t last) {
+    bxierr_p err = BXIERR_OK, err2;
+    for (bximap_thrd_idx_t i = first; i < last; i++) {
+        bximap_cpu_idx_t cpu = shared_info.threads_cpu[i];
+        pthread_attr_t attr;
+        int rc = pthread_attr_init(&attr);
+        bxiassert(0 == rc);
+        if (cpu >= 0) {
+            cpu_set_t * cpu_mask = CPU_ALLOC((size_t)cpu + 1);
+            size_t size = CPU_ALLOC_SIZE((size_t)cpu + 1);
+            if (NULL != cpu_mask) {
+                CPU_ZERO_S(size, cpu_mask);
+                CPU_SET_S((size_t)cpu, size, cpu_mask);
+                pthread_attr_setaffinity_np(&attr, size, cpu_mask);
+                CPU_FREE(cpu_mask);
+            }
             TRACE(MAPPER_LOGGER,
-                  "thread:"     THRD_IDX_FMT " "
-                  "start task:" TASK_IDX_FMT,
-                  thread_id, current_task->id);
-            err2 = bxitime_get(CLOCK_MONOTONIC, &starting_time);
-            BXIERR_CHAIN(err, err2);
-            bxierr_p task_err = _do_job(current_task, thread_id);
-            double duration;
-            err2 = bxitime_duration(CLOCK_MONOTONIC, starting_time, &duration);
+                  "Schedule on cpu="CPU_IDX_FMT" "
+                  "thread_id="THRD_IDX_FMT,
+                  cpu, i);
+        }
+        rc = pthread_create(&shared_info.threads_id[i], &attr,
+                            &_start_function, (void *)(intptr_t)i);
+        if (0 != rc && cpu >= 0) {
+            err2 = bxierr_fromidx(rc, NULL, "Can't be mapped on cpu "CPU_IDX_FMT, cpu);
+            BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
+            shared_info.threads_cpu[i] = -1;
+            rc = pthread_create(&shared_info.threads_id[i], NULL,
+                                &_start_function, (void *)(intptr_t)i);
+        }
+        pthread_attr_destroy(&attr);
+        if (0 != rc) {
+            err2 = bxierr_fromidx(rc, NULL, "Error on pthread create");
             BXIERR_CHAIN(err, err2);
-            working_time += duration;
-            nb_iterations += (current_task->end - current_task->start);
-            if (bxierr_isko(task_err)) {
-                bximap_thrd_idx_t next_error = __sync_fetch_and_add(&shared_info.global_task->next_error, 1);
-                TRACE(MAPPER_LOGGER,
-                      "thread:"     THRD_IDX_FMT " "
-                      "next_error " THRD_IDX_FMT,
-                      thread_id, next_error);
-                shared_info.global_task->tasks_error[next_error] = task_err;
-            }
+            break;
         }
+        shared_info.nb_created = i + 1;
+        TRACE(MAPPER_LOGGER, "Creation of one thread:"THRD_IDX_FMT, i);
+    }
+    return err;
+}
+
+/* Wait for the doorbell to be rung after epoch has been read.
+ * The thread polls for spin_budget rounds, then parks on the futex:
+ * a short wait does not pay for a system call on both sides. */
+void _doorbell_wait(int epoch, unsigned int * spins) {
+    if (*spins < spin_budget) {
+        (*spins)++;
+        _cpu_relax();
+        return;
+    }
+    __atomic_add_fetch(&shared_info.sleepers, 1, __ATOMIC_SEQ_CST);
+    // The futex returns at once if the epoch has changed meanwhile
+    syscall(SYS_futex, &shared_info.epoch, FUTEX_WAIT_PRIVATE, epoch, NULL, NULL, 0);
+    __atomic_sub_fetch(&shared_info.sleepers, 1, __ATOMIC_SEQ_CST);
+}
 
-        bximap_task_idx_t next_task = __sync_fetch_and_add(&shared_info.next_task, 1);
-        while (next_task < shared_info.nb_tasks) {
-            current_task = &shared_info.tasks[next_task];
+/* Ring the doorbell: the futex is only woken up when a thread is parked */
+void _doorbell_ring(void) {
+    __atomic_add_fetch(&shared_info.epoch, 1, __ATOMIC_SEQ_CST);
+    if (0 < __atomic_load_n(&shared_info.sleepers, __ATOMIC_SEQ_CST)) {
+        syscall(SYS_futex, &shared_info.epoch, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/* Run the tasks of a job the thread has joined, then leave it */
+bxierr_p _work_on(bximap_ctx_p job, bximap_thrd_idx_t thread_id) {
+    _work_s work = {.busy = 0, .tasks = 0, .iterations = 0, .steals = 0};
+    bximap_stats_mode_e timer = job->timer;
+    uint64_t joined = _timer_now(timer);
+    bxierr_p err = _run_tasks(job, thread_id, &work);
+    double working_time = _timer_seconds(timer, work.busy);
+    if (BXIMAP_STATS_OFF != timer) {
+        // The job may be released as soon as the thread has left it
+        bximap_thread_stats_s * stats = &job->stats[thread_id].s;
+        double in_job = _timer_seconds(timer, _timer_now(timer) - joined);
+        stats->busy_time += working_time;
+        stats->wait_time += in_job - working_time;
+        stats->tasks += work.tasks;
+        stats->iterations += work.iterations;
+        stats->steals += work.steals;
+    }
+    _leave_job(job, working_time);
+    DEBUG(MAPPER_LOGGER,
+          "Timing thread:"THRD_IDX_FMT" worked %f seconds "
+          "for "TASK_IDX_FMT" iterations",
+          thread_id, working_time, work.iterations);
+    return err;
+}
+
+/* Add the time the thread waited for the end of the job since the given
+ * timer ticks, once the job is done */
+void _add_wait_time(bximap_ctx_p job, bximap_thrd_idx_t thread_id, uint64_t since) {
+    if (thread_id < 0 || BXIMAP_STATS_OFF == job->timer) return;
+    if (NULL == job->stats || thread_id >= job->nb_threads) return;
+    job->stats[thread_id].s.wait_time += _timer_seconds(job->timer,
+                                                        _timer_now(job->timer) - since);
+}
+
+/* Ticks of the given timer: time stamp counter or nanoseconds */
+uint64_t _timer_now(bximap_stats_mode_e timer) {
+    switch (timer) {
+#if defined(__x86_64__) || defined(__i386__)
+    case BXIMAP_STATS_TSC:
+        return __builtin_ia32_rdtsc();
 #endif
-            TRACE(MAPPER_LOGGER,
-                  "thread:"THRD_IDX_FMT" start task:"TASK_IDX_FMT,
-                  thread_id, current_task->id);
-            err2 = bxitime_get(CLOCK_MONOTONIC, &starting_time);
-            BXIERR_CHAIN(err, err2);
-            bxierr_p task_err = _do_job(current_task, thread_id);
-            double tmp;
-            err2 = bxitime_duration(CLOCK_MONOTONIC, starting_time, &tmp);
-            BXIERR_CHAIN(err, err2);
-            working_time += tmp;
-            nb_iterations += (current_task->end - current_task->start);
-#ifndef ZMQ
-            if (bxierr_isko(task_err)) {
-                bximap_thrd_idx_t next_error = __sync_fetch_and_add(&shared_info.global_task->next_error, 1);
-                shared_info.global_task->tasks_error[next_error] = task_err;
+    case BXIMAP_STATS_OFF:
+        return 0;
+    default: {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000000000UL + (uint64_t)now.tv_nsec;
+    }
+    }
+}
+
+double _timer_seconds(bximap_stats_mode_e timer, uint64_t ticks) {
+    switch (timer) {
+    case BXIMAP_STATS_OFF:
+        return 0;
+    case BXIMAP_STATS_TSC:
+        return (double)ticks / tsc_hz;
+    default:
+        return (double)ticks * 1e-9;
+    }
+}
+
+/* Measure the frequency of the time stamp counter against the clock */
+void _tsc_calibrate(void) {
+    uint64_t clock_start = _timer_now(BXIMAP_STATS_CLOCK);
+    uint64_t tsc_start = _timer_now(BXIMAP_STATS_TSC);
+    uint64_t clock_end, tsc_end;
+    do {
+        clock_end = _timer_now(BXIMAP_STATS_CLOCK);
+        tsc_end = _timer_now(BXIMAP_STATS_TSC);
+    } while (clock_end - clock_start < 10000000UL);
+    tsc_hz = (double)(tsc_end - tsc_start) * 1e9 / (double)(clock_end - clock_start);
+    DEBUG(MAPPER_LOGGER, "Time stamp counter at %g Hz", tsc_hz);
+}
+
+bxierr_p _do_job(bximap_ctx_p job,
+                 bximap_task_idx_t start,
+                 bximap_task_idx_t end,
+                 bximap_thrd_idx_t thread_id) {
+    TRACE(MAPPER_LOGGER,
+          "start "     TASK_IDX_FMT ", "
+          "end "       TASK_IDX_FMT ", "
+          "thread_id " THRD_IDX_FMT,
+          start, end, thread_id);
+    // Nested maps run their own tasks meanwhile
+    bximap_ctx_p outer_job = current_job;
+    _active_job_s active = {.job = job, .outer = active_jobs};
+    current_job = job;
+    active_jobs = &active;
+    bxierr_p err = job->func(start, end, thread_id, job->usr_data);
+    active_jobs = active.outer;
+    current_job = outer_job;
+    return err;
+}
+
+/* Whether a task of the job is on the stack of the thread */
+bool _is_active(bximap_ctx_p job) {
+    for (const _active_job_s * active = active_jobs; NULL != active; active = active->outer) {
+        if (active->job == job) return true;
+    }
+    return false;
+}
+
+/* Whether the job is one of the awaited ones or is nested in one of them.
+ * The parents of a listed job are running, so they can be read. */
+bool _descends(bximap_ctx_p job, bximap_ctx_p * awaited, size_t n) {
+    for (bximap_ctx_p parent = job; NULL != parent; parent = parent->parent_job) {
+        for (size_t i = 0; i < n; i++) {
+            if (parent == awaited[i]) return true;
+        }
+    }
+    return false;
+}
+
+/* Bounds of tasks of the same cost: the task k ends at the first iteration
+ * where the cost reaches k / nb_tasks of the total. The weights are summed
+ * up as they are read, a prefix cost is searched for each bound.
+ * Without any cost, the range is cut evenly. */
+bxierr_p _weighted_bounds(bximap_ctx_p job) {
+    if (job->bounds_size < job->nb_tasks + 1) {
+        job->bounds = bximem_realloc(job->bounds,
+                                     (size_t)job->bounds_size * sizeof(*job->bounds),
+                                     (size_t)(job->nb_tasks + 1) * sizeof(*job->bounds));
+        job->bounds_size = job->nb_tasks + 1;
+    }
+    bximap_task_idx_t nb_tasks = job->nb_tasks;
+    job->bounds[0] = job->start;
+    job->bounds[nb_tasks] = job->end;
+    if (NULL != job->weights) {
+        double total = 0;
+        for (bximap_task_idx_t i = 0; i < job->end - job->start; i++) {
+            // Also false for NaN
+            if (!(job->weights[i] >= 0)) {
+                return bxierr_new(BXIMAP_ARG_ERROR, NULL, NULL, NULL, NULL,
+                                  "Invalid weight %g of the iteration "TASK_IDX_FMT,
+                                  job->weights[i], job->start + i);
             }
-            next_task = __sync_fetch_and_add(&shared_info.next_task, 1);
+            total += job->weights[i];
         }
-        DEBUG(MAPPER_LOGGER,
-              "Timing thread:"THRD_IDX_FMT" worked %f seconds "
-              "for "TASK_IDX_FMT" iterations",
-              thread_id, working_time, nb_iterations);
-#ifndef FADD
-        errno = 0;
-        TRACE(MAPPER_LOGGER, "Enter barrier")
-        rc = pthread_barrier_wait(&barrier);
-        TRACE(MAPPER_LOGGER, "Leave barrier")
-        if (0 != rc && PTHREAD_BARRIER_SERIAL_THREAD != rc) {
-            err2 = bxierr_errno("Error on pthread barrier wait");
-            BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err2, "Error");
+        if (!(total > 0)) return _even_weighted_bounds(job);
+        double sum = 0;
+        bximap_task_idx_t task = 1;
+        for (bximap_task_idx_t i = job->start; i < job->end && task < nb_tasks; i++) {
+            sum += job->weights[i - job->start];
+            while (task < nb_tasks && sum >= total * (double)task / (double)nb_tasks) {
+                job->bounds[task++] = i + 1;
+            }
         }
-#endif
-#else
-        err2 = bxizmq_data_snd(&task_err, sizeof(task_err),
-                               zocket_push_result, 0, 10, 10000);
-        BXIERR_CHAIN(err, err2);
-#endif
+        while (task < nb_tasks) job->bounds[task++] = job->end;
+        return BXIERR_OK;
+    }
+    double base = job->cost(job->start, job->cost_data);
+    double total = job->cost(job->end, job->cost_data) - base;
+    if (!(total > 0)) return _even_weighted_bounds(job);
+    for (bximap_task_idx_t task = 1; task < nb_tasks; task++) {
+        double target = base + total * (double)task / (double)nb_tasks;
+        bximap_task_idx_t low = job->bounds[task - 1], high = job->end;
+        while (low < high) {
+            bximap_task_idx_t mid = low + (high - low) / 2;
+            if (job->cost(mid, job->cost_data) < target) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        job->bounds[task] = low;
+    }
+    return BXIERR_OK;
+}
 
+/* Bounds of the tasks without weights, for a range of no cost at all */
+bxierr_p _even_weighted_bounds(bximap_ctx_p job) {
+    bximap_task_idx_t end;
+    for (bximap_task_idx_t task = 1; task < job->nb_tasks; task++) {
+        _even_bounds(job, task, &job->bounds[task], &end);
     }
-#ifdef ZMQ
-    TRACE(MAPPER_LOGGER, "thread:"THRD_IDX_FMT" clean zmq", thread_id);
-    INFO(MAPPER_LOGGER,
-         "Timing thread:"THRD_IDX_FMT" worked %f seconds "
-         "for "TASK_IDX_FMT" iterations",
-         thread_id, working_time, nb_iterations);
-    err2 = bxizmq_zocket_destroy(zocket_sub_end);
-    BXIERR_CHAIN(err, err2);
-    err2 = bxizmq_zocket_destroy(zocket_pull_tasks);
-    BXIERR_CHAIN(err, err2);
-    err2 = bxizmq_zocket_destroy(zocket_push_result);
+    return BXIERR_OK;
+}
+
+/* Compute the iterations of the task task_idx of the job */
+void _task_bounds(bximap_ctx_p job,
+                  bximap_task_idx_t task_idx,
+                  bximap_task_idx_t * start,
+                  bximap_task_idx_t * end) {
+    if (NULL != job->weights || NULL != job->cost) {
+        *start = job->bounds[task_idx];
+        *end = job->bounds[task_idx + 1];
+        return;
+    }
+    _even_bounds(job, task_idx, start, end);
+}
+
+/* Compute the iterations of the task task_idx cut evenly */
+void _even_bounds(bximap_ctx_p job,
+                  bximap_task_idx_t task_idx,
+                  bximap_task_idx_t * start,
+                  bximap_task_idx_t * end) {
+    bximap_task_idx_t size = job->task_size + job->spread;
+    *start = job->start + task_idx * size
+             + (task_idx < job->spread_rest ? task_idx : job->spread_rest);
+    if (task_idx < job->spread_rest) size++;
+    *end = *start + size;
+    if (*end > job->end) *end = job->end;
+}
+
+/* Record the error of a task, the array only grows when tasks fail */
+void _append_error(bximap_ctx_p context, bxierr_p err) {
+    _spin_lock(&context->errors_lock);
+    if (context->next_error == context->errors_size) {
+        bximap_thrd_idx_t size = context->errors_size == 0 ? BXIMAP_ERRORS_INIT_SIZE
+                                                           : 2 * context->errors_size;
+        context->tasks_error = bximem_realloc(context->tasks_error,
+                                              (size_t)context->errors_size
+                                              * sizeof(*context->tasks_error),
+                                              (size_t)size * sizeof(*context->tasks_error));
+        context->errors_size = size;
+    }
+    context->tasks_error[context->next_error++] = err;
+    _spin_unlock(&context->errors_lock);
+}
+
+/* Execute the iterations [start, end[ of the job and record their error */
+void _run_task(bximap_ctx_p job,
+               bximap_task_idx_t start,
+               bximap_task_idx_t end,
+               bximap_thrd_idx_t thread_id,
+               _work_s * work) {
+    // Weighted tasks are empty when a single iteration costs more
+    if (start == end) return;
+    TRACE(MAPPER_LOGGER,
+          "thread:"THRD_IDX_FMT" start task:["TASK_IDX_FMT", "TASK_IDX_FMT"[",
+          thread_id, start, end);
+    bxierr_p task_err;
+    if (BXIMAP_STATS_OFF == job->timer) {
+        task_err = _do_job(job, start, end, thread_id);
+    } else {
+        uint64_t starting_time = _timer_now(job->timer);
+        task_err = _do_job(job, start, end, thread_id);
+        work->busy += _timer_now(job->timer) - starting_time;
+    }
+    work->tasks++;
+    work->iterations += end - start;
+    if (bxierr_isko(task_err)) {
+        TRACE(MAPPER_LOGGER,
+              "thread:" THRD_IDX_FMT " task:[" TASK_IDX_FMT ", " TASK_IDX_FMT "[ failed",
+              thread_id, start, end);
+        _append_error(job, task_err);
+        if (job->stop_on_error) __atomic_store_n(&job->cancelled, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Execute the tasks of the job until none remains to be claimed,
+ * or the job is cancelled */
+bxierr_p _run_tasks(bximap_ctx_p job,
+                    bximap_thrd_idx_t thread_id,
+                    _work_s * work) {
+    bxierr_p err = BXIERR_OK;
+    bximap_task_idx_t task_idx, start, end;
+
+    switch (job->run_sched) {
+    case BXIMAP_SCHED_STEAL:
+    case BXIMAP_SCHED_AFFINITY:
+        while (!_cancelled(job)) {
+            if (!_deque_pop(&job->deques[thread_id], &task_idx)) {
+                if (!_deque_steal(job, thread_id, &task_idx)) break;
+                work->steals++;
+            }
+            _task_bounds(job, task_idx, &start, &end);
+            _run_task(job, start, end, thread_id, work);
+        }
+        return err;
+    case BXIMAP_SCHED_STATIC:
+        // The share of the thread first, then the shares of the threads
+        // which have not joined the job (yet)
+        for (bximap_thrd_idx_t i = 0; i < job->nb_threads; i++) {
+            bximap_task_idx_t first, last;
+            if (!_deque_take(&job->deques[(thread_id + i) % job->nb_threads],
+                             &first, &last)) continue;
+            if (0 != i) work->steals++;
+            for (task_idx = first; task_idx < last && !_cancelled(job); task_idx++) {
+                _task_bounds(job, task_idx, &start, &end);
+                _run_task(job, start, end, thread_id, work);
+            }
+        }
+        return err;
+    case BXIMAP_SCHED_GUIDED:
+        while (!_cancelled(job) && _guided_next(job, &start, &end)) {
+            _run_task(job, start, end, thread_id, work);
+        }
+        return err;
+    default:
+        break;
+    }
+
+    // Threads join the job at any time: every task is fetched
+    // from the shared counter
+    task_idx = __sync_fetch_and_add(&job->next_task, 1);
+    while (task_idx < job->nb_tasks && !_cancelled(job)) {
+        _task_bounds(job, task_idx, &start, &end);
+        _run_task(job, start, end, thread_id, work);
+        task_idx = __sync_fetch_and_add(&job->next_task, 1);
+    }
+    return err;
+}
+
+/* Pop the next task owned by the thread */
+bool _deque_pop(_task_deque_s * deque, bximap_task_idx_t * task_idx) {
+    bool found = false;
+    _spin_lock(&deque->lock);
+    if (deque->next < deque->end) {
+        *task_idx = deque->next;
+        __atomic_store_n(&deque->next, deque->next + 1, __ATOMIC_RELAXED);
+        found = true;
+    }
+    _spin_unlock(&deque->lock);
+    return found;
+}
+
+/* Steal the second half of the tasks remaining in another thread deque.
+ * The first stolen task is returned, the others are moved into the deque
+ * of the thief. Victims are scanned from the next thread index so thieves
+ * spread over different victims. The deques of the threads which did not
+ * join the job are only emptied by thieves. */
+bool _deque_steal(bximap_ctx_p job,
+                  bximap_thrd_idx_t thread_id,
+                  bximap_task_idx_t * task_idx) {
+    if (BXIMAP_SCHED_AFFINITY != job->run_sched) {
+        for (bximap_thrd_idx_t i = 1; i < job->nb_threads; i++) {
+            bximap_thrd_idx_t victim_id = (thread_id + i) % job->nb_threads;
+            if (_deque_steal_from(job, thread_id, victim_id, task_idx)) return true;
+        }
+        return false;
+    }
+    // The threads of the same NUMA node first, then the remote ones
+    int node = shared_info.threads_node[thread_id];
+    for (int remote = 0; remote < 2; remote++) {
+        for (bximap_thrd_idx_t i = 1; i < job->nb_threads; i++) {
+            bximap_thrd_idx_t victim_id = (thread_id + i) % job->nb_threads;
+            if ((shared_info.threads_node[victim_id] != node) != remote) continue;
+            if (_deque_steal_from(job, thread_id, victim_id, task_idx)) return true;
+        }
+    }
+    return false;
+}
+
+/* Move the second half of the tasks of the victim to the deque of the thread */
+bool _deque_steal_from(bximap_ctx_p job,
+                       bximap_thrd_idx_t thread_id,
+                       bximap_thrd_idx_t victim_id,
+                       bximap_task_idx_t * task_idx) {
+    _task_deque_s * victim = &job->deques[victim_id];
+    // Do not lock deques which look empty
+    if (__atomic_load_n(&victim->next, __ATOMIC_RELAXED)
+        >= __atomic_load_n(&victim->end, __ATOMIC_RELAXED)) return false;
+
+    _spin_lock(&victim->lock);
+    bximap_task_idx_t remaining = victim->end - victim->next;
+    if (remaining <= 0) {
+        _spin_unlock(&victim->lock);
+        return false;
+    }
+    bximap_task_idx_t end = victim->end;
+    bximap_task_idx_t first = end - (remaining + 1) / 2;
+    __atomic_store_n(&victim->end, first, __ATOMIC_RELAXED);
+    _spin_unlock(&victim->lock);
+
+    _task_deque_s * deque = &job->deques[thread_id];
+    _spin_lock(&deque->lock);
+    __atomic_store_n(&deque->next, first + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->end, end, __ATOMIC_RELAXED);
+    _spin_unlock(&deque->lock);
+    TRACE(MAPPER_LOGGER,
+          "thread:"THRD_IDX_FMT" stole tasks "
+          "["TASK_IDX_FMT", "TASK_IDX_FMT"[ from thread:"THRD_IDX_FMT,
+          thread_id, first, end, victim_id);
+    *task_idx = first;
+    return true;
+}
+
+/* Take all the tasks remaining in the deque */
+bool _deque_take(_task_deque_s * deque,
+                 bximap_task_idx_t * first,
+                 bximap_task_idx_t * end) {
+    if (__atomic_load_n(&deque->next, __ATOMIC_RELAXED)
+        >= __atomic_load_n(&deque->end, __ATOMIC_RELAXED)) return false;
+    bool found = false;
+    _spin_lock(&deque->lock);
+    if (deque->next < deque->end) {
+        *first = deque->next;
+        *end = deque->end;
+        __atomic_store_n(&deque->next, deque->end, __ATOMIC_RELAXED);
+        found = true;
+    }
+    _spin_unlock(&deque->lock);
+    return found;
+}
+
+/* Claim the next chunk of iterations of the guided schedule.
+ * As with OpenMP, chunks are the remaining iterations divided by the
+ * number of threads, but never smaller than the context granularity. */
+bool _guided_next(bximap_ctx_p job,
+                  bximap_task_idx_t * start,
+                  bximap_task_idx_t * end) {
+    bximap_task_idx_t min = job->granularity > 0 ? job->granularity : 1;
+    bximap_task_idx_t next = __atomic_load_n(&job->next_task, __ATOMIC_RELAXED);
+    bximap_task_idx_t chunk;
+    do {
+        bximap_task_idx_t remaining = job->end - next;
+        if (remaining <= 0) return false;
+        chunk = (remaining + job->nb_threads - 1) / job->nb_threads;
+        if (chunk < min) chunk = min;
+        if (chunk > remaining) chunk = remaining;
+    } while (!__atomic_compare_exchange_n(&job->next_task, &next, next + chunk, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    *start = next;
+    *end = next + chunk;
+    return true;
+}
+
+/* Granularity of BXIMAP_SCHED_AUTO: tasks long enough to hide the dispatch
+ * overhead, according to the time per iteration measured by the previous
+ * executions of the same function, but enough tasks per thread to balance
+ * the load at the end of the map. */
+bximap_task_idx_t _auto_granularity(bximap_ctx_p job,
+                                    bximap_task_idx_t granularity) {
+    size_t slot = (size_t)((uintptr_t)job->func >> 4) % BXIMAP_AUTO_ENTRIES;
+    double iteration_time = 0;
+    _spin_lock(&auto_lock);
+    if (auto_table[slot].func == job->func) {
+        iteration_time = auto_table[slot].iteration_time;
+    }
+    _spin_unlock(&auto_lock);
+    if (iteration_time <= 0) return granularity;
+
+    bximap_task_idx_t max = (job->end - job->start)
+                            / (BXIMAP_AUTO_TASKS_PER_THREAD * job->nb_threads);
+    if (max < 1) max = 1;
+    double best = BXIMAP_AUTO_TASK_TIME / iteration_time;
+    granularity = best >= (double)max ? max : (bximap_task_idx_t)best;
+    if (granularity < 1) granularity = 1;
+    TRACE(MAPPER_LOGGER,
+          "auto granularity "TASK_IDX_FMT" for %g seconds per iteration",
+          granularity, iteration_time);
+    return granularity;
+}
+
+/* Record the time per iteration of the ended job */
+void _auto_record(bximap_ctx_p job) {
+    bximap_task_idx_t iterations = job->end - job->start;
+    if (iterations <= 0 || job->busy_time <= 0) return;
+    double measured = job->busy_time / (double)iterations;
+    size_t slot = (size_t)((uintptr_t)job->func >> 4) % BXIMAP_AUTO_ENTRIES;
+    _spin_lock(&auto_lock);
+    if (auto_table[slot].func != job->func) {
+        // Direct mapped: another function is evicted
+        auto_table[slot].func = job->func;
+        auto_table[slot].iteration_time = measured;
+    } else {
+        auto_table[slot].iteration_time = (auto_table[slot].iteration_time + measured) / 2;
+    }
+    _spin_unlock(&auto_lock);
+}
+
+bxierr_p _reduce_func(bximap_task_idx_t start,
+                      bximap_task_idx_t end,
+                      bximap_thrd_idx_t thread,
+                      void * usr_data) {
+    _reduce_s * reduce = (_reduce_s *)usr_data;
+    char * accs = __atomic_load_n(&reduce->accs, __ATOMIC_ACQUIRE);
+    if (NULL == accs) {
+        // One accumulator for each thread the job has room for
+        bximap_thrd_idx_t nb_threads = current_job->nb_threads;
+        char * new_accs = NULL;
+        int rc = posix_memalign((void **)&new_accs, BXIMAP_CACHE_LINE,
+                                (size_t)nb_threads * reduce->acc_stride);
+        if (0 != rc) return bxierr_fromidx(rc, NULL, "Calling posix_memalign() failed");
+        for (bximap_thrd_idx_t i = 0; i < nb_threads; i++) {
+            reduce->identity(new_accs + (size_t)i * reduce->acc_stride, reduce->usr_data);
+        }
+        if (__atomic_compare_exchange_n(&reduce->accs, &accs, new_accs, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            // Read by bximap_reduce() once the job ended
+            reduce->nb_threads = nb_threads;
+            accs = new_accs;
+        } else {
+            BXIFREE(new_accs);
+        }
+    }
+    return reduce->func(start, end, thread,
+                        accs + (size_t)thread * reduce->acc_stride,
+                        reduce->usr_data);
+}
+
+/* Run the blocks [0, nb_blocks[ on the pool, one per task.
+ * A single block is run by the calling thread. */
+bxierr_p _run_blocks(size_t nb_blocks,
+                     bxierr_p (*func)(bximap_task_idx_t start,
+                                      bximap_task_idx_t end,
+                                      bximap_thrd_idx_t thread,
+                                      void * usr_data),
+                     void * usr_data) {
+    if (1 == nb_blocks) return func(0, 1, 0, usr_data);
+    bximap_ctx_p context = NULL;
+    bxierr_p err = bximap_new(0, (bximap_task_idx_t)nb_blocks, 1, func, usr_data, &context);
+    bxierr_p err2 = bximap_execute(context);
     BXIERR_CHAIN(err, err2);
-#endif
+    bximap_destroy(&context);
+    return err;
+}
+
+/* A few blocks per thread, but blocks long enough to hide the dispatch */
+size_t _nb_blocks(size_t n) {
+    size_t nb_blocks = (size_t)shared_info.nb_threads * BXIMAP_SORT_BLOCKS;
+    size_t max_blocks = (n + BXIMAP_SORT_BLOCK - 1) / BXIMAP_SORT_BLOCK;
+    return nb_blocks < max_blocks ? nb_blocks : max_blocks;
+}
+
+bxierr_p _sort_block_func(bximap_task_idx_t start,
+                          bximap_task_idx_t end,
+                          bximap_thrd_idx_t thread,
+                          void * usr_data) {
+    UNUSED(thread);
+    _sort_s * sort = usr_data;
+    for (size_t b = (size_t)start; b < (size_t)end; b++) {
+        size_t first = b * sort->block;
+        if (first >= sort->n) break;
+        size_t nb = sort->n - first < sort->block ? sort->n - first : sort->block;
+        qsort(sort->src + first * sort->size, nb, sort->size, sort->compar);
+    }
+    return BXIERR_OK;
+}
+
+/* Merge a piece of two sorted runs: the piece p of a merge writes the
+ * outputs [p * len / pieces, (p + 1) * len / pieces[ of the merge */
+bxierr_p _merge_func(bximap_task_idx_t start,
+                     bximap_task_idx_t end,
+                     bximap_thrd_idx_t thread,
+                     void * usr_data) {
+    UNUSED(thread);
+    _sort_s * sort = usr_data;
+    size_t size = sort->size;
+    for (size_t t = (size_t)start; t < (size_t)end; t++) {
+        size_t merge = t / sort->pieces, piece = t % sort->pieces;
+        size_t lo = merge * 2 * sort->width;
+        size_t mid = lo + sort->width < sort->n ? lo + sort->width : sort->n;
+        size_t hi = mid + sort->width < sort->n ? mid + sort->width : sort->n;
+        const char * left = sort->src + lo * size;
+        const char * right = sort->src + mid * size;
+        size_t nl = mid - lo, nr = hi - mid;
+        size_t k0 = (hi - lo) * piece / sort->pieces;
+        size_t k1 = (hi - lo) * (piece + 1) / sort->pieces;
+        size_t i = _merge_corank(sort, k0, left, nl, right, nr), j = k0 - i;
+        size_t i1 = _merge_corank(sort, k1, left, nl, right, nr), j1 = k1 - i1;
+        char * out = sort->dst + (lo + k0) * size;
+        while (i < i1 && j < j1) {
+            // The left element first on ties
+            if (sort->compar(right + j * size, left + i * size) < 0) {
+                memcpy(out, right + j++ * size, size);
+            } else {
+                memcpy(out, left + i++ * size, size);
+            }
+            out += size;
+        }
+        memcpy(out, left + i * size, (i1 - i) * size);
+        out += (i1 - i) * size;
+        memcpy(out, right + j * size, (j1 - j) * size);
+    }
+    return BXIERR_OK;
+}
+
+/* Number of elements of the left run among the first k of the merge:
+ * the first i such that left[i] is after right[k - i - 1] */
+size_t _merge_corank(_sort_s * sort, size_t k,
+                     const char * left, size_t nl,
+                     const char * right, size_t nr) {
+    size_t low = k > nr ? k - nr : 0, high = k < nl ? k : nl;
+    while (low < high) {
+        size_t i = low + (high - low) / 2, j = k - i;
+        if (sort->compar(left + i * sort->size, right + (j - 1) * sort->size) <= 0) {
+            low = i + 1;
+        } else {
+            high = i;
+        }
+    }
+    return low;
+}
+
+/* Copy the blocks from src to dst */
+bxierr_p _copy_func(bximap_task_idx_t start,
+                    bximap_task_idx_t end,
+                    bximap_thrd_idx_t thread,
+                    void * usr_data) {
+    UNUSED(thread);
+    _sort_s * sort = usr_data;
+    size_t first = (size_t)start * sort->block;
+    size_t last = (size_t)end * sort->block;
+    if (last > sort->n) last = sort->n;
+    if (first < last) {
+        memcpy(sort->dst + first * sort->size, sort->src + first * sort->size,
+               (last - first) * sort->size);
+    }
+    return BXIERR_OK;
+}
+
+/* Compute the keys of the blocks and their largest bits */
+bxierr_p _key_func(bximap_task_idx_t start,
+                   bximap_task_idx_t end,
+                   bximap_thrd_idx_t thread,
+                   void * usr_data) {
+    UNUSED(thread);
+    _sort_s * sort = usr_data;
+    for (size_t b = (size_t)start; b < (size_t)end; b++) {
+        size_t last = (b + 1) * sort->block < sort->n ? (b + 1) * sort->block : sort->n;
+        uint64_t bits = 0;
+        for (size_t i = b * sort->block; i < last; i++) {
+            sort->keys_src[i] = sort->key(sort->src + i * sort->size);
+            bits |= sort->keys_src[i];
+        }
+        sort->max_keys[b] = bits;
+    }
+    return BXIERR_OK;
+}
+
+bxierr_p _radix_count_func(bximap_task_idx_t start,
+                           bximap_task_idx_t end,
+                           bximap_thrd_idx_t thread,
+                           void * usr_data) {
+    UNUSED(thread);
+    _sort_s * sort = usr_data;
+    for (size_t b = (size_t)start; b < (size_t)end; b++) {
+        size_t * counts = sort->counts + b * BXIMAP_RADIX;
+        memset(counts, 0, BXIMAP_RADIX * sizeof(*counts));
+        size_t last = (b + 1) * sort->block < sort->n ? (b + 1) * sort->block : sort->n;
+        for (size_t i = b * sort->block; i < last; i++) {
+            counts[(sort->keys_src[i] >> sort->shift) & (BXIMAP_RADIX - 1)]++;
+        }
+    }
+    return BXIERR_OK;
+}
+
+/* Move the elements of the blocks to their offset, in order: stable */
+bxierr_p _radix_scatter_func(bximap_task_idx_t start,
+                             bximap_task_idx_t end,
+                             bximap_thrd_idx_t thread,
+                             void * usr_data) {
+    UNUSED(thread);
+    _sort_s * sort = usr_data;
+    for (size_t b = (size_t)start; b < (size_t)end; b++) {
+        size_t * offsets = sort->counts + b * BXIMAP_RADIX;
+        size_t last = (b + 1) * sort->block < sort->n ? (b + 1) * sort->block : sort->n;
+        for (size_t i = b * sort->block; i < last; i++) {
+            size_t pos = offsets[(sort->keys_src[i] >> sort->shift) & (BXIMAP_RADIX - 1)]++;
+            memcpy(sort->dst + pos * sort->size, sort->src + i * sort->size, sort->size);
+            sort->keys_dst[pos] = sort->keys_src[i];
+        }
+    }
+    return BXIERR_OK;
+}
+
+bxierr_p _scan_sum_func(bximap_task_idx_t start,
+                        bximap_task_idx_t end,
+                        bximap_thrd_idx_t thread,
+                        void * usr_data) {
+    UNUSED(thread);
+    _scan_s * scan = usr_data;
+    for (size_t b = (size_t)start; b < (size_t)end; b++) {
+        size_t last = (b + 1) * scan->block < scan->n ? (b + 1) * scan->block : scan->n;
+        int64_t sum = 0;
+        for (size_t i = b * scan->block; i < last; i++) sum += scan->in[i];
+        scan->sums[b] = sum;
+    }
+    return BXIERR_OK;
+}
+
+/* Each input is read before its output is written: in and out may alias */
+bxierr_p _scan_write_func(bximap_task_idx_t start,
+                          bximap_task_idx_t end,
+                          bximap_thrd_idx_t thread,
+                          void * usr_data) {
+    UNUSED(thread);
+    _scan_s * scan = usr_data;
+    for (size_t b = (size_t)start; b < (size_t)end; b++) {
+        size_t last = (b + 1) * scan->block < scan->n ? (b + 1) * scan->block : scan->n;
+        int64_t sum = scan->sums[b];
+        if (scan->inclusive) {
+            for (size_t i = b * scan->block; i < last; i++) {
+                sum += scan->in[i];
+                scan->out[i] = sum;
+            }
+        } else {
+            for (size_t i = b * scan->block; i < last; i++) {
+                int64_t value = scan->in[i];
+                scan->out[i] = sum;
+                sum += value;
+            }
+        }
+    }
+    return BXIERR_OK;
+}
+
+/* Run the tiles [start, end[ in Morton order */
+bxierr_p _nd_func(bximap_task_idx_t start,
+                  bximap_task_idx_t end,
+                  bximap_thrd_idx_t thread,
+                  void * usr_data) {
+    _nd_s * nd = (_nd_s *)usr_data;
+    bximap_tile_s tile;
+    tile.dims = nd->dims;
+    bximap_task_idx_t coords[BXIMAP_ND_MAX];
+    for (bximap_task_idx_t i = start; i < end; i++) {
+        _nd_tile(nd, i, coords);
+        for (int k = 0; k < nd->dims; k++) {
+            tile.start[k] = nd->start[k] + coords[k] * nd->tile[k];
+            tile.end[k] = tile.start[k] + nd->tile[k];
+            if (tile.end[k] > nd->end[k]) tile.end[k] = nd->end[k];
+        }
+        bxierr_p err = nd->func(&tile, thread, nd->usr_data);
+        if (bxierr_isko(err)) return err;
+    }
+    return BXIERR_OK;
+}
+
+/* Coordinates of the tile of the given rank along the Z curve, whose code
+ * interleaves the bits of the coordinates, the first dimension in the
+ * least significant bit of each level. The codes of the tiles beyond the
+ * grid are skipped: the code is read from its most significant bit, each
+ * bit chooses the half of the remaining box which holds the rank, from the
+ * number of tiles of the grid in its lower half. */
+void _nd_tile(const _nd_s * nd, bximap_task_idx_t rank, bximap_task_idx_t * coords) {
+    bximap_task_idx_t width[BXIMAP_ND_MAX];
+    for (int k = 0; k < nd->dims; k++) {
+        coords[k] = 0;
+        width[k] = (bximap_task_idx_t)1 << nd->bits[k];
+    }
+    for (unsigned int b = nd->max_bits; b-- > 0;) {
+        for (int k = nd->dims - 1; k >= 0; k--) {
+            if (b >= nd->bits[k]) continue;
+            bximap_task_idx_t half = width[k] / 2;
+            // Tiles of the grid in the lower half of the box
+            bximap_task_idx_t lower = 1;
+            for (int j = 0; j < nd->dims; j++) {
+                bximap_task_idx_t size = j == k ? half : width[j];
+                bximap_task_idx_t last = coords[j] + size;
+                if (last > nd->tiles[j]) last = nd->tiles[j];
+                lower *= last > coords[j] ? last - coords[j] : 0;
+            }
+            if (rank >= lower) {
+                rank -= lower;
+                coords[k] += half;
+            }
+            width[k] = half;
+        }
+    }
+}
+
+void _nd_free(_nd_s ** nd) {
+    if (NULL == *nd) return;
+    BXIFREE(*nd);
+}
+
+bxierr_p _parse_schedule(const char * str, bximap_sched_e * sched) {
+    if (0 == strcmp(str, "dynamic")) {
+        *sched = BXIMAP_SCHED_DYNAMIC;
+    } else if (0 == strcmp(str, "steal")) {
+        *sched = BXIMAP_SCHED_STEAL;
+    } else if (0 == strcmp(str, "static")) {
+        *sched = BXIMAP_SCHED_STATIC;
+    } else if (0 == strcmp(str, "guided")) {
+        *sched = BXIMAP_SCHED_GUIDED;
+    } else if (0 == strcmp(str, "auto")) {
+        *sched = BXIMAP_SCHED_AUTO;
+    } else if (0 == strcmp(str, "affinity")) {
+        *sched = BXIMAP_SCHED_AFFINITY;
+    } else {
+        return bxierr_new(BXIMAP_ARG_ERROR, strdup(str), free, NULL, NULL,
+                          "Unknown schedule '%s'", str);
+    }
+    return BXIERR_OK;
+}
+
+void * __start_function(void *arg) {
+    bximap_thrd_idx_t thread_id = (bximap_thrd_idx_t)(intptr_t)arg;
+    bxierr_p err = BXIERR_OK, err2;
+    worker_id = thread_id;
+    TRACE(MAPPER_LOGGER, "thread:"THRD_IDX_FMT" start", thread_id);
+
+    // Idle workers join the first job which may have tasks to claim
+    unsigned int spins = 0;
+    while (true) {
+        int resize_epoch = __atomic_load_n(&shared_info.resize_epoch, __ATOMIC_ACQUIRE);
+        int epoch = __atomic_load_n(&shared_info.epoch, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shared_info.stopping, __ATOMIC_ACQUIRE)) break;
+        if (thread_id >= __atomic_load_n(&shared_info.nb_threads, __ATOMIC_ACQUIRE)) {
+            // Parked out of the doorbell: jobs do not wake it up
+            syscall(SYS_futex, &shared_info.resize_epoch, FUTEX_WAIT_PRIVATE,
+                    resize_epoch, NULL, NULL, 0);
+            continue;
+        }
+        bximap_ctx_p job = NULL;
+        if (NULL != __atomic_load_n(&shared_info.jobs, __ATOMIC_ACQUIRE)) {
+            job = _join_next(thread_id, NULL, 0);
+        }
+        if (NULL == job) {
+            // Maps first, then the submitted calls
+            _pool_task_s task;
+            if (_queue_pop(&task)) {
+                _run_pool_task(&task);
+                spins = 0;
+                continue;
+            }
+            _doorbell_wait(epoch, &spins);
+            continue;
+        }
+
+        err2 = _work_on(job, thread_id);
+        BXIERR_CHAIN(err, err2);
+        spins = 0;
+    }
     TRACE(MAPPER_LOGGER, "thread:"THRD_IDX_FMT" stop", thread_id);
     return err;
 }
@@ -1111,7 +3354,7 @@ void * _start_function(void * arg) {
     if (bxierr_isko(err)) {
         BXILOG_REPORT(MAPPER_LOGGER, BXILOG_WARNING, err, "Error");
     }
-    bximap_thrd_idx_t thread_id = *(bximap_thrd_idx_t *)arg;
+    bximap_thrd_idx_t thread_id = (bximap_thrd_idx_t)(intptr_t)arg;
     TRACE(MAPPER_LOGGER, "thread:"THRD_IDX_FMT" stop", thread_id);
     return err;
 }
@@ -1136,3 +3379,169 @@ bxierr_p _fill_vector_with_cpu(bximap_cpu_idx_t first_cpu,
     }
     return BXIERR_OK;
 }
+
+/* Choose the cpu of each thread from the cpu mask and the placement policy */
+bxierr_p _map_threads(bximap_thrd_idx_t nb_threads, bximap_cpu_idx_t * threads_cpu) {
+    for (bximap_thrd_idx_t i = 0; i < nb_threads; i++) threads_cpu[i] = -1;
+    if (vcpus == NULL && placement == BXIMAP_PLACE_NONE) return BXIERR_OK;
+
+    bximap_cpu_idx_t * cpus;
+    size_t nb_cpus = 0;
+    if (vcpus != NULL) {
+        cpus = bximem_calloc(bxivector_get_size(vcpus) * sizeof(*cpus));
+        for (size_t i = 0; i < bxivector_get_size(vcpus); i++) {
+            cpus[nb_cpus++] = (bximap_cpu_idx_t)(intptr_t)bxivector_get_elem(vcpus, i);
+        }
+    } else {
+        // Saved by bximap_init(), the calling thread may be bound since
+        nb_cpus = shared_info.allowed_nb;
+        if (0 == nb_cpus) return BXIERR_OK;
+        cpus = bximem_calloc(nb_cpus * sizeof(*cpus));
+        for (size_t i = 0; i < nb_cpus; i++) cpus[i] = shared_info.allowed_cpus[i];
+    }
+    if (0 == nb_cpus) {
+        BXIFREE(cpus);
+        return BXIERR_OK;
+    }
+
+    bximap_cpu_idx_t * placed = cpus;
+    size_t nb_placed = nb_cpus;
+    if (placement != BXIMAP_PLACE_NONE) {
+        placed = bximem_calloc(nb_cpus * sizeof(*placed));
+        bxierr_p err = _place_cpus(placement, cpus, nb_cpus, placed, &nb_placed);
+        BXIFREE(cpus);
+        if (bxierr_isko(err)) {
+            BXIFREE(placed);
+            return err;
+        }
+    }
+    for (bximap_thrd_idx_t i = 0; i < nb_threads; i++) {
+        threads_cpu[i] = placed[(size_t)i % nb_placed];
+        DEBUG(MAPPER_LOGGER, "thread:"THRD_IDX_FMT" on cpu "CPU_IDX_FMT,
+              i, threads_cpu[i]);
+    }
+    BXIFREE(placed);
+    return BXIERR_OK;
+}
+
+/* The cpus the calling thread may run on, see _read_affinity() */
+bxierr_p _read_allowed(bximap_cpu_idx_t ** cpus, size_t * nb_cpus) {
+    cpu_set_t * allowed;
+    size_t size;
+    bxierr_p err = _read_affinity(&allowed, &size);
+    if (bxierr_isko(err)) return err;
+    *cpus = bximem_calloc((size_t)CPU_COUNT_S(size, allowed) * sizeof(**cpus));
+    *nb_cpus = 0;
+    // CPU_ALLOC_SIZE() rounds up, every bit of the mask is meaningful
+    for (size_t cpu = 0; cpu < size * 8; cpu++) {
+        if (CPU_ISSET_S(cpu, size, allowed)) {
+            (*cpus)[(*nb_cpus)++] = (bximap_cpu_idx_t)cpu;
+        }
+    }
+    CPU_FREE(allowed);
+    return BXIERR_OK;
+}
+
+/* Order the cpus according to the placement policy.
+ * placed must hold nb_cpus cpus, nb_placed is set to the number used. */
+bxierr_p _place_cpus(bximap_place_e place,
+                     const bximap_cpu_idx_t * cpus,
+                     size_t nb_cpus,
+                     bximap_cpu_idx_t * placed,
+                     size_t * nb_placed) {
+    _cpu_topo_s * topo = bximem_calloc(nb_cpus * sizeof(*topo));
+    for (size_t i = 0; i < nb_cpus; i++) _read_topology(cpus[i], &topo[i]);
+
+    // Rank the cores within their socket and the cpus within their core
+    qsort(topo, nb_cpus, sizeof(*topo), _compare_compact);
+    for (size_t i = 0; i < nb_cpus; i++) {
+        if (0 == i || topo[i].package != topo[i - 1].package) {
+            topo[i].core_rank = 0;
+            topo[i].smt = 0;
+        } else if (topo[i].core != topo[i - 1].core) {
+            topo[i].core_rank = topo[i - 1].core_rank + 1;
+            topo[i].smt = 0;
+        } else {
+            topo[i].core_rank = topo[i - 1].core_rank;
+            topo[i].smt = topo[i - 1].smt + 1;
+        }
+    }
+
+    *nb_placed = 0;
+    switch (place) {
+    case BXIMAP_PLACE_SCATTER:
+        qsort(topo, nb_cpus, sizeof(*topo), _compare_scatter);
+        // Fall through
+    case BXIMAP_PLACE_COMPACT:
+        for (size_t i = 0; i < nb_cpus; i++) placed[(*nb_placed)++] = topo[i].cpu;
+        break;
+    case BXIMAP_PLACE_PHYSCORE:
+        for (size_t i = 0; i < nb_cpus; i++) {
+            if (0 == topo[i].smt) placed[(*nb_placed)++] = topo[i].cpu;
+        }
+        break;
+    default:
+        BXIFREE(topo);
+        return bxierr_simple(BXIMAP_ARG_ERROR, ARG_ERROR_MSG);
+    }
+    BXIFREE(topo);
+    return BXIERR_OK;
+}
+
+/* Read the socket and the core of the cpu, each cpu is its own core
+ * when the topology is not available */
+void _read_topology(bximap_cpu_idx_t cpu, _cpu_topo_s * topo) {
+    const char * names[] = {"physical_package_id", "core_id"};
+    int * values[] = {&topo->package, &topo->core};
+
+    topo->cpu = cpu;
+    topo->package = 0;
+    topo->core = cpu;
+    for (size_t i = 0; i < ARRAYLEN(names); i++) {
+        char * path = bxistr_new("%s/cpu"CPU_IDX_FMT"/topology/%s",
+                                 sysfs_cpu, cpu, names[i]);
+        FILE * file = fopen(path, "r");
+        if (NULL != file) {
+            int value;
+            if (1 == fscanf(file, "%d", &value) && value >= 0) *values[i] = value;
+            fclose(file);
+        } else {
+            TRACE(MAPPER_LOGGER, "Can't read %s", path);
+        }
+        BXIFREE(path);
+    }
+}
+
+/* NUMA node of the cpu, from its nodeN entry in sysfs.
+ * Threads not bound and cpus without entry are on the node 0. */
+int _read_node(bximap_cpu_idx_t cpu) {
+    if (cpu < 0) return 0;
+    char * path = bxistr_new("%s/cpu"CPU_IDX_FMT, sysfs_cpu, cpu);
+    DIR * dir = opendir(path);
+    BXIFREE(path);
+    if (NULL == dir) return 0;
+    int node = 0;
+    struct dirent * entry;
+    while (NULL != (entry = readdir(dir))) {
+        if (1 == sscanf(entry->d_name, "node%d", &node)) break;
+    }
+    closedir(dir);
+    return node;
+}
+
+/* Socket, then core, then cpu */
+int _compare_compact(const void * a, const void * b) {
+    const _cpu_topo_s * ta = a, * tb = b;
+    if (ta->package != tb->package) return ta->package < tb->package ? -1 : 1;
+    if (ta->core != tb->core) return ta->core < tb->core ? -1 : 1;
+    return ta->cpu < tb->cpu ? -1 : ta->cpu > tb->cpu;
+}
+
+/* Rank within the core, then rank of the core, then socket */
+int _compare_scatter(const void * a, const void * b) {
+    const _cpu_topo_s * ta = a, * tb = b;
+    if (ta->smt != tb->smt) return ta->smt < tb->smt ? -1 : 1;
+    if (ta->core_rank != tb->core_rank) return ta->core_rank < tb->core_rank ? -1 : 1;
+    if (ta->package != tb->package) return ta->package < tb->package ? -1 : 1;
+    return ta->cpu < tb->cpu ? -1 : ta->cpu > tb->cpu;
+}
@@ -11,30 +11,72 @@
 ###############################################################################
 */
 
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "bxi/base/log.h"
 #include "bxi/base/mem.h"
+#include "bxi/util/misc.h"
 #include "bxi/util/stretch.h"
 
 // *********************************************************************************
 // ********************************** Defines **************************************
 // *********************************************************************************
+#define HEADER_MAGIC "BXISTRCH"
+#define HEADER_VERSION 1
+#define HEADER_SIZE 64
 
 
 // *********************************************************************************
 // ********************************** Types ****************************************
 // *********************************************************************************
+typedef struct {
+    char magic[8];         /**< HEADER_MAGIC without its terminating null byte*/
+    uint64_t version;
+    uint64_t element_size;
+    uint64_t chunk_size;
+    uint64_t element_nb;   /**< number of elements hit in the file*/
+    uint64_t element_max;  /**< capacity of the file*/
+} _stretch_header_s;
+
 typedef struct bxistretch_s_t {
     size_t array_size; /**< size of the reallocable array which contain the chunk*/
     size_t chunk_nb;   /**< the number of chunk allocated*/
     size_t chunk_size; /**< the size of the chunks*/
+    unsigned chunk_shift; /**< log2 of chunk_size when it is a power of 2*/
+    bool chunk_pow2;   /**< chunk_size is a power of 2*/
     size_t element_nb; /**< number of allocated elements*/
     size_t element_size;
     char ** biarray;     /**< array containing the chunk*/
+    char *** directory;  /**< two-level directory of a concurrent stretch*/
+    volatile size_t appended; /**< next index given by bxistretch_append()*/
+    bool sparse;         /**< only the chunks hit are allocated*/
+    char * base;         /**< reserved address space of a reserved stretch*/
+    size_t element_max;  /**< capacity of a reserved stretch*/
+    size_t reserved;     /**< size in bytes of the reserved address space*/
+    size_t committed;    /**< size in bytes of the committed memory*/
+    size_t commit_size;  /**< size in bytes committed at once*/
+    _stretch_header_s * header; /**< header of a file stretch*/
 } bxistretch_s;
 
 // *********************************************************************************
 // ********************************** Static Functions  ****************************
 // *********************************************************************************
+static void _set_chunk_size(bxistretch_p self, size_t chunk_size);
+static inline size_t _chunk_of(bxistretch_p self, size_t index);
+static inline size_t _position_of(bxistretch_p self, size_t index);
+static char * _publish_chunk(bxistretch_p self, size_t chunk);
+static void _atomic_max(volatile size_t * value, size_t candidate);
+static void * _hit_concurrent(bxistretch_p self, size_t index);
+static void * _hit_reserved(bxistretch_p self, size_t index);
+static bxistretch_p _file_stretch(char * addr, _stretch_header_s * header);
+static bxierr_p _check_header(const char * filename, size_t file_size,
+                              size_t element_size, _stretch_header_s * header);
 
 // *********************************************************************************
 // ********************************** Global Variables *****************************
@@ -55,8 +97,7 @@ bxistretch_p bxistretch_new(size_t chunk_size,
     self->array_size = BXISTRETCH_ARRAY_SIZE;
     self->element_nb = 0;
     self->element_size = element_size;
-    self->chunk_size = chunk_size;
-    if (self->chunk_size == 0) self->chunk_size = BXISTRETCH_DEFAULT_CHUNK_SIZE;
+    _set_chunk_size(self, chunk_size);
     self->biarray = bximem_calloc(sizeof(*self->biarray) * BXISTRETCH_ARRAY_SIZE);
     self->chunk_nb = 0;
     if (element_nb > 1) bxistretch_hit(self, element_nb - 1);
@@ -64,10 +105,183 @@ bxistretch_p bxistretch_new(size_t chunk_size,
     return self;
 }
 
+bxistretch_p bxistretch_new_concurrent(size_t chunk_size,
+                                       size_t element_size,
+                                       size_t element_nb) {
+
+    bxistretch_p self = bximem_calloc(sizeof(*self));
+    self->array_size = 0;
+    self->element_nb = 0;
+    self->element_size = element_size;
+    _set_chunk_size(self, chunk_size);
+    self->biarray = NULL;
+    self->directory = bximem_calloc(sizeof(*self->directory)
+                                    * BXISTRETCH_DIRECTORY_SIZE);
+    self->chunk_nb = 0;
+    self->appended = 0;
+    if (element_nb > 1) bxistretch_hit(self, element_nb - 1);
+
+    return self;
+}
+
+bxistretch_p bxistretch_new_reserved(size_t chunk_size,
+                                     size_t element_size,
+                                     size_t element_nb,
+                                     size_t element_max) {
+
+    if (chunk_size == 0) chunk_size = BXISTRETCH_DEFAULT_CHUNK_SIZE;
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    if (0 != element_size && chunk_size > (SIZE_MAX - page_size) / element_size) {
+        ERROR(STRETCH_C_LOGGER,
+              "Chunks of %zu elements of %zu bytes are too large", chunk_size, element_size);
+        return NULL;
+    }
+    size_t commit_size = chunk_size * element_size;
+    commit_size = (commit_size + page_size - 1) / page_size * page_size;
+    if (0 == commit_size) commit_size = page_size;
+    if (0 != element_size && element_max > (SIZE_MAX - commit_size) / element_size) {
+        ERROR(STRETCH_C_LOGGER,
+              "Can't reserve %zu elements of %zu bytes", element_max, element_size);
+        return NULL;
+    }
+    size_t reserved = element_max * element_size;
+    reserved = (reserved + commit_size - 1) / commit_size * commit_size;
+    if (0 == reserved) reserved = commit_size;
+
+    void * base = mmap(NULL, reserved, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (MAP_FAILED == base) {
+        bxierr_p err = bxierr_errno("Can't reserve %zu bytes", reserved);
+        BXILOG_REPORT(STRETCH_C_LOGGER, BXILOG_ERROR, err,
+                      "Can't create the reserved stretch");
+        return NULL;
+    }
+
+    bxistretch_p self = bximem_calloc(sizeof(*self));
+    self->element_nb = 0;
+    self->element_size = element_size;
+    _set_chunk_size(self, chunk_size);
+    self->base = base;
+    self->element_max = element_max;
+    self->reserved = reserved;
+    self->committed = 0;
+    self->commit_size = commit_size;
+    if (element_nb > 1) bxistretch_hit(self, element_nb - 1);
+
+    return self;
+}
+
+bxierr_p bxistretch_new_file(const char * filename,
+                             size_t chunk_size,
+                             size_t element_size,
+                             size_t element_max,
+                             bxistretch_p * result) {
+    bxiassert(NULL != filename);
+    bxiassert(NULL != result);
+
+    if (chunk_size == 0) chunk_size = BXISTRETCH_DEFAULT_CHUNK_SIZE;
+    if (0 == element_size) return bxierr_gen("Can't store elements of 0 bytes");
+    if (element_max > SIZE_MAX - chunk_size) {
+        return bxierr_gen("Can't store %zu elements in a file", element_max);
+    }
+    element_max = (element_max + chunk_size - 1) / chunk_size * chunk_size;
+    if (0 == element_max) element_max = chunk_size;
+    if (element_max > (SIZE_MAX - HEADER_SIZE) / element_size) {
+        return bxierr_gen("Can't store %zu elements of %zu bytes in a file",
+                          element_max, element_size);
+    }
+
+    char * addr = NULL;
+    bxierr_p err = bximisc_file_map(filename, HEADER_SIZE + element_max * element_size,
+                                    false, true, PROT_READ | PROT_WRITE, &addr);
+    if (bxierr_isko(err)) return err;
+
+    _stretch_header_s * header = (_stretch_header_s *)(void *)addr;
+    memcpy(header->magic, HEADER_MAGIC, sizeof(header->magic));
+    header->version = HEADER_VERSION;
+    header->element_size = element_size;
+    header->chunk_size = chunk_size;
+    header->element_nb = 0;
+    header->element_max = element_max;
+
+    *result = _file_stretch(addr, header);
+    return BXIERR_OK;
+}
+
+bxierr_p bxistretch_open_file(const char * filename,
+                              size_t element_size,
+                              bxistretch_p * result) {
+    bxiassert(NULL != filename);
+    bxiassert(NULL != result);
+
+    struct stat sb;
+    errno = 0;
+    if (-1 == stat(filename, &sb)) return bxierr_errno("Can't stat %s", filename);
+    size_t file_size = (size_t)sb.st_size;
+    if (file_size < HEADER_SIZE) {
+        return bxierr_new(BXISTRETCH_HEADER_ERROR, NULL, NULL, NULL, NULL,
+                          "File %s is too small for a stretch header", filename);
+    }
+
+    char * addr = NULL;
+    bxierr_p err = bximisc_file_map(filename, file_size, true, true,
+                                    PROT_READ | PROT_WRITE, &addr);
+    if (bxierr_isko(err)) return err;
+
+    _stretch_header_s * header = (_stretch_header_s *)(void *)addr;
+    err = _check_header(filename, file_size, element_size, header);
+    if (bxierr_isko(err)) {
+        if (-1 == munmap(addr, file_size)) {
+            bxierr_p err2 = bxierr_errno("An error occured while unmapping %s.",
+                                         filename);
+            BXIERR_CHAIN(err, err2);
+        }
+        return err;
+    }
+
+    *result = _file_stretch(addr, header);
+    return BXIERR_OK;
+}
+
+bxistretch_p bxistretch_new_sparse(size_t chunk_size,
+                                   size_t element_size) {
+
+    bxistretch_p self = bxistretch_new_concurrent(chunk_size, element_size, 0);
+    self->sparse = true;
+
+    return self;
+}
+
 void bxistretch_destroy(bxistretch_p *self_p) {
     if (NULL == self_p) return;
     bxistretch_p self = *self_p;
-    for (size_t i = 0; i < self->chunk_nb; i++) {
+    if (NULL != self->header) {
+        int rc = munmap(self->header, HEADER_SIZE + self->reserved);
+        if (0 != rc) {
+            bxierr_p err = bxierr_errno("Can't unmap %zu bytes",
+                                        HEADER_SIZE + self->reserved);
+            BXILOG_REPORT(STRETCH_C_LOGGER, BXILOG_WARNING, err,
+                          "Can't release the file stretch");
+        }
+    } else if (NULL != self->base) {
+        int rc = munmap(self->base, self->reserved);
+        if (0 != rc) {
+            bxierr_p err = bxierr_errno("Can't unmap %zu bytes", self->reserved);
+            BXILOG_REPORT(STRETCH_C_LOGGER, BXILOG_WARNING, err,
+                          "Can't release the reserved stretch");
+        }
+    }
+    if (NULL != self->directory) {
+        for (size_t i = 0; i < BXISTRETCH_DIRECTORY_SIZE; i++) {
+            if (NULL == self->directory[i]) continue;
+            for (size_t j = 0; j < BXISTRETCH_DIRECTORY_SIZE; j++) {
+                BXIFREE(self->directory[i][j]);
+            }
+            BXIFREE(self->directory[i]);
+        }
+        BXIFREE(self->directory);
+    }
+    for (size_t i = 0; i < self->chunk_nb && NULL != self->biarray; i++) {
         BXIFREE(self->biarray[i]);
     }
     BXIFREE(self->biarray);
@@ -75,24 +289,48 @@ void bxistretch_destroy(bxistretch_p *self_p) {
 }
 
 void * bxistretch_get(bxistretch_p self, size_t index) {
-    size_t chunk_requested = ((index + self->chunk_size) / self->chunk_size) - 1;
-    size_t position = index - chunk_requested * self->chunk_size;
+    if (NULL != self->base) {
+        if (self->element_nb <= index) return NULL;
+        return self->base + index * self->element_size;
+    }
+    if (NULL != self->directory) {
+        // The release store of element_nb in _hit_concurrent() follows the
+        // publication of every chunk below it
+        if (__atomic_load_n(&self->element_nb, __ATOMIC_ACQUIRE) <= index) return NULL;
+        size_t chunk = _chunk_of(self, index);
+        size_t position = _position_of(self, index);
+        // The chunks of a sparse stretch may not be allocated
+        char ** leaf = __atomic_load_n(&self->directory[chunk / BXISTRETCH_DIRECTORY_SIZE],
+                                       __ATOMIC_ACQUIRE);
+        if (NULL == leaf) return NULL;
+        char * data = __atomic_load_n(&leaf[chunk % BXISTRETCH_DIRECTORY_SIZE],
+                                      __ATOMIC_ACQUIRE);
+        if (NULL == data) return NULL;
+        return data + position * self->element_size;
+    }
+    size_t chunk_requested = _chunk_of(self, index);
+    size_t position = _position_of(self, index);
     if (self->element_nb <= index) return NULL;
     return (void*)(uintptr_t)(self->biarray[chunk_requested] + position * self->element_size);
 }
 
 void * bxistretch_hit(bxistretch_p self, size_t index) {
 
+    if (NULL != self->base) return _hit_reserved(self, index);
+    if (NULL != self->directory) return _hit_concurrent(self, index);
+
     if (self->element_nb <= index) {
 
         size_t previously_chunk_nb = self->chunk_nb;
-        size_t chunk_requested = (index + self->chunk_size) / self->chunk_size;
+        size_t chunk_requested = _chunk_of(self, index) + 1;
         self->chunk_nb = chunk_requested;
 
         if (self->array_size < self->chunk_nb) {
             size_t old_size = self->array_size;
             size_t new_size = (self->chunk_nb + old_size)/old_size * old_size;
-            self->biarray = bximem_realloc(self->biarray, old_size, new_size);
+            self->biarray = bximem_realloc(self->biarray,
+                                           old_size * sizeof(*self->biarray),
+                                           new_size * sizeof(*self->biarray));
             self->array_size = new_size;
         }
 
@@ -105,8 +343,294 @@ void * bxistretch_hit(bxistretch_p self, size_t index) {
     return bxistretch_get(self, index);
 }
 
+void * bxistretch_append(bxistretch_p self, size_t * index) {
+    bxiassert(NULL != self);
+    bxiassert(NULL != index);
+
+    if (NULL == self->directory) {
+        *index = self->element_nb;
+    } else {
+        *index = __atomic_fetch_add(&self->appended, 1, __ATOMIC_RELAXED);
+    }
+    return bxistretch_hit(self, *index);
+}
+
+void * bxistretch_data(bxistretch_p self) {
+    bxiassert(NULL != self);
+
+    return self->base;
+}
+
+void * bxistretch_next_chunk(bxistretch_p self, size_t * index, size_t * count) {
+    bxiassert(NULL != self);
+    bxiassert(NULL != index);
+    bxiassert(NULL != count);
+
+    size_t element_nb = __atomic_load_n(&self->element_nb, __ATOMIC_ACQUIRE);
+    if (element_nb <= *index) return NULL;
+    size_t chunk = _chunk_of(self, *index);
+    char * data = NULL;
+    while (NULL == data && chunk * self->chunk_size < element_nb) {
+        if (NULL != self->base) {
+            data = self->base + chunk * self->chunk_size * self->element_size;
+        } else if (NULL != self->directory) {
+            char ** leaf = __atomic_load_n(&self->directory[chunk / BXISTRETCH_DIRECTORY_SIZE],
+                                           __ATOMIC_ACQUIRE);
+            if (NULL == leaf) {
+                chunk = (chunk / BXISTRETCH_DIRECTORY_SIZE + 1) * BXISTRETCH_DIRECTORY_SIZE;
+                continue;
+            }
+            data = __atomic_load_n(&leaf[chunk % BXISTRETCH_DIRECTORY_SIZE],
+                                   __ATOMIC_ACQUIRE);
+            if (NULL == data) chunk++;
+        } else {
+            data = self->biarray[chunk];
+        }
+    }
+    if (NULL == data) return NULL;
+
+    size_t first = chunk * self->chunk_size;
+    size_t last = first + self->chunk_size;
+    if (first < *index) first = *index;
+    if (last > element_nb) last = element_nb;
+    data += (first - chunk * self->chunk_size) * self->element_size;
+    *index = first;
+    *count = last - first;
+
+    return data;
+}
+
+void * bxistretch_next_span(bxistretch_p self, size_t * index, size_t * count) {
+    char * data = bxistretch_next_chunk(self, index, count);
+    if (NULL == data) return NULL;
+
+    size_t element_nb = __atomic_load_n(&self->element_nb, __ATOMIC_ACQUIRE);
+    if (NULL != self->base) {
+        *count = element_nb - *index;
+        return data;
+    }
+    while (*index + *count < element_nb) {
+        size_t next = *index + *count;
+        size_t next_count;
+        char * next_data = bxistretch_next_chunk(self, &next, &next_count);
+        if (next != *index + *count
+            || next_data != data + *count * self->element_size) break;
+        *count += next_count;
+    }
+
+    return data;
+}
+
+size_t bxistretch_write(bxistretch_p self, size_t index, size_t n, const void * buf) {
+    bxiassert(NULL != self);
+    bxiassert(NULL != buf || 0 == n);
+
+    const char * src = buf;
+    size_t done = 0;
+    while (done < n) {
+        size_t first = index + done;
+        // The elements of a reserved stretch are all contiguous,
+        // the ones beyond its capacity are left out
+        size_t nb = n - done;
+        if (NULL != self->base) {
+            if (self->element_max <= first) break;
+            if (nb > self->element_max - first) nb = self->element_max - first;
+        } else if (nb > self->chunk_size - _position_of(self, first)) {
+            nb = self->chunk_size - _position_of(self, first);
+        }
+        char * dst = bxistretch_hit(self, first + nb - 1);
+        if (NULL == dst) break;
+        dst -= (nb - 1) * self->element_size;
+        memcpy(dst, src + done * self->element_size, nb * self->element_size);
+        done += nb;
+    }
+
+    return done;
+}
+
+size_t bxistretch_read(bxistretch_p self, size_t index, size_t n, void * buf) {
+    bxiassert(NULL != self);
+    bxiassert(NULL != buf || 0 == n);
+
+    size_t element_nb = __atomic_load_n(&self->element_nb, __ATOMIC_ACQUIRE);
+    if (element_nb <= index) return 0;
+    if (n > element_nb - index) n = element_nb - index;
+
+    char * dst = buf;
+    size_t done = 0;
+    while (done < n) {
+        size_t first = index + done;
+        size_t nb = n - done;
+        if (NULL == self->base && nb > self->chunk_size - _position_of(self, first)) {
+            nb = self->chunk_size - _position_of(self, first);
+        }
+        char * src = bxistretch_get(self, first);
+        if (NULL == src) {
+            memset(dst + done * self->element_size, 0, nb * self->element_size);
+        } else {
+            memcpy(dst + done * self->element_size, src, nb * self->element_size);
+        }
+        done += nb;
+    }
+
+    return n;
+}
+
 
 // *********************************************************************************
 // ********************************** Static Functions Implementation  *************
 // *********************************************************************************
 
+void * _hit_concurrent(bxistretch_p self, size_t index) {
+    size_t chunk = _chunk_of(self, index);
+    if (chunk >= BXISTRETCH_DIRECTORY_SIZE * BXISTRETCH_DIRECTORY_SIZE) {
+        WARNING(STRETCH_C_LOGGER,
+                "Index %zu is beyond the capacity of the stretch directory", index);
+        return NULL;
+    }
+
+    if (self->sparse) {
+        _publish_chunk(self, chunk);
+    } else {
+        // Every chunk below element_nb must be reachable before element_nb
+        // grows, so the missing chunks are published in order
+        size_t published = __atomic_load_n(&self->chunk_nb, __ATOMIC_ACQUIRE);
+        for (size_t i = published; i <= chunk; i++) _publish_chunk(self, i);
+        _atomic_max(&self->chunk_nb, chunk + 1);
+    }
+    _atomic_max(&self->appended, index + 1);
+    _atomic_max(&self->element_nb, index + 1);
+
+    return bxistretch_get(self, index);
+}
+
+void * _hit_reserved(bxistretch_p self, size_t index) {
+    if (self->element_nb <= index) {
+        // The reserved size is rounded up, the capacity is element_max
+        if (self->element_max <= index) {
+            WARNING(STRETCH_C_LOGGER,
+                    "Index %zu is beyond the capacity of the reserved stretch", index);
+            return NULL;
+        }
+        size_t needed = (index + 1) * self->element_size;
+        if (self->committed < needed) {
+            size_t committed = (needed + self->commit_size - 1)
+                               / self->commit_size * self->commit_size;
+            int rc = mprotect(self->base + self->committed,
+                              committed - self->committed,
+                              PROT_READ | PROT_WRITE);
+            if (0 != rc) {
+                bxierr_p err = bxierr_errno("Can't commit %zu bytes",
+                                            committed - self->committed);
+                BXILOG_REPORT(STRETCH_C_LOGGER, BXILOG_WARNING, err,
+                              "Can't extend the reserved stretch");
+                return NULL;
+            }
+            self->committed = committed;
+            self->chunk_nb = committed / self->commit_size;
+        }
+        self->element_nb = index + 1;
+        if (NULL != self->header) self->header->element_nb = self->element_nb;
+    }
+
+    return bxistretch_get(self, index);
+}
+
+bxistretch_p _file_stretch(char * addr, _stretch_header_s * header) {
+    // A file stretch is a reserved stretch whose memory is all committed
+    bxistretch_p self = bximem_calloc(sizeof(*self));
+    self->header = header;
+    self->element_nb = header->element_nb;
+    self->element_size = header->element_size;
+    _set_chunk_size(self, header->chunk_size);
+    self->base = addr + HEADER_SIZE;
+    self->element_max = header->element_max;
+    self->reserved = header->element_max * header->element_size;
+    self->committed = self->reserved;
+    self->commit_size = self->chunk_size * self->element_size;
+    self->chunk_nb = header->element_max / header->chunk_size;
+
+    return self;
+}
+
+bxierr_p _check_header(const char * filename, size_t file_size,
+                       size_t element_size, _stretch_header_s * header) {
+    if (0 != memcmp(header->magic, HEADER_MAGIC, sizeof(header->magic))
+        || HEADER_VERSION != header->version) {
+        return bxierr_new(BXISTRETCH_HEADER_ERROR, NULL, NULL, NULL, NULL,
+                          "File %s isn't a stretch file", filename);
+    }
+    if (element_size != header->element_size) {
+        return bxierr_new(BXISTRETCH_HEADER_ERROR, NULL, NULL, NULL, NULL,
+                          "File %s stores elements of %" PRIu64 " bytes instead of %zu",
+                          filename, header->element_size, element_size);
+    }
+    // Divided rather than multiplied, a crafted size can't wrap around
+    if (0 == header->element_size
+        || 0 == header->chunk_size
+        || 0 != header->element_max % header->chunk_size
+        || header->element_max < header->element_nb
+        || header->element_max > (file_size - HEADER_SIZE) / header->element_size
+        || file_size - HEADER_SIZE != header->element_max * header->element_size) {
+        return bxierr_new(BXISTRETCH_HEADER_ERROR, NULL, NULL, NULL, NULL,
+                          "File %s has an inconsistent stretch header", filename);
+    }
+
+    return BXIERR_OK;
+}
+
+void _set_chunk_size(bxistretch_p self, size_t chunk_size) {
+    if (chunk_size == 0) chunk_size = BXISTRETCH_DEFAULT_CHUNK_SIZE;
+    self->chunk_size = chunk_size;
+    // Shifts and masks replace the divisions for a power of 2
+    self->chunk_pow2 = 0 == (chunk_size & (chunk_size - 1));
+    self->chunk_shift = 0;
+    while (self->chunk_pow2 && ((size_t)1 << self->chunk_shift) < chunk_size) {
+        self->chunk_shift++;
+    }
+}
+
+size_t _chunk_of(bxistretch_p self, size_t index) {
+    if (self->chunk_pow2) return index >> self->chunk_shift;
+    return index / self->chunk_size;
+}
+
+size_t _position_of(bxistretch_p self, size_t index) {
+    if (self->chunk_pow2) return index & (self->chunk_size - 1);
+    return index % self->chunk_size;
+}
+
+char * _publish_chunk(bxistretch_p self, size_t chunk) {
+    char ** volatile * leaf_p = &self->directory[chunk / BXISTRETCH_DIRECTORY_SIZE];
+    char ** leaf = __atomic_load_n(leaf_p, __ATOMIC_ACQUIRE);
+    if (NULL == leaf) {
+        char ** new_leaf = bximem_calloc(sizeof(*new_leaf) * BXISTRETCH_DIRECTORY_SIZE);
+        if (__atomic_compare_exchange_n(leaf_p, &leaf, new_leaf, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            leaf = new_leaf;
+        } else {
+            BXIFREE(new_leaf);
+        }
+    }
+
+    char * volatile * data_p = &leaf[chunk % BXISTRETCH_DIRECTORY_SIZE];
+    char * data = __atomic_load_n(data_p, __ATOMIC_ACQUIRE);
+    if (NULL == data) {
+        char * new_data = bximem_calloc(self->element_size * self->chunk_size);
+        if (__atomic_compare_exchange_n(data_p, &data, new_data, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            data = new_data;
+        } else {
+            BXIFREE(new_data);
+        }
+    }
+    return data;
+}
+
+void _atomic_max(volatile size_t * value, size_t candidate) {
+    size_t current = __atomic_load_n(value, __ATOMIC_RELAXED);
+    while (current < candidate
+           && !__atomic_compare_exchange_n(value, &current, candidate, false,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+}
@@ -15,6 +15,7 @@
 #include "bxi/base/log.h"
 
 #include "bxi/util/misc.h"
+#include "bxi/util/map.h"
 #include "bxi/util/vector.h"
 
 // *********************************************************************************
@@ -36,10 +37,26 @@ typedef struct bxivector_s_t {
     void ** array;
 } bxivector_s;
 
+/*
+ * Data of bxivector_apply_parallel() given to _apply_func()
+ */
+typedef struct {
+    bxivector_p vector;
+    bxierr_p (*func)(void*, void*);
+    void * data;
+} _apply_s;
+
 
 // *********************************************************************************
 // **************************** Static function declaration ************************
 // *********************************************************************************
+static bxierr_p _apply_func(bximap_task_idx_t start,
+                            bximap_task_idx_t end,
+                            bximap_thrd_idx_t thread,
+                            void * acc,
+                            void * usr_data);
+static void _apply_identity(void * acc, void * usr_data);
+static void _apply_combine(void * acc, const void * other, void * usr_data);
 
 // *********************************************************************************
 // ********************************** Global Variables *****************************
@@ -101,6 +118,45 @@ bxierr_p bxivector_apply(bxivector_p vector,
     }
 }
 
+/*
+ * Apply the provided function on the elements in parallel,
+ * each thread of the pool appends the errors to its own list:
+ * the lists are the accumulators of a bximap_reduce()
+ */
+bxierr_p bxivector_apply_parallel(bxivector_p vector,
+                                  bxierr_p (*func)(void*,void*),
+                                  void* const data_cb) {
+
+    BXIASSERT(BXIVECTOR_LOGGER, NULL != vector);
+    BXIASSERT(BXIVECTOR_LOGGER, NULL != func);
+    size_t n = bxivector_get_size(vector);
+    bximap_thrd_idx_t nb_threads;
+    // Without pool, the elements are processed by the calling thread
+    bxierr_p err = bximap_get_nb_threads(&nb_threads);
+    if (bxierr_isko(err)) {
+        bxierr_destroy(&err);
+        return bxivector_apply(vector, func, data_cb);
+    }
+    if (0 == n) return BXIERR_OK;
+
+    _apply_s apply = {.vector = vector, .func = func, .data = data_cb};
+    bxierr_list_p errors = NULL;
+    err = bximap_reduce(0, (bximap_task_idx_t)n, 0, _apply_func, sizeof(errors),
+                        _apply_identity, _apply_combine, &apply, &errors);
+
+    bxierr_list_p list = NULL != errors ? errors : bxierr_list_new();
+    if (bxierr_isko(err)) bxierr_list_append(list, err);
+
+    if (0 == list->errors_nb) {
+        bxierr_list_free(list);
+        return BXIERR_OK;
+    } else {
+        return bxierr_from_list(BXIVECTOR_APPLY_ERR, list,
+                                "Errors found in apply(): %zu/%zu",
+                                list->errors_nb, n);
+    }
+}
+
 /*
  * Free the vector and apply the provided function on all remaining elements
  */
@@ -182,3 +238,56 @@ void ** bxivector_get_array(bxivector_p vector){
     BXIASSERT(BXIVECTOR_LOGGER, NULL != vector);
     return vector->array;
 }
+
+// *********************************************************************************
+// ********************************** Static Functions  ****************************
+// *********************************************************************************
+
+/*
+ * Apply the function on the elements [start, end[ of the vector
+ */
+bxierr_p _apply_func(bximap_task_idx_t start,
+                     bximap_task_idx_t end,
+                     bximap_thrd_idx_t thread,
+                     void * acc,
+                     void * usr_data) {
+    UNUSED(thread);
+    _apply_s * apply = usr_data;
+    bxierr_list_p * list = acc;
+    for (bximap_task_idx_t i = start; i < end; i++) {
+        bxierr_p err = apply->func(apply->vector->array[i], apply->data);
+        if (bxierr_isko(err)) {
+            if (NULL == *list) *list = bxierr_list_new();
+            bxierr_list_append(*list, err);
+        }
+    }
+    return BXIERR_OK;
+}
+
+/*
+ * The errors of a thread, created on the first one
+ */
+void _apply_identity(void * acc, void * usr_data) {
+    UNUSED(usr_data);
+    *(bxierr_list_p *)acc = NULL;
+}
+
+/*
+ * Move the errors of another thread to the list
+ */
+void _apply_combine(void * acc, const void * other, void * usr_data) {
+    UNUSED(usr_data);
+    bxierr_list_p * list = acc;
+    bxierr_list_p other_list = *(bxierr_list_p const *)other;
+    if (NULL == other_list) return;
+    if (NULL == *list) {
+        *list = other_list;
+        return;
+    }
+    for (size_t e = 0; e < other_list->errors_nb; e++) {
+        bxierr_list_append(*list, other_list->errors[e]);
+    }
+    // The errors now belong to the merged list
+    other_list->errors_nb = 0;
+    bxierr_list_free(other_list);
+}
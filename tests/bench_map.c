@@ -0,0 +1,296 @@
+/* -*- coding: utf-8 -*-
+###############################################################################
+# Created on: Oct 17, 2026
+# Contributors:
+###############################################################################
+# Copyright (C) 2018 Bull S.A.S.  -  All rights reserved
+# Bull, Rue Jean Jaures, B.P. 68, 78340 Les Clayes-sous-Bois
+# This is not Free or Open Source software.
+# Please contact Bull S. A. S. for details about its license.
+###############################################################################
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysinfo.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bxi/base/err.h"
+#include "bxi/base/log.h"
+#include "bxi/base/time.h"
+#include "bxi/util/map.h"
+
+// *********************************************************************************
+// ********************************** Defines **************************************
+// *********************************************************************************
+
+#define BENCH_ITERATIONS 200000
+#define BENCH_REPEAT 5
+#define BENCH_ROUNDTRIPS 20000
+#define BENCH_SPIN_DEFAULT 4096     // Default of bximap_set_spin_budget()
+#define BENCH_FORKS 200
+#define BENCH_FORK_THREADS 64
+
+// *********************************************************************************
+// ********************************** Types ****************************************
+// *********************************************************************************
+
+typedef struct {
+    const char * name;
+    int (*main)(int argc, char ** argv);
+} bench_s;
+
+// *********************************************************************************
+// ********************************** Static Functions  ****************************
+// *********************************************************************************
+
+static int _bench_schedule(int argc, char ** argv);
+static int _bench_latency(int argc, char ** argv);
+static int _bench_fork(int argc, char ** argv);
+
+// *********************************************************************************
+// ********************************** Global Variables *****************************
+// *********************************************************************************
+
+SET_LOGGER(BENCH_LOGGER, "bench.bxiutil.map");
+
+static const bench_s BENCHES[] = {
+    {"schedule", _bench_schedule},
+    {"latency", _bench_latency},
+    {"fork", _bench_fork},
+};
+
+static volatile unsigned long bench_sink = 0;
+
+// *********************************************************************************
+// ********************************** MAIN *****************************************
+// *********************************************************************************
+
+/*
+ * Usage: bench_map [bench [threads [iterations]]]
+ * Without argument, every benchmark is run.
+ * For the latency benchmark, threads is the largest number of threads
+ * and iterations the number of executed maps.
+ * For the fork benchmark, threads is the size of the pool (64 by default)
+ * and iterations the number of forks.
+ */
+int main(int argc, char ** argv) {
+    int rc = EXIT_SUCCESS;
+    for (size_t i = 0; i < ARRAYLEN(BENCHES); i++) {
+        if (argc > 1 && 0 != strcmp(argv[1], BENCHES[i].name)) continue;
+        int brc = BENCHES[i].main(argc > 1 ? argc - 1 : 0, argv + 1);
+        if (EXIT_SUCCESS != brc) rc = brc;
+    }
+    return rc;
+}
+
+// *********************************************************************************
+// ********************************** Static Functions Implementation  *************
+// *********************************************************************************
+
+/*
+ * Irregular per-iteration cost: one iteration out of 64 is 200 times
+ * more expensive than the others, and the cost grows along the range.
+ */
+static bxierr_p _irregular_func(bximap_task_idx_t start,
+                                bximap_task_idx_t end,
+                                bximap_thrd_idx_t thread,
+                                void * usr_data) {
+    UNUSED(thread);
+    bximap_task_idx_t nb = *(bximap_task_idx_t *)usr_data;
+    unsigned long acc = 0;
+    for (bximap_task_idx_t i = start; i < end; i++) {
+        unsigned long cost = 20 + (unsigned long)(20 * i / nb);
+        if (0 == i % 64) cost *= 200;
+        for (unsigned long j = 0; j < cost; j++) acc += j ^ (unsigned long)i;
+    }
+    __sync_fetch_and_add(&bench_sink, acc);
+    return BXIERR_OK;
+}
+
+static bxierr_p _time_execute(bximap_ctx_p ctx, double * best) {
+    *best = -1;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        struct timespec start;
+        double duration;
+        bxierr_p err = bxitime_get(CLOCK_MONOTONIC, &start);
+        if (bxierr_isko(err)) return err;
+        err = bximap_execute(ctx);
+        if (bxierr_isko(err)) return err;
+        err = bxitime_duration(CLOCK_MONOTONIC, start, &duration);
+        if (bxierr_isko(err)) return err;
+        if (*best < 0 || duration < *best) *best = duration;
+    }
+    return BXIERR_OK;
+}
+
+/*
+ * Compare the throughput of the schedules on a loop with irregular
+ * per-iteration costs, for several granularities.
+ */
+static int _bench_schedule(int argc, char ** argv) {
+    bximap_thrd_idx_t threads = argc > 1 ? atoi(argv[1]) : 0;
+    bximap_task_idx_t nb = argc > 2 ? atoll(argv[2]) : BENCH_ITERATIONS;
+
+    bxierr_p err = bximap_init(&threads);
+    if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+
+    const bximap_task_idx_t granularities[] = {1, 8, 64, 0};
+    const struct {
+        const char * name;
+        bximap_sched_e sched;
+    } scheds[] = {{"dynamic", BXIMAP_SCHED_DYNAMIC}, {"steal", BXIMAP_SCHED_STEAL},
+                  {"static", BXIMAP_SCHED_STATIC}, {"guided", BXIMAP_SCHED_GUIDED},
+                  {"auto", BXIMAP_SCHED_AUTO}, {"affinity", BXIMAP_SCHED_AFFINITY}};
+
+    printf("# schedule: threads="THRD_IDX_FMT" iterations="TASK_IDX_FMT"\n",
+           threads, nb);
+    printf("%-10s %12s %12s %16s\n",
+           "schedule", "granularity", "seconds", "iterations/s");
+    for (size_t g = 0; g < ARRAYLEN(granularities); g++) {
+        for (size_t s = 0; s < ARRAYLEN(scheds); s++) {
+            bximap_ctx_p ctx = NULL;
+            err = bximap_new(0, nb, granularities[g], _irregular_func, &nb, &ctx);
+            if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+            err = bximap_set_schedule(ctx, scheds[s].sched);
+            if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+            double best;
+            err = _time_execute(ctx, &best);
+            if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+            printf("%-10s %12lld %12.6f %16.0f\n",
+                   scheds[s].name, granularities[g], best, (double)nb / best);
+            bximap_destroy(&ctx);
+        }
+    }
+
+    err = bximap_finalize();
+    if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+    return EXIT_SUCCESS;
+}
+
+static bxierr_p _empty_func(bximap_task_idx_t start,
+                            bximap_task_idx_t end,
+                            bximap_thrd_idx_t thread,
+                            void * usr_data) {
+    UNUSED(start);
+    UNUSED(end);
+    UNUSED(thread);
+    UNUSED(usr_data);
+    return BXIERR_OK;
+}
+
+/*
+ * Round-trip latency of an empty map with one task per thread,
+ * for 1, 2, 4... threads, with idle threads sleeping at once or polling.
+ */
+static int _bench_latency(int argc, char ** argv) {
+    bximap_thrd_idx_t max_threads = argc > 1 ? atoi(argv[1]) : 0;
+    long roundtrips = argc > 2 ? atol(argv[2]) : BENCH_ROUNDTRIPS;
+    if (max_threads <= 0) max_threads = (bximap_thrd_idx_t)get_nprocs();
+
+    const struct {
+        const char * name;
+        int spins;
+    } waits[] = {{"park", 0}, {"spin", BENCH_SPIN_DEFAULT}};
+
+    printf("# latency: roundtrips=%ld\n", roundtrips);
+    printf("%-6s %8s %14s\n", "wait", "threads", "usec/execute");
+    for (bximap_thrd_idx_t threads = 1; threads <= max_threads; threads *= 2) {
+        bxierr_p err = bximap_init(&threads);
+        if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+        bximap_ctx_p ctx = NULL;
+        err = bximap_new(0, threads, 1, _empty_func, NULL, &ctx);
+        if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+        for (size_t w = 0; w < ARRAYLEN(waits); w++) {
+            err = bximap_set_spin_budget(waits[w].spins);
+            if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+            struct timespec start;
+            double duration;
+            err = bxitime_get(CLOCK_MONOTONIC, &start);
+            if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+            for (long r = 0; r < roundtrips; r++) {
+                err = bximap_execute(ctx);
+                if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+            }
+            err = bxitime_duration(CLOCK_MONOTONIC, start, &duration);
+            if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+            printf("%-6s %8d %14.3f\n",
+                   waits[w].name, threads, 1e6 * duration / (double)roundtrips);
+        }
+        bximap_destroy(&ctx);
+        err = bximap_finalize();
+        if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Fork and wait for a child which exits at once or runs one map, with the
+ * pool kept across the fork, or finalized before and initialized after it
+ * as the fork handlers used to do.
+ */
+static int _bench_fork(int argc, char ** argv) {
+    bximap_thrd_idx_t threads = argc > 1 ? atoi(argv[1]) : BENCH_FORK_THREADS;
+    long forks = argc > 2 ? atol(argv[2]) : BENCH_FORKS;
+    if (threads <= 0) threads = BENCH_FORK_THREADS;
+
+    const struct {
+        const char * name;
+        bool restart;       // Finalize before the fork, initialize after
+        bool child_map;     // The child executes one map
+    } modes[] = {{"keep", false, false}, {"keep+map", false, true},
+                 {"restart", true, false}, {"restart+map", true, true}};
+
+    printf("# fork: threads="THRD_IDX_FMT" forks=%ld\n", threads, forks);
+    printf("%-12s %14s\n", "pool", "usec/fork");
+    bxierr_p err = bximap_init(&threads);
+    if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+    bximap_ctx_p ctx = NULL;
+    err = bximap_new(0, threads, 1, _empty_func, NULL, &ctx);
+    if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+    for (size_t m = 0; m < ARRAYLEN(modes); m++) {
+        struct timespec start;
+        double duration;
+        err = bxitime_get(CLOCK_MONOTONIC, &start);
+        if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+        for (long f = 0; f < forks; f++) {
+            if (modes[m].restart) {
+                err = bximap_finalize();
+                if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+            }
+            pid_t pid = fork();
+            if (-1 == pid) {
+                BXIEXIT(EXIT_FAILURE, bxierr_errno("Can't fork()"),
+                        BENCH_LOGGER, BXILOG_CRITICAL);
+            }
+            if (0 == pid) {
+                if (modes[m].child_map) {
+                    if (modes[m].restart) err = bximap_init(&threads);
+                    if (bxierr_isok(err)) err = bximap_execute(ctx);
+                    if (bxierr_isok(err)) err = bximap_finalize();
+                    _exit(bxierr_isok(err) ? EXIT_SUCCESS : EXIT_FAILURE);
+                }
+                _exit(EXIT_SUCCESS);
+            }
+            if (modes[m].restart) {
+                err = bximap_init(&threads);
+                if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+            }
+            int status;
+            if (pid != waitpid(pid, &status, 0)
+                || !WIFEXITED(status) || EXIT_SUCCESS != WEXITSTATUS(status)) {
+                BXIEXIT(EXIT_FAILURE, bxierr_gen("Child %d failed", pid),
+                        BENCH_LOGGER, BXILOG_CRITICAL);
+            }
+        }
+        err = bxitime_duration(CLOCK_MONOTONIC, start, &duration);
+        if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+        printf("%-12s %14.1f\n", modes[m].name, 1e6 * duration / (double)forks);
+    }
+    bximap_destroy(&ctx);
+    err = bximap_finalize();
+    if (bxierr_isko(err)) BXIEXIT(EXIT_FAILURE, err, BENCH_LOGGER, BXILOG_CRITICAL);
+    return EXIT_SUCCESS;
+}
@@ -11,6 +11,18 @@
  ###############################################################################
  */
 
+bxierr_p test_function_count(bximap_task_idx_t start,
+                             bximap_task_idx_t end,
+                             bximap_thrd_idx_t thread,
+                             void *usr_data) {
+    UNUSED(thread);
+    int * test = (int *)usr_data;
+    for (bximap_task_idx_t i = start; i < end; i++) {
+        __sync_fetch_and_add(&test[i], 1);
+    }
+    return BXIERR_OK;
+}
+
 bxierr_p test_function(bximap_task_idx_t start,
                        bximap_task_idx_t end,
                        bximap_thrd_idx_t thread,
@@ -18,14 +30,18 @@ bxierr_p test_function(bximap_task_idx_t start,
     int * test = (int *)usr_data;
 
     UNUSED(thread);
+    // Maps can be nested
+    int nested[8] = {0};
     bximap_ctx_p task = NULL;
-    bxierr_p rc = bximap_new(1, 9, 1, &test_function, test, &task);
+    bxierr_p rc = bximap_new(0, 8, 1, &test_function_count, nested, &task);
     CU_ASSERT_TRUE(bxierr_isok(rc));
     bxierr_p err = bximap_execute(task);
-    CU_ASSERT_EQUAL(err->code, BXIMAP_RUNNING);
+    CU_ASSERT_TRUE(bxierr_isok(err));
     CU_ASSERT_PTR_NOT_NULL(task);
     bximap_destroy(&task);
-    bxierr_destroy(&err);
+    for (int i = 0; i < 8; i++) {
+        CU_ASSERT_EQUAL(nested[i], 1);
+    }
     //fprintf(stderr, "start: %d end %d\n",start,end);
     for (bximap_task_idx_t i = start; i < end; i++) {
         test[i]++;
@@ -387,6 +403,7 @@ void test_mapper_fork(void) {
     CU_ASSERT_TRUE(bxierr_isok(rc));
 
     CU_ASSERT_EQUAL(shared_info.state, MAPPER_INITIALIZED);
+    pthread_t worker = shared_info.threads_id[1];
     DEBUG(TEST_LOGGER, "Forking a child");
     errno = 0;
     pid_t cpid = fork();
@@ -398,13 +415,18 @@ void test_mapper_fork(void) {
         break;
     }
     case 0: { // In the child
-        CU_ASSERT_EQUAL(shared_info.state, MAPPER_UNSET);
-        bxierr_p err = bximap_execute(task);
-        CU_ASSERT_EQUAL(err->code, BXIMAP_NOT_INITIALIZED);
+        // The workers are started by the first execution
+        CU_ASSERT_EQUAL(shared_info.state, MAPPER_FORKED);
+        CU_ASSERT_EQUAL(shared_info.nb_created, 1);
+        // No worker of the parent owns a global spin lock
+        CU_ASSERT_EQUAL(auto_lock, 0);
+        bxierr_p err = bximap_init(&threads_nb);
+        CU_ASSERT_EQUAL(err->code, BXIMAP_INITIALIZE);
         bxierr_destroy(&err);
-        CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
-        CU_ASSERT_EQUAL(shared_info.state, MAPPER_INITIALIZED);
+        CU_ASSERT_TRUE(bxierr_isok(bximap_set_schedule(task, BXIMAP_SCHED_AUTO)));
         CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+        CU_ASSERT_EQUAL(shared_info.state, MAPPER_INITIALIZED);
+        CU_ASSERT_EQUAL(shared_info.nb_created, threads_nb);
         CU_ASSERT_EQUAL(test[0], 0);
         //fprintf(stderr, "test i: %d -> %d and should be 0 \n", 0, test[0]);
         for (int i = 2; i < 4; i++) {
@@ -423,7 +445,9 @@ void test_mapper_fork(void) {
         break;
     }
     default: {  // In the parent
+        // The pool is kept as it was
         CU_ASSERT_EQUAL(shared_info.state, MAPPER_INITIALIZED);
+        CU_ASSERT_TRUE(pthread_equal(worker, shared_info.threads_id[1]));
         CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
 
         CU_ASSERT_EQUAL(test[0], 0);
@@ -457,3 +481,1686 @@ void test_mapper_fork(void) {
     bximap_destroy(&task);
 }
 
+void test_map_steal(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    bximap_ctx_p task = NULL;
+    bxierr_p err = bximap_new(0, 10, 0, &test_function_count, NULL, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    err = bximap_set_schedule(task, (bximap_sched_e)42);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+    bxierr_destroy(&err);
+    err = bximap_set_default_schedule(BXIMAP_SCHED_DEFAULT);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+    bxierr_destroy(&err);
+    bximap_destroy(&task);
+
+    bximap_thrd_idx_t threads_nb = 4;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+
+    bximap_sched_e scheds[] = {BXIMAP_SCHED_DYNAMIC, BXIMAP_SCHED_STEAL,
+                               BXIMAP_SCHED_STATIC, BXIMAP_SCHED_GUIDED,
+                               BXIMAP_SCHED_AUTO, BXIMAP_SCHED_AFFINITY};
+    bximap_task_idx_t granularities[] = {0, 1, 3, 7, 1000};
+    bximap_task_idx_t ends[] = {0, 1, 9, 48, 1000};
+    for (size_t s = 0; s < ARRAYLEN(scheds); s++) {
+        for (size_t g = 0; g < ARRAYLEN(granularities); g++) {
+            for (size_t e = 0; e < ARRAYLEN(ends); e++) {
+                int * test = bximem_calloc((size_t)ends[e] * sizeof(*test));
+                err = bximap_new(0, ends[e], granularities[g],
+                                 &test_function_count, test, &task);
+                CU_ASSERT_TRUE(bxierr_isok(err));
+                err = bximap_set_schedule(task, scheds[s]);
+                CU_ASSERT_TRUE(bxierr_isok(err));
+                CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+                for (bximap_task_idx_t i = 0; i < ends[e]; i++) {
+                    CU_ASSERT_EQUAL(test[i], 1);
+                }
+                bximap_destroy(&task);
+                BXIFREE(test);
+            }
+        }
+    }
+
+    // Errors are collected as with the dynamic schedule
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_default_schedule(BXIMAP_SCHED_STEAL)));
+    int * test = bximem_calloc(10 * sizeof(*test));
+    err = bximap_new(1, 9, 1, &test_function2, test, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+    bximap_thrd_idx_t n = 0;
+    bxierr_p * errors = NULL;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_get_error(task, &n, &errors)));
+    CU_ASSERT_EQUAL(n, 8);
+    for (bximap_thrd_idx_t i = 0; i < n; i++) {
+        CU_ASSERT_EQUAL(errors[i]->code, TEST_ERR);
+    }
+    for (int i = 1; i < 9; i++) {
+        CU_ASSERT_EQUAL(test[i], 1);
+    }
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_default_schedule(BXIMAP_SCHED_DYNAMIC)));
+
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    bximap_destroy(&task);
+    BXIFREE(test);
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+bxierr_p test_function_fail_odd(bximap_task_idx_t start,
+                                bximap_task_idx_t end,
+                                bximap_thrd_idx_t thread,
+                                void *usr_data) {
+    UNUSED(thread);
+    int * test = (int *)usr_data;
+    for (bximap_task_idx_t i = start; i < end; i++) {
+        __sync_fetch_and_add(&test[i], 1);
+    }
+    if (start % 2 == 1) return bxierr_simple(TEST_ERR, "test");
+    return BXIERR_OK;
+}
+
+void test_map_bounds(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    bximap_thrd_idx_t threads_nb = 3;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+
+    // Remaining work spread among the tasks, or put in an additional task
+    bximap_task_idx_t granularities[] = {1, 2, 4, 5, 6, 10, 33};
+    const bximap_task_idx_t nb = 100003;
+    int * test = bximem_calloc((size_t)nb * sizeof(*test));
+    bximap_ctx_p task = NULL;
+    for (size_t g = 0; g < ARRAYLEN(granularities); g++) {
+        memset(test, 0, (size_t)nb * sizeof(*test));
+        bxierr_p err = bximap_new(3, nb, granularities[g],
+                                  &test_function_count, test, &task);
+        CU_ASSERT_TRUE(bxierr_isok(err));
+        CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+        for (bximap_task_idx_t i = 0; i < 3; i++) CU_ASSERT_EQUAL(test[i], 0);
+        bximap_task_idx_t bad = 0;
+        for (bximap_task_idx_t i = 3; i < nb; i++) bad += (test[i] != 1);
+        CU_ASSERT_EQUAL(bad, 0);
+    }
+    bximap_destroy(&task);
+
+    // Errors are only stored for failed tasks and reset on each execution
+    bxierr_p err = bximap_new(0, 1000, 1, &test_function_fail_odd, test, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    for (int r = 0; r < 2; r++) {
+        CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+        bximap_thrd_idx_t n = 0;
+        bxierr_p * errors = NULL;
+        CU_ASSERT_TRUE(bxierr_isok(bximap_get_error(task, &n, &errors)));
+        CU_ASSERT_EQUAL(n, 500);
+        CU_ASSERT_PTR_NOT_NULL(errors);
+        for (bximap_thrd_idx_t i = 0; i < n; i++) {
+            CU_ASSERT_EQUAL(errors[i]->code, TEST_ERR);
+        }
+    }
+    bximap_destroy(&task);
+
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    BXIFREE(test);
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+#define NESTED_ROWS 16
+#define NESTED_COLS 100
+typedef struct {
+    int * test;
+    bximap_sched_e sched;
+    int * depth;                // Tasks of the outer map on the stack of each thread
+    int reentered;
+} nested_data_s;
+
+bxierr_p test_function_nested(bximap_task_idx_t start,
+                              bximap_task_idx_t end,
+                              bximap_thrd_idx_t thread,
+                              void *usr_data) {
+    nested_data_s * data = (nested_data_s *)usr_data;
+    // Waiting for the inner map must not run another task of the outer one
+    if (0 != data->depth[thread]++) __atomic_store_n(&data->reentered, 1, __ATOMIC_RELAXED);
+    bxierr_p err = BXIERR_OK, err2;
+    for (bximap_task_idx_t row = start; row < end; row++) {
+        bximap_ctx_p task = NULL;
+        err2 = bximap_new(0, NESTED_COLS, 1, &test_function_count,
+                          data->test + row * NESTED_COLS, &task);
+        BXIERR_CHAIN(err, err2);
+        if (NULL == task) continue;
+        err2 = bximap_set_schedule(task, data->sched);
+        BXIERR_CHAIN(err, err2);
+        err2 = bximap_execute(task);
+        BXIERR_CHAIN(err, err2);
+        bximap_destroy(&task);
+    }
+    data->depth[thread]--;
+    return err;
+}
+
+bxierr_p test_function_self(bximap_task_idx_t start,
+                            bximap_task_idx_t end,
+                            bximap_thrd_idx_t thread,
+                            void *usr_data) {
+    UNUSED(start);
+    UNUSED(end);
+    UNUSED(thread);
+    // A running context cannot be executed again
+    bxierr_p err = bximap_execute(*(bximap_ctx_p *)usr_data);
+    if (bxierr_isko(err) && BXIMAP_RUNNING == err->code) {
+        bxierr_destroy(&err);
+        return BXIERR_OK;
+    }
+    bxierr_p err2 = bxierr_gen("The running context was executed again");
+    BXIERR_CHAIN(err, err2);
+    return err;
+}
+
+#define CONCURRENT_THREADS 4
+#define CONCURRENT_RUNS 20
+typedef struct {
+    int * test;
+    int failures;               // Checked by the main thread after the join
+} concurrent_data_s;
+
+void * test_map_concurrent_thread(void * arg) {
+    concurrent_data_s * data = (concurrent_data_s *)arg;
+    bximap_ctx_p task = NULL;
+    bxierr_p err = bximap_new(0, 1000, 0, &test_function_count, data->test, &task);
+    if (bxierr_isko(err)) {
+        data->failures++;
+        bxierr_destroy(&err);
+        return NULL;
+    }
+    for (int r = 0; r < CONCURRENT_RUNS; r++) {
+        err = bximap_execute(task);
+        if (bxierr_isko(err)) data->failures++;
+        bxierr_destroy(&err);
+    }
+    bximap_destroy(&task);
+    return NULL;
+}
+
+void test_map_nested(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    bximap_thrd_idx_t threads_nb = 4;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+
+    // Maps nested inside maps
+    bximap_sched_e scheds[] = {BXIMAP_SCHED_DYNAMIC, BXIMAP_SCHED_STEAL};
+    int * test = bximem_calloc(NESTED_ROWS * NESTED_COLS * sizeof(*test));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_get_nb_threads(&threads_nb)));
+    int * depth = bximem_calloc((size_t)threads_nb * sizeof(*depth));
+    for (size_t s = 0; s < ARRAYLEN(scheds); s++) {
+        memset(test, 0, NESTED_ROWS * NESTED_COLS * sizeof(*test));
+        nested_data_s data = {.test = test, .sched = scheds[s], .depth = depth};
+        bximap_ctx_p task = NULL;
+        bxierr_p err = bximap_new(0, NESTED_ROWS, 1, &test_function_nested,
+                                  &data, &task);
+        CU_ASSERT_TRUE(bxierr_isok(err));
+        err = bximap_set_schedule(task, scheds[s]);
+        CU_ASSERT_TRUE(bxierr_isok(err));
+        CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+        for (int i = 0; i < NESTED_ROWS * NESTED_COLS; i++) {
+            CU_ASSERT_EQUAL(test[i], 1);
+        }
+        CU_ASSERT_FALSE(data.reentered);
+        bximap_destroy(&task);
+    }
+    BXIFREE(depth);
+    BXIFREE(test);
+
+    bximap_ctx_p task = NULL;
+    bxierr_p err = bximap_new(0, 4, 1, &test_function_self, &task, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+    bximap_destroy(&task);
+
+    // Maps issued by several application threads at the same time
+    pthread_t threads[CONCURRENT_THREADS];
+    concurrent_data_s concurrent[CONCURRENT_THREADS];
+    test = bximem_calloc(CONCURRENT_THREADS * 1000 * sizeof(*test));
+    for (int t = 0; t < CONCURRENT_THREADS; t++) {
+        concurrent[t].test = test + t * 1000;
+        concurrent[t].failures = 0;
+        int rc = pthread_create(&threads[t], NULL, &test_map_concurrent_thread,
+                                &concurrent[t]);
+        CU_ASSERT_EQUAL(rc, 0);
+    }
+    for (int t = 0; t < CONCURRENT_THREADS; t++) {
+        CU_ASSERT_EQUAL(pthread_join(threads[t], NULL), 0);
+        CU_ASSERT_EQUAL(concurrent[t].failures, 0);
+    }
+    for (int i = 0; i < CONCURRENT_THREADS * 1000; i++) {
+        CU_ASSERT_EQUAL(test[i], CONCURRENT_RUNS);
+    }
+    BXIFREE(test);
+
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+typedef struct {
+    int * test;
+    bximap_task_idx_t nb;
+    int calls;
+    int complete;
+} callback_data_s;
+
+void test_map_callback(bximap_ctx_p context, void * data) {
+    UNUSED(context);
+    callback_data_s * cb = (callback_data_s *)data;
+    bximap_task_idx_t bad = 0;
+    for (bximap_task_idx_t i = 0; i < cb->nb; i++) bad += (cb->test[i] != cb->calls + 1);
+    if (0 == bad) cb->complete++;
+    cb->calls++;
+}
+
+void test_map_async(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    bximap_thrd_idx_t threads_nb = 4;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+
+    const bximap_task_idx_t nb = 10000;
+    int * test = bximem_calloc(3 * (size_t)nb * sizeof(*test));
+    bximap_ctx_p task = NULL;
+    bxierr_p err = bximap_new(0, nb, 0, &test_function_count, test, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+
+    // The context is only released by bximap_wait()
+    err = bximap_wait(task);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+    bxierr_destroy(&err);
+
+    callback_data_s cb = {.test = test, .nb = nb, .calls = 0, .complete = 0};
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_callback(task, &test_map_callback, &cb)));
+    bximap_handle_p handle = NULL;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_execute_async(task, &handle)));
+    err = bximap_execute_async(task, &handle);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_RUNNING);
+    bxierr_destroy(&err);
+    err = bximap_set_callback(task, NULL, NULL);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_RUNNING);
+    bxierr_destroy(&err);
+    bool done = false;
+    while (!done) {
+        CU_ASSERT_TRUE(bxierr_isok(bximap_test(handle, &done)));
+        sched_yield();
+    }
+    CU_ASSERT_TRUE(bxierr_isok(bximap_wait(handle)));
+    CU_ASSERT_EQUAL(cb.calls, 1);
+    CU_ASSERT_EQUAL(cb.complete, 1);
+    bximap_task_idx_t bad = 0;
+    for (bximap_task_idx_t i = 0; i < nb; i++) bad += (test[i] != 1);
+    CU_ASSERT_EQUAL(bad, 0);
+
+    // The callback is also called by synchronous executions
+    CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+    CU_ASSERT_EQUAL(cb.calls, 2);
+    CU_ASSERT_EQUAL(cb.complete, 2);
+    bximap_destroy(&task);
+
+    // Several executions waited for at once
+    memset(test, 0, 3 * (size_t)nb * sizeof(*test));
+    bximap_ctx_p tasks[3] = {NULL, NULL, NULL};
+    bximap_handle_p handles[3];
+    for (int t = 0; t < 3; t++) {
+        err = bximap_new(0, nb, 0, &test_function_count, test + t * nb, &tasks[t]);
+        CU_ASSERT_TRUE(bxierr_isok(err));
+        CU_ASSERT_TRUE(bxierr_isok(bximap_execute_async(tasks[t], &handles[t])));
+    }
+    size_t idx = 3;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_wait_any(handles, 3, &idx)));
+    CU_ASSERT_TRUE(idx < 3);
+    for (bximap_task_idx_t i = 0; i < nb; i++) {
+        CU_ASSERT_EQUAL(test[(bximap_task_idx_t)idx * nb + i], 1);
+    }
+    handles[idx] = handles[2];
+    CU_ASSERT_TRUE(bxierr_isok(bximap_wait_all(handles, 2)));
+    bad = 0;
+    for (bximap_task_idx_t i = 0; i < 3 * nb; i++) bad += (test[i] != 1);
+    CU_ASSERT_EQUAL(bad, 0);
+    for (int t = 0; t < 3; t++) bximap_destroy(&tasks[t]);
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+
+    // Without worker the work is done before returning
+    threads_nb = 1;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+    memset(test, 0, 3 * (size_t)nb * sizeof(*test));
+    err = bximap_new(0, nb, 0, &test_function_count, test, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_execute_async(task, &handle)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_test(handle, &done)));
+    CU_ASSERT_TRUE(done);
+    CU_ASSERT_TRUE(bxierr_isok(bximap_wait(handle)));
+    bad = 0;
+    for (bximap_task_idx_t i = 0; i < nb; i++) bad += (test[i] != 1);
+    CU_ASSERT_EQUAL(bad, 0);
+    bximap_destroy(&task);
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+
+    BXIFREE(test);
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+typedef struct {
+    long long sum;
+    bximap_task_idx_t min;
+    bximap_task_idx_t max;
+    int histogram[16];
+} reduce_acc_s;
+
+void test_reduce_identity(void * acc, void * usr_data) {
+    UNUSED(usr_data);
+    reduce_acc_s * r = (reduce_acc_s *)acc;
+    memset(r, 0, sizeof(*r));
+    r->min = LLONG_MAX;
+    r->max = LLONG_MIN;
+}
+
+void test_reduce_combine(void * acc, const void * other, void * usr_data) {
+    UNUSED(usr_data);
+    reduce_acc_s * r = (reduce_acc_s *)acc;
+    const reduce_acc_s * o = (const reduce_acc_s *)other;
+    r->sum += o->sum;
+    if (o->min < r->min) r->min = o->min;
+    if (o->max > r->max) r->max = o->max;
+    for (int i = 0; i < 16; i++) r->histogram[i] += o->histogram[i];
+}
+
+bxierr_p test_reduce_func(bximap_task_idx_t start,
+                          bximap_task_idx_t end,
+                          bximap_thrd_idx_t thread,
+                          void * acc,
+                          void * usr_data) {
+    UNUSED(thread);
+    reduce_acc_s * r = (reduce_acc_s *)acc;
+    for (bximap_task_idx_t i = start; i < end; i++) {
+        r->sum += i;
+        if (i < r->min) r->min = i;
+        if (i > r->max) r->max = i;
+        r->histogram[i % 16]++;
+    }
+    if (NULL != usr_data && start % 2 == 1) return bxierr_simple(TEST_ERR, "test");
+    return BXIERR_OK;
+}
+
+void test_map_reduce(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    reduce_acc_s result;
+    bxierr_p err = bximap_reduce(0, 10, 0, &test_reduce_func, sizeof(result),
+                                 &test_reduce_identity, &test_reduce_combine,
+                                 NULL, &result);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_NOT_INITIALIZED);
+    bxierr_destroy(&err);
+
+    bximap_thrd_idx_t threads_nb = 5;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+
+    err = bximap_reduce(0, 10, 0, &test_reduce_func, 0,
+                        &test_reduce_identity, &test_reduce_combine,
+                        NULL, &result);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+    bxierr_destroy(&err);
+
+    bximap_task_idx_t granularities[] = {0, 1, 7, 1000};
+    bximap_task_idx_t nb = 100000;
+    for (size_t g = 0; g < ARRAYLEN(granularities); g++) {
+        err = bximap_reduce(3, nb, granularities[g], &test_reduce_func, sizeof(result),
+                            &test_reduce_identity, &test_reduce_combine,
+                            NULL, &result);
+        CU_ASSERT_TRUE(bxierr_isok(err));
+        CU_ASSERT_EQUAL(result.sum, nb * (nb - 1) / 2 - 3);
+        CU_ASSERT_EQUAL(result.min, 3);
+        CU_ASSERT_EQUAL(result.max, nb - 1);
+        int total = 0;
+        for (int i = 0; i < 16; i++) total += result.histogram[i];
+        CU_ASSERT_EQUAL(total, nb - 3);
+        CU_ASSERT_EQUAL(result.histogram[0], (nb - 1) / 16);
+    }
+
+    // Empty range: the result is the identity
+    err = bximap_reduce(5, 5, 0, &test_reduce_func, sizeof(result),
+                        &test_reduce_identity, &test_reduce_combine,
+                        NULL, &result);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    CU_ASSERT_EQUAL(result.sum, 0);
+    CU_ASSERT_EQUAL(result.min, LLONG_MAX);
+
+    // Errors of the failed tasks are chained
+    err = bximap_reduce(0, 10, 1, &test_reduce_func, sizeof(result),
+                        &test_reduce_identity, &test_reduce_combine,
+                        &result, &result);
+    CU_ASSERT_TRUE(bxierr_isko(err));
+    CU_ASSERT_EQUAL(err->code, TEST_ERR);
+    bxierr_destroy(&err);
+
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+void test_map_spin(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    bxierr_p err = bximap_set_spin_budget(-1);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+    bxierr_destroy(&err);
+
+    bximap_thrd_idx_t threads_nb = 4;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+    int spins[] = {0, 1, BXIMAP_SPIN_DEFAULT};
+    int * test = bximem_calloc(64 * sizeof(*test));
+    bximap_ctx_p task = NULL;
+    err = bximap_new(0, 64, 1, &test_function_count, test, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    for (size_t s = 0; s < ARRAYLEN(spins); s++) {
+        CU_ASSERT_TRUE(bxierr_isok(bximap_set_spin_budget(spins[s])));
+        memset(test, 0, 64 * sizeof(*test));
+        // Many small maps: threads park and wake up between them
+        for (int r = 0; r < 200; r++) {
+            CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+        }
+        for (int i = 0; i < 64; i++) {
+            CU_ASSERT_EQUAL(test[i], 200);
+        }
+    }
+    bximap_destroy(&task);
+    BXIFREE(test);
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+bxierr_p test_function_chunks(bximap_task_idx_t start,
+                              bximap_task_idx_t end,
+                              bximap_thrd_idx_t thread,
+                              void *usr_data) {
+    UNUSED(thread);
+    bximap_task_idx_t * chunks = (bximap_task_idx_t *)usr_data;
+    chunks[start] = end - start;
+    return BXIERR_OK;
+}
+
+bxierr_p test_function_busy(bximap_task_idx_t start,
+                            bximap_task_idx_t end,
+                            bximap_thrd_idx_t thread,
+                            void *usr_data) {
+    UNUSED(thread);
+    volatile unsigned long * sink = (volatile unsigned long *)usr_data;
+    unsigned long acc = 0;
+    for (bximap_task_idx_t i = start; i < end; i++) {
+        for (unsigned long j = 0; j < 200; j++) acc += j ^ (unsigned long)i;
+    }
+    __sync_fetch_and_add(sink, acc);
+    return BXIERR_OK;
+}
+
+void test_map_policies(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    bximap_thrd_idx_t threads_nb = 4;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+
+    // Guided chunks shrink along the range, down to the granularity
+    const bximap_task_idx_t nb = 10000;
+    bximap_task_idx_t * chunks = bximem_calloc((size_t)nb * sizeof(*chunks));
+    bximap_ctx_p task = NULL;
+    bxierr_p err = bximap_new(0, nb, 16, &test_function_chunks, chunks, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_schedule(task, BXIMAP_SCHED_GUIDED)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+    bximap_task_idx_t previous = nb, nb_chunks = 0;
+    for (bximap_task_idx_t i = 0; i < nb; i += chunks[i]) {
+        CU_ASSERT_TRUE(chunks[i] > 0);
+        if (chunks[i] <= 0) break;
+        CU_ASSERT_TRUE(chunks[i] <= previous);
+        CU_ASSERT_TRUE(chunks[i] >= 16 || i + chunks[i] == nb);
+        previous = chunks[i];
+        nb_chunks++;
+    }
+    CU_ASSERT_EQUAL(chunks[0], nb / threads_nb);
+    CU_ASSERT_TRUE(nb_chunks < nb / 16);
+    bximap_destroy(&task);
+    BXIFREE(chunks);
+
+    // Auto tuned granularity, bounded to keep several tasks per thread
+    volatile unsigned long sink = 0;
+    err = bximap_new(0, 100000, 0, &test_function_busy, (void *)&sink, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_schedule(task, BXIMAP_SCHED_AUTO)));
+    for (int r = 0; r < 3; r++) {
+        CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+    }
+    size_t slot = (size_t)((uintptr_t)&test_function_busy >> 4) % BXIMAP_AUTO_ENTRIES;
+    CU_ASSERT_TRUE(auto_table[slot].func == &test_function_busy);
+    CU_ASSERT_TRUE(auto_table[slot].iteration_time > 0);
+    CU_ASSERT_TRUE(task->task_size >= 1);
+    CU_ASSERT_TRUE(task->task_size
+                   <= 100000 / (BXIMAP_AUTO_TASKS_PER_THREAD * threads_nb));
+    bximap_destroy(&task);
+
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+void test_map_stats(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    bxierr_p err = bximap_set_stats_mode(BXIMAP_STATS_CLOCK + 1);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+    bxierr_destroy(&err);
+
+    bximap_thrd_idx_t threads_nb = 4;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+    volatile unsigned long sink = 0;
+    const bximap_task_idx_t nb = 20000;
+    const bximap_sched_e scheds[] = {BXIMAP_SCHED_DYNAMIC, BXIMAP_SCHED_STEAL,
+                                     BXIMAP_SCHED_STATIC, BXIMAP_SCHED_GUIDED};
+    const bximap_stats_mode_e modes[] = {BXIMAP_STATS_CLOCK, BXIMAP_STATS_TSC};
+    for (size_t m = 0; m < ARRAYLEN(modes); m++) {
+        CU_ASSERT_TRUE(bxierr_isok(bximap_set_stats_mode(modes[m])));
+        for (size_t s = 0; s < ARRAYLEN(scheds); s++) {
+            bximap_ctx_p task = NULL;
+            err = bximap_new(0, nb, 10, &test_function_busy, (void *)&sink, &task);
+            CU_ASSERT_TRUE(bxierr_isok(err));
+            CU_ASSERT_TRUE(bxierr_isok(bximap_set_schedule(task, scheds[s])));
+            CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+            bximap_stats_s stats;
+            CU_ASSERT_TRUE(bxierr_isok(bximap_get_stats(task, &stats)));
+            CU_ASSERT_EQUAL(stats.nb_threads, threads_nb);
+            CU_ASSERT_TRUE(stats.duration > 0);
+            CU_ASSERT_TRUE(stats.imbalance >= 1);
+            bximap_task_idx_t tasks = 0, iterations = 0;
+            for (bximap_thrd_idx_t i = 0; i < stats.nb_threads; i++) {
+                CU_ASSERT_TRUE(stats.threads[i].busy_time >= 0);
+                CU_ASSERT_TRUE(stats.threads[i].wait_time >= 0);
+                CU_ASSERT_TRUE(stats.threads[i].steals <= stats.threads[i].tasks);
+                // Timer ticks are read on different cores: allow some jitter
+                CU_ASSERT_TRUE(stats.threads[i].busy_time <= stats.duration * 1.01
+                               + 1e-3);
+                tasks += stats.threads[i].tasks;
+                iterations += stats.threads[i].iterations;
+            }
+            CU_ASSERT_EQUAL(iterations, nb);
+            if (BXIMAP_SCHED_GUIDED != scheds[s]) CU_ASSERT_EQUAL(tasks, nb / 10);
+            if (BXIMAP_SCHED_DYNAMIC == scheds[s]) {
+                for (bximap_thrd_idx_t i = 0; i < stats.nb_threads; i++) {
+                    CU_ASSERT_EQUAL(stats.threads[i].steals, 0);
+                }
+            }
+            bximap_destroy(&task);
+        }
+    }
+
+    // Without timing, there are no statistics
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_stats_mode(BXIMAP_STATS_OFF)));
+    bximap_ctx_p task = NULL;
+    err = bximap_new(0, nb, 10, &test_function_busy, (void *)&sink, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+    bximap_stats_s stats;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_get_stats(task, &stats)));
+    CU_ASSERT_EQUAL(stats.nb_threads, 0);
+    CU_ASSERT_TRUE(NULL == stats.threads);
+    bximap_destroy(&task);
+
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_stats_mode(BXIMAP_STATS_CLOCK)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+/* Write a fake topology: 2 sockets of 2 cores of 2 hardware threads,
+ * numbered as Linux does, siblings of cpus 0-3 being 4-7.
+ * Each socket is a NUMA node. */
+void test_write_topology(const char * root, bool create) {
+    for (int cpu = 0; cpu < 8; cpu++) {
+        char * dir = bxistr_new("%s/cpu%d", root, cpu);
+        char * topo = bxistr_new("%s/topology", dir);
+        char * package = bxistr_new("%s/physical_package_id", topo);
+        char * core = bxistr_new("%s/core_id", topo);
+        char * node = bxistr_new("%s/node%d", dir, (cpu % 4) / 2);
+        if (create) {
+            CU_ASSERT_EQUAL(mkdir(dir, 0700), 0);
+            CU_ASSERT_EQUAL(mkdir(topo, 0700), 0);
+            CU_ASSERT_EQUAL(mkdir(node, 0700), 0);
+            FILE * file = fopen(package, "w");
+            CU_ASSERT_PTR_NOT_NULL_FATAL(file);
+            fprintf(file, "%d\n", (cpu % 4) / 2);
+            fclose(file);
+            file = fopen(core, "w");
+            CU_ASSERT_PTR_NOT_NULL_FATAL(file);
+            fprintf(file, "%d\n", cpu % 2);
+            fclose(file);
+        } else {
+            unlink(package);
+            unlink(core);
+            rmdir(node);
+            rmdir(topo);
+            rmdir(dir);
+        }
+        BXIFREE(node);
+        BXIFREE(core);
+        BXIFREE(package);
+        BXIFREE(topo);
+        BXIFREE(dir);
+    }
+}
+
+bxierr_p test_function_where(bximap_task_idx_t start,
+                             bximap_task_idx_t end,
+                             bximap_thrd_idx_t thread,
+                             void *usr_data) {
+    bximap_cpu_idx_t * where = (bximap_cpu_idx_t *)usr_data;
+    for (bximap_task_idx_t i = start; i < end; i++) {
+        // Threads may run several tasks: keep the cpu of each thread
+        where[thread] = sched_getcpu();
+    }
+    return BXIERR_OK;
+}
+
+void test_map_placement(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    char * root = NULL;
+    bxierr_p err = bximisc_mkdtemp("bximap-topology-XXXXXX", &root);
+    CU_ASSERT_TRUE_FATAL(bxierr_isok(err));
+    test_write_topology(root, true);
+    const char * saved = sysfs_cpu;
+    sysfs_cpu = root;
+
+    const bximap_cpu_idx_t cpus[] = {0, 1, 2, 3, 4, 5, 6, 7};
+    const struct {
+        bximap_place_e place;
+        size_t nb;
+        bximap_cpu_idx_t expected[8];
+    } cases[] = {
+        {BXIMAP_PLACE_COMPACT, 8, {0, 4, 1, 5, 2, 6, 3, 7}},
+        {BXIMAP_PLACE_SCATTER, 8, {0, 2, 1, 3, 4, 6, 5, 7}},
+        {BXIMAP_PLACE_PHYSCORE, 4, {0, 1, 2, 3}},
+    };
+    for (size_t c = 0; c < ARRAYLEN(cases); c++) {
+        bximap_cpu_idx_t placed[8];
+        size_t nb_placed = 0;
+        err = _place_cpus(cases[c].place, cpus, ARRAYLEN(cpus), placed, &nb_placed);
+        CU_ASSERT_TRUE(bxierr_isok(err));
+        CU_ASSERT_EQUAL(nb_placed, cases[c].nb);
+        for (size_t i = 0; i < nb_placed && i < cases[c].nb; i++) {
+            CU_ASSERT_EQUAL(placed[i], cases[c].expected[i]);
+        }
+    }
+
+    CU_ASSERT_EQUAL(_read_node(0), 0);
+    CU_ASSERT_EQUAL(_read_node(2), 1);
+    CU_ASSERT_EQUAL(_read_node(7), 1);
+    CU_ASSERT_EQUAL(_read_node(-1), 0);
+
+    // Without topology, each cpu is its own core
+    sysfs_cpu = "/nonexistent";
+    CU_ASSERT_EQUAL(_read_node(3), 0);
+    bximap_cpu_idx_t placed[8];
+    size_t nb_placed = 0;
+    err = _place_cpus(BXIMAP_PLACE_PHYSCORE, cpus, ARRAYLEN(cpus), placed, &nb_placed);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    CU_ASSERT_EQUAL(nb_placed, ARRAYLEN(cpus));
+    sysfs_cpu = saved;
+    test_write_topology(root, false);
+    rmdir(root);
+    BXIFREE(root);
+
+    err = bximap_on_cpu(-1);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_NEGATIVE_INTEGER);
+    bxierr_destroy(&err);
+    err = bximap_set_placement(BXIMAP_PLACE_PHYSCORE + 1);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+    bxierr_destroy(&err);
+
+    // Threads run on the cpus of the map, restore the affinity afterwards
+    cpu_set_t affinity;
+    CU_ASSERT_EQUAL(sched_getaffinity(0, sizeof(affinity), &affinity), 0);
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_placement(BXIMAP_PLACE_COMPACT)));
+    bximap_thrd_idx_t threads_nb = 4;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+    err = bximap_set_placement(BXIMAP_PLACE_NONE);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_INITIALIZE);
+    bxierr_destroy(&err);
+    bximap_cpu_idx_t map[5], where[4] = {-1, -1, -1, -1};
+    CU_ASSERT_TRUE(bxierr_isok(bximap_get_cpu_map(map, 5)));
+    CU_ASSERT_EQUAL(map[4], -1);
+    bximap_ctx_p task = NULL;
+    err = bximap_new(0, 4000, 1, &test_function_where, where, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_get_cpu_map(map, 4)));
+    for (bximap_thrd_idx_t i = 0; i < threads_nb; i++) {
+        CU_ASSERT_TRUE(map[i] >= 0);
+        CU_ASSERT_TRUE(where[i] == -1 || map[i] < 0 || where[i] == map[i]);
+    }
+    bximap_destroy(&task);
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_placement(BXIMAP_PLACE_NONE)));
+    CU_ASSERT_EQUAL(sched_setaffinity(0, sizeof(affinity), &affinity), 0);
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+void test_map_affinity(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    // Threads 0 and 2 on one node, 1 and 3 on the other
+    int nodes[] = {0, 1, 0, 1};
+    int * saved = shared_info.threads_node;
+    shared_info.threads_node = nodes;
+    bximap_ctx_s job;
+    memset(&job, 0, sizeof(job));
+    job.nb_threads = 4;
+    job.run_sched = BXIMAP_SCHED_AFFINITY;
+    _task_deque_s * deques = NULL;
+    CU_ASSERT_EQUAL_FATAL(posix_memalign((void **)&deques, BXIMAP_CACHE_LINE,
+                                         4 * sizeof(*deques)), 0);
+    memset(deques, 0, 4 * sizeof(*deques));
+    job.deques = deques;
+    deques[1].next = 10; deques[1].end = 20;
+    deques[2].next = 20; deques[2].end = 30;
+    deques[3].next = 30; deques[3].end = 40;
+
+    // The thread 0 steals from its node first, then from the nearest thread
+    bximap_task_idx_t task_idx;
+    CU_ASSERT_TRUE(_deque_steal(&job, 0, &task_idx));
+    CU_ASSERT_EQUAL(task_idx, 25);
+    CU_ASSERT_EQUAL(deques[2].end, 25);
+    deques[2].next = deques[2].end;
+    CU_ASSERT_TRUE(_deque_steal(&job, 0, &task_idx));
+    CU_ASSERT_EQUAL(task_idx, 15);
+
+    // The thread 3 steals from the thread 1
+    CU_ASSERT_TRUE(_deque_steal(&job, 3, &task_idx));
+    CU_ASSERT_EQUAL(task_idx, 12);
+    free(deques);
+    shared_info.threads_node = saved;
+
+    bximap_thrd_idx_t threads_nb = 4;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+    int * test = bximem_calloc(4000 * sizeof(*test));
+    bximap_ctx_p task = NULL;
+    bxierr_p err = bximap_new(0, 4000, 10, &test_function_count, test, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_schedule(task, BXIMAP_SCHED_AFFINITY)));
+    for (int r = 0; r < 3; r++) {
+        CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+    }
+    for (int i = 0; i < 4000; i++) CU_ASSERT_EQUAL(test[i], 3);
+    bximap_destroy(&task);
+    BXIFREE(test);
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+typedef struct {
+    bximap_task_idx_t match;    // Iteration searched
+    bximap_task_idx_t found;
+    bximap_task_idx_t done;     // Iterations run
+} search_data_s;
+
+bxierr_p test_function_search(bximap_task_idx_t start,
+                              bximap_task_idx_t end,
+                              bximap_thrd_idx_t thread,
+                              void *usr_data) {
+    UNUSED(thread);
+    search_data_s * search = (search_data_s *)usr_data;
+    for (bximap_task_idx_t i = start; i < end && !bximap_cancelled(NULL); i++) {
+        __sync_fetch_and_add(&search->done, 1);
+        if (i == search->match) {
+            search->found = i;
+            return bximap_cancel(NULL);
+        }
+    }
+    return BXIERR_OK;
+}
+
+bxierr_p test_function_fail_match(bximap_task_idx_t start,
+                                  bximap_task_idx_t end,
+                                  bximap_thrd_idx_t thread,
+                                  void *usr_data) {
+    UNUSED(thread);
+    search_data_s * search = (search_data_s *)usr_data;
+    __sync_fetch_and_add(&search->done, end - start);
+    if (start <= search->match && search->match < end) {
+        return bxierr_gen("Iteration "TASK_IDX_FMT" failed", search->match);
+    }
+    return BXIERR_OK;
+}
+
+bxierr_p test_function_wait_cancel(bximap_task_idx_t start,
+                                   bximap_task_idx_t end,
+                                   bximap_thrd_idx_t thread,
+                                   void *usr_data) {
+    UNUSED(thread);
+    search_data_s * search = (search_data_s *)usr_data;
+    __sync_fetch_and_add(&search->done, end - start);
+    // Long task, ended by the caller
+    while (!bximap_cancelled(NULL)) sched_yield();
+    return BXIERR_OK;
+}
+
+void test_map_cancel(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    CU_ASSERT_FALSE(bximap_cancelled(NULL));
+    bxierr_p err = bximap_cancel(NULL);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_NO_CONTEXT);
+    bxierr_destroy(&err);
+
+    bximap_thrd_idx_t threads_nb = 4;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+    const bximap_task_idx_t nb = 1000000;
+    bximap_sched_e scheds[] = {BXIMAP_SCHED_DYNAMIC, BXIMAP_SCHED_STEAL,
+                               BXIMAP_SCHED_STATIC, BXIMAP_SCHED_GUIDED,
+                               BXIMAP_SCHED_AFFINITY};
+    for (size_t s = 0; s < ARRAYLEN(scheds); s++) {
+        // Find first: the map ends soon after the match
+        search_data_s search = {.match = 1000, .found = -1, .done = 0};
+        bximap_ctx_p task = NULL;
+        err = bximap_new(0, nb, 100, &test_function_search, &search, &task);
+        CU_ASSERT_TRUE(bxierr_isok(err));
+        CU_ASSERT_TRUE(bxierr_isok(bximap_set_schedule(task, scheds[s])));
+        CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+        CU_ASSERT_TRUE(bximap_cancelled(task));
+        CU_ASSERT_EQUAL(search.found, 1000);
+        CU_ASSERT_TRUE(search.done < nb);
+        err = bximap_cancel(task);
+        CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+        bxierr_destroy(&err);
+
+        // The next execution runs every task again
+        search.match = nb;
+        search.done = 0;
+        CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+        CU_ASSERT_FALSE(bximap_cancelled(task));
+        CU_ASSERT_EQUAL(search.done, nb);
+        bximap_destroy(&task);
+    }
+
+    // Stop on the first error
+    search_data_s search = {.match = 500, .found = -1, .done = 0};
+    bximap_ctx_p task = NULL;
+    err = bximap_new(0, nb, 10, &test_function_fail_match, &search, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_stop_on_error(task, true)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+    CU_ASSERT_TRUE(bximap_cancelled(task));
+    CU_ASSERT_TRUE(search.done < nb);
+    bximap_thrd_idx_t nb_errors = 0;
+    bxierr_p * errors = NULL;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_get_error(task, &nb_errors, &errors)));
+    CU_ASSERT_EQUAL(nb_errors, 1);
+    bximap_destroy(&task);
+
+    // Cancellation by the caller of an asynchronous execution
+    search.done = 0;
+    err = bximap_new(0, threads_nb, 1, &test_function_wait_cancel, &search, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    bximap_handle_p handle = NULL;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_execute_async(task, &handle)));
+    while (0 == __atomic_load_n(&search.done, __ATOMIC_ACQUIRE)) sched_yield();
+    CU_ASSERT_TRUE(bxierr_isok(bximap_cancel(task)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_wait(handle)));
+    CU_ASSERT_TRUE(bximap_cancelled(task));
+    bximap_destroy(&task);
+
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+#define ND_ROWS 10
+#define ND_COLS 7
+
+bxierr_p test_function_tile(const bximap_tile_s * tile,
+                            bximap_thrd_idx_t thread,
+                            void *usr_data) {
+    UNUSED(thread);
+    int * test = (int *)usr_data;
+    bxiassert(2 == tile->dims);
+    for (bximap_task_idx_t r = tile->start[0]; r < tile->end[0]; r++) {
+        for (bximap_task_idx_t c = tile->start[1]; c < tile->end[1]; c++) {
+            __sync_fetch_and_add(&test[r * ND_COLS + c], 1);
+        }
+    }
+    return BXIERR_OK;
+}
+
+bxierr_p test_function_tile_3d(const bximap_tile_s * tile,
+                               bximap_thrd_idx_t thread,
+                               void *usr_data) {
+    UNUSED(thread);
+    bximap_task_idx_t * volume = (bximap_task_idx_t *)usr_data;
+    bximap_task_idx_t size = 1;
+    for (int k = 0; k < tile->dims; k++) size *= tile->end[k] - tile->start[k];
+    __sync_fetch_and_add(volume, size);
+    return BXIERR_OK;
+}
+
+void test_map_nd(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    bximap_thrd_idx_t threads_nb = 4;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+
+    // Every cell is in one tile, tiles are clipped at the upper bounds
+    int test[ND_ROWS * ND_COLS];
+    bximap_task_idx_t start[] = {0, 0}, end[] = {ND_ROWS, ND_COLS}, tile[] = {3, 2};
+    bximap_ctx_p task = NULL;
+    bxierr_p err = bximap_new_nd(2, start, end, tile, &test_function_tile, test, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    bximap_sched_e scheds[] = {BXIMAP_SCHED_DYNAMIC, BXIMAP_SCHED_STEAL,
+                               BXIMAP_SCHED_GUIDED};
+    for (size_t s = 0; s < ARRAYLEN(scheds); s++) {
+        memset(test, 0, sizeof(test));
+        CU_ASSERT_TRUE(bxierr_isok(bximap_set_schedule(task, scheds[s])));
+        CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+        for (int i = 0; i < ND_ROWS * ND_COLS; i++) CU_ASSERT_EQUAL(test[i], 1);
+    }
+    CU_ASSERT_EQUAL(task->end, 16);
+
+    // Z order of a 2x2 grid of tiles: the first dimension varies fastest
+    bximap_task_idx_t square[] = {4, 4}, half[] = {2, 2};
+    err = bximap_new_nd(2, start, square, half, &test_function_tile, test, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    _nd_s * nd = task->nd;
+    const bximap_task_idx_t z_order[] = {0, 2, 1, 3};
+    bximap_task_idx_t coords[BXIMAP_ND_MAX];
+    for (size_t i = 0; i < ARRAYLEN(z_order); i++) {
+        _nd_tile(nd, (bximap_task_idx_t)i, coords);
+        CU_ASSERT_EQUAL(coords[0] * 2 + coords[1], z_order[i]);
+    }
+
+    // A 3x5 grid follows the Z curve of the 4x8 grid, without its holes
+    bximap_task_idx_t grid[] = {3, 5}, unit[] = {1, 1};
+    err = bximap_new_nd(2, start, grid, unit, &test_function_tile, test, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    nd = task->nd;
+    const bximap_task_idx_t z_grid[][2] = {{0, 0}, {1, 0}, {0, 1}, {1, 1},
+                                           {2, 0}, {2, 1}, {0, 2}, {1, 2},
+                                           {0, 3}, {1, 3}, {2, 2}, {2, 3},
+                                           {0, 4}, {1, 4}, {2, 4}};
+    for (size_t i = 0; i < ARRAYLEN(z_grid); i++) {
+        _nd_tile(nd, (bximap_task_idx_t)i, coords);
+        CU_ASSERT_EQUAL(coords[0], z_grid[i][0]);
+        CU_ASSERT_EQUAL(coords[1], z_grid[i][1]);
+    }
+
+    // A 1-D map on the same context drops the tiles
+    err = bximap_new(0, 10, 0, &test_function2, test, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    CU_ASSERT_PTR_NULL(task->nd);
+    bximap_destroy(&task);
+
+    // Three dimensions, not starting at 0
+    bximap_task_idx_t start3[] = {-5, 3, 10}, end3[] = {20, 11, 10 + 33};
+    bximap_task_idx_t tile3[] = {4, 3, 5}, volume = 0;
+    err = bximap_new_nd(3, start3, end3, tile3, &test_function_tile_3d, &volume, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+    CU_ASSERT_EQUAL(volume, 25 * 8 * 33);
+    bximap_destroy(&task);
+
+    err = bximap_new_nd(BXIMAP_ND_MAX + 1, start3, end3, tile3,
+                        &test_function_tile_3d, &volume, &task);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+    bxierr_destroy(&err);
+    tile3[1] = 0;
+    err = bximap_new_nd(3, start3, end3, tile3, &test_function_tile_3d, &volume, &task);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+    bxierr_destroy(&err);
+    CU_ASSERT_PTR_NULL(task);
+
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+bxierr_p test_function_threads(bximap_task_idx_t start,
+                               bximap_task_idx_t end,
+                               bximap_thrd_idx_t thread,
+                               void *usr_data) {
+    int * used = (int *)usr_data;
+    __sync_fetch_and_add(&used[thread], (int)(end - start));
+    // Leave time to the other threads to join
+    sched_yield();
+    return BXIERR_OK;
+}
+
+void test_map_resize(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    bxierr_p err = bximap_resize(2);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_NOT_INITIALIZED);
+    bxierr_destroy(&err);
+
+    bximap_thrd_idx_t threads_nb = 4;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+    err = bximap_resize(0);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+    bxierr_destroy(&err);
+
+    int used[8];
+    bximap_ctx_p task = NULL;
+    err = bximap_new(0, 2000, 1, &test_function_threads, used, &task);
+    CU_ASSERT_TRUE(bxierr_isok(err));
+    // Shrink, grow beyond the initial size, then back to the initial size
+    bximap_thrd_idx_t sizes[] = {2, 1, 6, 4};
+    for (size_t s = 0; s < ARRAYLEN(sizes); s++) {
+        CU_ASSERT_TRUE(bxierr_isok(bximap_resize(sizes[s])));
+        for (int r = 0; r < 3; r++) {
+            memset(used, 0, sizeof(used));
+            CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+            int total = 0;
+            for (bximap_thrd_idx_t i = 0; i < 8; i++) {
+                if (i >= sizes[s]) CU_ASSERT_EQUAL(used[i], 0);
+                total += used[i];
+            }
+            CU_ASSERT_EQUAL(total, 2000);
+        }
+        bximap_cpu_idx_t cpus[8];
+        CU_ASSERT_TRUE(bxierr_isok(bximap_get_cpu_map(cpus, 8)));
+        CU_ASSERT_EQUAL(cpus[sizes[s]], -1);
+        bximap_stats_s stats;
+        CU_ASSERT_TRUE(bxierr_isok(bximap_get_stats(task, &stats)));
+        CU_ASSERT_EQUAL(stats.nb_threads, sizes[s]);
+    }
+    CU_ASSERT_EQUAL(shared_info.nb_created, 6);
+
+    // Not while a map runs
+    bximap_handle_p handle = NULL;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_execute_async(task, &handle)));
+    err = bximap_resize(2);
+    CU_ASSERT_TRUE(bxierr_isok(err) || BXIMAP_RUNNING == err->code);
+    bxierr_destroy(&err);
+    CU_ASSERT_TRUE(bxierr_isok(bximap_wait(handle)));
+    bximap_destroy(&task);
+
+    // Parked threads are joined too
+    CU_ASSERT_TRUE(bxierr_isok(bximap_resize(3)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+void test_map_resize_placed(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    // The master is bound to its cpu from bximap_init() to bximap_finalize()
+    cpu_set_t affinity;
+    CU_ASSERT_EQUAL(sched_getaffinity(0, sizeof(affinity), &affinity), 0);
+    bximap_thrd_idx_t allowed = (bximap_thrd_idx_t)CPU_COUNT(&affinity);
+    bximap_thrd_idx_t grown = allowed < 4 ? allowed : 4;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_placement(BXIMAP_PLACE_COMPACT)));
+    bximap_thrd_idx_t threads_nb = 1;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_resize(grown)));
+
+    // The new threads are spread over the cpus allowed before the binding
+    bximap_cpu_idx_t cpus[4];
+    CU_ASSERT_TRUE(bxierr_isok(bximap_get_cpu_map(cpus, grown)));
+    for (bximap_thrd_idx_t i = 0; i < grown; i++) {
+        CU_ASSERT_TRUE(cpus[i] >= 0);
+        CU_ASSERT_TRUE(cpus[i] < 0 || CPU_ISSET((size_t)cpus[i], &affinity));
+        for (bximap_thrd_idx_t j = 0; j < i; j++) CU_ASSERT_NOT_EQUAL(cpus[i], cpus[j]);
+    }
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    // The master gets its affinity back
+    cpu_set_t restored;
+    CU_ASSERT_EQUAL(sched_getaffinity(0, sizeof(restored), &restored), 0);
+    CU_ASSERT_TRUE(CPU_EQUAL(&restored, &affinity));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_placement(BXIMAP_PLACE_NONE)));
+    CU_ASSERT_EQUAL(sched_setaffinity(0, sizeof(affinity), &affinity), 0);
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+#define SUBMIT_CALLS (3 * BXIMAP_QUEUE_SIZE)
+#define SUBMIT_DEPTH 3
+#define SUBMIT_FANOUT 4
+
+volatile int submit_count = 0;
+
+bxierr_p test_function_call(void * arg) {
+    __sync_fetch_and_add(&submit_count, 1);
+    long n = (long)(intptr_t)arg;
+    if (n % 7 == 0) return bxierr_gen("Call %ld failed", n);
+    return BXIERR_OK;
+}
+
+/* Submit its children and wait for them from a thread of the pool */
+bxierr_p test_function_tree(void * arg) {
+    long depth = (long)(intptr_t)arg;
+    __sync_fetch_and_add(&submit_count, 1);
+    if (depth == SUBMIT_DEPTH) return BXIERR_OK;
+    bximap_future_p futures[SUBMIT_FANOUT];
+    for (int i = 0; i < SUBMIT_FANOUT; i++) {
+        bxierr_p err = bximap_submit(&test_function_tree, (void *)(intptr_t)(depth + 1),
+                                     &futures[i]);
+        if (bxierr_isko(err)) return err;
+    }
+    bxierr_p err = BXIERR_OK, err2;
+    for (int i = 0; i < SUBMIT_FANOUT; i++) {
+        err2 = bximap_future_wait(&futures[i]);
+        BXIERR_CHAIN(err, err2);
+    }
+    return err;
+}
+
+/* Run a map from a submitted call */
+bxierr_p test_function_call_map(void * arg) {
+    return bximap_execute((bximap_ctx_p)arg);
+}
+
+void test_map_submit(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    bximap_future_p future = NULL;
+    bxierr_p err = bximap_submit(&test_function_call, NULL, &future);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_NOT_INITIALIZED);
+    bxierr_destroy(&err);
+
+    bximap_thrd_idx_t threads_nb = 4;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+
+    // More calls than the queue holds: the submitter runs the overflow
+    submit_count = 0;
+    bximap_future_p * futures = bximem_calloc(SUBMIT_CALLS * sizeof(*futures));
+    for (long i = 0; i < SUBMIT_CALLS; i++) {
+        err = bximap_submit(&test_function_call, (void *)(intptr_t)i, &futures[i]);
+        CU_ASSERT_TRUE(bxierr_isok(err));
+    }
+    int failed = 0;
+    for (long i = 0; i < SUBMIT_CALLS; i++) {
+        err = bximap_future_wait(&futures[i]);
+        CU_ASSERT_PTR_NULL(futures[i]);
+        if (bxierr_isko(err)) failed++;
+        bxierr_destroy(&err);
+    }
+    CU_ASSERT_EQUAL(submit_count, SUBMIT_CALLS);
+    CU_ASSERT_EQUAL(failed, (SUBMIT_CALLS + 6) / 7);
+    BXIFREE(futures);
+
+    // Calls waiting for their own calls
+    submit_count = 0;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_submit(&test_function_tree, (void *)0, &future)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_future_wait(&future)));
+    int nodes = 0;
+    for (int d = 0, level = 1; d <= SUBMIT_DEPTH; d++, level *= SUBMIT_FANOUT) nodes += level;
+    CU_ASSERT_EQUAL(submit_count, nodes);
+
+    // A call and a map share the pool
+    int used[4] = {0};
+    bximap_ctx_p task = NULL;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_new(0, 1000, 1, &test_function_threads, used, &task)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_submit(&test_function_call_map, task, &future)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_future_wait(&future)));
+    CU_ASSERT_EQUAL(used[0] + used[1] + used[2] + used[3], 1000);
+    bximap_destroy(&task);
+
+    // Without future, the pool can't be stopped before the calls returned
+    submit_count = 0;
+    for (long i = 1; i <= 100; i++) {
+        CU_ASSERT_TRUE(bxierr_isok(bximap_submit(&test_function_call,
+                                                 (void *)(intptr_t)(7 * i + 1), NULL)));
+    }
+    while (true) {
+        err = bximap_finalize();
+        if (bxierr_isok(err)) break;
+        CU_ASSERT_EQUAL(err->code, BXIMAP_RUNNING);
+        bxierr_destroy(&err);
+        sched_yield();
+    }
+    CU_ASSERT_EQUAL(submit_count, 100);
+
+    // A single thread runs the calls inline
+    threads_nb = 1;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_submit(&test_function_call, (void *)1, &future)));
+    bool done = false;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_future_test(future, &done)));
+    CU_ASSERT_TRUE(done);
+    CU_ASSERT_TRUE(bxierr_isok(bximap_future_wait(&future)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+#define GRAPH_CHAIN 1000
+
+volatile int graph_clock = 0;
+
+/* Record the rank of the call among the calls of the graph */
+bxierr_p test_function_node(void * arg) {
+    int * rank = (int *)arg;
+    *rank = __sync_add_and_fetch(&graph_clock, 1);
+    return BXIERR_OK;
+}
+
+bxierr_p test_function_node_fail(void * arg) {
+    UNUSED(arg);
+    return bxierr_gen("Node failed");
+}
+
+void test_map_graph(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    bximap_thrd_idx_t threads_nb = 4;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+
+    // Diamond: a before the maps b and c, both before d
+    int rank_a = 0, rank_d = 0;
+    int used_b[4] = {0}, used_c[4] = {0};
+    bximap_ctx_p map_b = NULL, map_c = NULL;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_new(0, 500, 1, &test_function_threads, used_b, &map_b)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_new(0, 700, 1, &test_function_threads, used_c, &map_c)));
+    bximap_graph_p graph = NULL;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_graph_new(&graph)));
+    size_t a, b, c, d;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_graph_add_call(graph, &test_function_node, &rank_a, &a)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_graph_add_map(graph, map_b, &b)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_graph_add_map(graph, map_c, &c)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_graph_add_call(graph, &test_function_node, &rank_d, &d)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_graph_add_edge(graph, a, b)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_graph_add_edge(graph, a, c)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_graph_add_edge(graph, b, d)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_graph_add_edge(graph, c, d)));
+    bxierr_p err = bximap_graph_add_edge(graph, d, 4);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+    bxierr_destroy(&err);
+    for (int r = 0; r < 3; r++) {
+        graph_clock = 0;
+        memset(used_b, 0, sizeof(used_b));
+        memset(used_c, 0, sizeof(used_c));
+        CU_ASSERT_TRUE(bxierr_isok(bximap_graph_execute(graph)));
+        CU_ASSERT_EQUAL(rank_a, 1);
+        CU_ASSERT_EQUAL(rank_d, 2);
+        CU_ASSERT_EQUAL(used_b[0] + used_b[1] + used_b[2] + used_b[3], 500);
+        CU_ASSERT_EQUAL(used_c[0] + used_c[1] + used_c[2] + used_c[3], 700);
+    }
+
+    // A failed node does not stop the others
+    size_t e;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_graph_add_call(graph, &test_function_node_fail, NULL, &e)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_graph_add_edge(graph, b, e)));
+    graph_clock = 0;
+    err = bximap_graph_execute(graph);
+    CU_ASSERT_TRUE(bxierr_isko(err));
+    bxierr_destroy(&err);
+    CU_ASSERT_EQUAL(rank_d, 2);
+
+    // Cycles are rejected
+    CU_ASSERT_TRUE(bxierr_isok(bximap_graph_add_edge(graph, d, a)));
+    err = bximap_graph_execute(graph);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+    bxierr_destroy(&err);
+    bximap_graph_destroy(&graph);
+    CU_ASSERT_PTR_NULL(graph);
+    bximap_destroy(&map_b);
+    bximap_destroy(&map_c);
+
+    // A long chain runs in order, and a fan out runs everything
+    int * ranks = bximem_calloc(2 * GRAPH_CHAIN * sizeof(*ranks));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_graph_new(&graph)));
+    for (size_t i = 0; i < GRAPH_CHAIN; i++) {
+        size_t node;
+        CU_ASSERT_TRUE(bxierr_isok(bximap_graph_add_call(graph, &test_function_node,
+                                                         &ranks[i], &node)));
+        CU_ASSERT_EQUAL(node, i);
+        if (0 < i) CU_ASSERT_TRUE(bxierr_isok(bximap_graph_add_edge(graph, i - 1, i)));
+    }
+    for (size_t i = GRAPH_CHAIN; i < 2 * GRAPH_CHAIN; i++) {
+        size_t node;
+        CU_ASSERT_TRUE(bxierr_isok(bximap_graph_add_call(graph, &test_function_node,
+                                                         &ranks[i], &node)));
+        CU_ASSERT_TRUE(bxierr_isok(bximap_graph_add_edge(graph, 0, node)));
+    }
+    graph_clock = 0;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_graph_execute(graph)));
+    CU_ASSERT_EQUAL(graph_clock, 2 * GRAPH_CHAIN);
+    for (size_t i = 1; i < GRAPH_CHAIN; i++) CU_ASSERT_TRUE(ranks[i - 1] < ranks[i]);
+    for (size_t i = GRAPH_CHAIN; i < 2 * GRAPH_CHAIN; i++) CU_ASSERT_TRUE(ranks[0] < ranks[i]);
+    bximap_graph_destroy(&graph);
+    BXIFREE(ranks);
+
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+#define PIPELINE_BATCHES 5000
+
+typedef struct {
+    long produced;
+    long limit;
+    long fail_at;         // Batch failing in the transform, -1 for none
+    long consumed;
+    long dropped;
+    long last;            // Last batch seen by the sink
+    bool ordered;
+} test_pipeline_s;
+
+bxierr_p test_stage_source(void * batch, void ** out, void * usr_data) {
+    UNUSED(batch);
+    test_pipeline_s * test = usr_data;
+    if (test->produced == test->limit) return BXIERR_OK;
+    long * value = bximem_calloc(sizeof(*value));
+    *value = test->produced++;
+    *out = value;
+    return BXIERR_OK;
+}
+
+/* Drop the multiples of 5, fail on fail_at */
+bxierr_p test_stage_transform(void * batch, void ** out, void * usr_data) {
+    test_pipeline_s * test = usr_data;
+    long * value = batch;
+    bxierr_p err = BXIERR_OK;
+    if (*value == test->fail_at) err = bxierr_gen("Batch %ld failed", *value);
+    if (*value % 5 == 0) {
+        test->dropped++;
+        BXIFREE(value);
+        return err;
+    }
+    *value *= 2;
+    *out = value;
+    return err;
+}
+
+bxierr_p test_stage_sink(void * batch, void ** out, void * usr_data) {
+    UNUSED(out);
+    test_pipeline_s * test = usr_data;
+    long * value = batch;
+    if (*value <= test->last) test->ordered = false;
+    test->last = *value;
+    test->consumed++;
+    BXIFREE(value);
+    return BXIERR_OK;
+}
+
+void test_map_pipeline(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    bximap_pipeline_p pipeline = NULL;
+    bxierr_p err = bximap_pipeline_new(0, &pipeline);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+    bxierr_destroy(&err);
+
+    bximap_thrd_idx_t sizes[] = {4, 1};
+    for (size_t s = 0; s < ARRAYLEN(sizes); s++) {
+        bximap_thrd_idx_t threads_nb = sizes[s];
+        CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+        test_pipeline_s test;
+        CU_ASSERT_TRUE(bxierr_isok(bximap_pipeline_new(3, &pipeline)));
+        CU_ASSERT_EQUAL(pipeline->depth, 4);
+        CU_ASSERT_TRUE(bxierr_isok(bximap_pipeline_add_stage(pipeline, &test_stage_source,
+                                                             &test)));
+        err = bximap_pipeline_execute(pipeline);
+        CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+        bxierr_destroy(&err);
+        CU_ASSERT_TRUE(bxierr_isok(bximap_pipeline_add_stage(pipeline, &test_stage_transform,
+                                                             &test)));
+        CU_ASSERT_TRUE(bxierr_isok(bximap_pipeline_add_stage(pipeline, &test_stage_sink,
+                                                             &test)));
+
+        // Every batch is processed in order, whatever the size of the pool
+        for (int r = 0; r < 2; r++) {
+            memset(&test, 0, sizeof(test));
+            test.limit = PIPELINE_BATCHES;
+            test.fail_at = -1;
+            test.last = -1;
+            test.ordered = true;
+            CU_ASSERT_TRUE(bxierr_isok(bximap_pipeline_execute(pipeline)));
+            CU_ASSERT_EQUAL(test.produced, PIPELINE_BATCHES);
+            CU_ASSERT_EQUAL(test.dropped, PIPELINE_BATCHES / 5);
+            CU_ASSERT_EQUAL(test.consumed, PIPELINE_BATCHES - PIPELINE_BATCHES / 5);
+            CU_ASSERT_EQUAL(test.last, 2 * (PIPELINE_BATCHES - 1));
+            CU_ASSERT_TRUE(test.ordered);
+        }
+
+        // An error stops the source, the batches produced are not leaked
+        memset(&test, 0, sizeof(test));
+        test.limit = PIPELINE_BATCHES;
+        test.fail_at = 100;
+        test.last = -1;
+        test.ordered = true;
+        err = bximap_pipeline_execute(pipeline);
+        CU_ASSERT_TRUE(bxierr_isko(err));
+        bxierr_destroy(&err);
+        CU_ASSERT_TRUE(test.produced < PIPELINE_BATCHES);
+        CU_ASSERT_EQUAL(test.consumed + test.dropped, test.produced);
+        CU_ASSERT_TRUE(test.ordered);
+
+        bximap_pipeline_destroy(&pipeline);
+        CU_ASSERT_PTR_NULL(pipeline);
+        CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    }
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+#define WEIGHTED_N 1000
+
+typedef struct {
+    const double * weights;
+    double max_cost;          // Cost of the most expensive task
+    volatile int lock;
+    bximap_task_idx_t iterations;
+} test_weighted_s;
+
+bxierr_p test_function_weighted(bximap_task_idx_t start,
+                                bximap_task_idx_t end,
+                                bximap_thrd_idx_t thread,
+                                void *usr_data) {
+    UNUSED(thread);
+    test_weighted_s * test = usr_data;
+    double cost = 0;
+    for (bximap_task_idx_t i = start; i < end; i++) cost += test->weights[i];
+    _spin_lock(&test->lock);
+    if (cost > test->max_cost) test->max_cost = cost;
+    test->iterations += end - start;
+    _spin_unlock(&test->lock);
+    return BXIERR_OK;
+}
+
+/* Cost of [0, i[ with the weight of the iteration j being j */
+double test_prefix_cost(bximap_task_idx_t i, void * data) {
+    UNUSED(data);
+    return (double)i * (double)(i - 1) / 2;
+}
+
+void test_map_weights(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    bximap_thrd_idx_t threads_nb = 4;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+
+    // A few iterations cost as much as all the others
+    double * weights = bximem_calloc(WEIGHTED_N * sizeof(*weights));
+    double total = 0, max_weight = 0;
+    for (int i = 0; i < WEIGHTED_N; i++) {
+        weights[i] = i % 100 == 0 ? 100 : 1;
+        total += weights[i];
+        if (weights[i] > max_weight) max_weight = weights[i];
+    }
+    test_weighted_s test;
+    bximap_ctx_p task = NULL;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_new(0, WEIGHTED_N, 0, &test_function_weighted,
+                                          &test, &task)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_weights(task, weights)));
+    bximap_sched_e scheds[] = {BXIMAP_SCHED_DYNAMIC, BXIMAP_SCHED_STEAL,
+                               BXIMAP_SCHED_STATIC, BXIMAP_SCHED_GUIDED};
+    for (size_t s = 0; s < ARRAYLEN(scheds); s++) {
+        memset(&test, 0, sizeof(test));
+        test.weights = weights;
+        CU_ASSERT_TRUE(bxierr_isok(bximap_set_schedule(task, scheds[s])));
+        CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+        CU_ASSERT_EQUAL(test.iterations, WEIGHTED_N);
+        CU_ASSERT_TRUE(test.max_cost <= total / (double)task->nb_tasks + max_weight);
+        for (bximap_task_idx_t k = 0; k < task->nb_tasks; k++) {
+            CU_ASSERT_TRUE(task->bounds[k] <= task->bounds[k + 1]);
+        }
+    }
+
+    // The same with the costs summed up, the weights grow with the index
+    for (int i = 0; i < WEIGHTED_N; i++) weights[i] = i;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_cost(task, &test_prefix_cost, NULL)));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_schedule(task, BXIMAP_SCHED_DYNAMIC)));
+    memset(&test, 0, sizeof(test));
+    test.weights = weights;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+    CU_ASSERT_EQUAL(test.iterations, WEIGHTED_N);
+    total = test_prefix_cost(WEIGHTED_N, NULL);
+    CU_ASSERT_TRUE(test.max_cost <= total / (double)task->nb_tasks + WEIGHTED_N);
+    // The first tasks, of cheap iterations, are the widest
+    CU_ASSERT_TRUE(task->bounds[1] - task->bounds[0]
+                   > task->bounds[task->nb_tasks] - task->bounds[task->nb_tasks - 1]);
+
+    // Without any weight, the tasks are even
+    memset(weights, 0, WEIGHTED_N * sizeof(*weights));
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_weights(task, weights)));
+    memset(&test, 0, sizeof(test));
+    test.weights = weights;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+    CU_ASSERT_EQUAL(test.iterations, WEIGHTED_N);
+    for (bximap_task_idx_t k = 0; k < task->nb_tasks; k++) {
+        CU_ASSERT_TRUE(task->bounds[k + 1] - task->bounds[k] <= task->task_size + 1);
+    }
+
+    // Negative and NaN weights are rejected by the execution
+    const double invalid[] = {-1, NAN};
+    for (size_t i = 0; i < ARRAYLEN(invalid); i++) {
+        weights[WEIGHTED_N / 2] = invalid[i];
+        bxierr_p err = bximap_execute(task);
+        CU_ASSERT_TRUE(bxierr_isko(err) && BXIMAP_ARG_ERROR == err->code);
+        bxierr_destroy(&err);
+    }
+    weights[WEIGHTED_N / 2] = 0;
+
+    // Back to even tasks
+    CU_ASSERT_TRUE(bxierr_isok(bximap_set_cost(task, NULL, NULL)));
+    memset(&test, 0, sizeof(test));
+    test.weights = weights;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_execute(task)));
+    CU_ASSERT_EQUAL(test.iterations, WEIGHTED_N);
+
+    bximap_destroy(&task);
+    BXIFREE(weights);
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+typedef struct {
+    uint64_t key;
+    size_t idx;
+} test_record_s;
+
+int test_compare_records(const void * a, const void * b) {
+    const test_record_s * ra = a, * rb = b;
+    return ra->key < rb->key ? -1 : ra->key > rb->key;
+}
+
+uint64_t test_record_key(const void * elem) {
+    return ((const test_record_s *)elem)->key;
+}
+
+void test_map_sort(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    bximap_thrd_idx_t threads_nb = 4;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+
+    // Sequential, a few blocks, and enough blocks to merge several rounds
+    size_t sizes[] = {0, 1, 1000, 5 * BXIMAP_SORT_BLOCK + 3, 40 * BXIMAP_SORT_BLOCK + 7};
+    uint64_t ranges[] = {1000, (uint64_t)1 << 40};
+    for (size_t s = 0; s < ARRAYLEN(sizes); s++) {
+        size_t n = sizes[s];
+        test_record_s * records = bximem_calloc((n + 1) * sizeof(*records));
+        for (size_t r = 0; r < ARRAYLEN(ranges); r++) {
+            uint64_t sum = 0;
+            srand(42);
+            for (size_t i = 0; i < n; i++) {
+                records[i].key = ((uint64_t)rand() << 20 ^ (uint64_t)rand()) % ranges[r];
+                records[i].idx = i;
+                sum += records[i].key;
+            }
+            CU_ASSERT_TRUE(bxierr_isok(bximap_sort(records, n, sizeof(*records),
+                                                   &test_compare_records)));
+            uint64_t sorted_sum = 0;
+            for (size_t i = 0; i < n; i++) {
+                if (0 < i) CU_ASSERT_TRUE(records[i - 1].key <= records[i].key);
+                sorted_sum += records[i].key;
+            }
+            CU_ASSERT_EQUAL(sorted_sum, sum);
+
+            // The radix sort keeps the order of the equal keys
+            for (size_t i = 0; i < n; i++) records[i].idx = i;
+            for (size_t i = 0; i < n / 2; i++) {
+                test_record_s swap = records[i];
+                records[i] = records[n - 1 - i];
+                records[n - 1 - i] = swap;
+            }
+            CU_ASSERT_TRUE(bxierr_isok(bximap_sort_by_key(records, n, sizeof(*records),
+                                                          &test_record_key)));
+            sorted_sum = 0;
+            for (size_t i = 0; i < n; i++) {
+                if (0 < i) {
+                    CU_ASSERT_TRUE(records[i - 1].key <= records[i].key);
+                    if (records[i - 1].key == records[i].key) {
+                        CU_ASSERT_TRUE(records[i - 1].idx > records[i].idx);
+                    }
+                }
+                sorted_sum += records[i].key;
+            }
+            CU_ASSERT_EQUAL(sorted_sum, sum);
+        }
+        BXIFREE(records);
+    }
+    bxierr_p err = bximap_sort(&threads_nb, 1, 0, &test_compare_records);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+    bxierr_destroy(&err);
+    // Sizes which don't fit in a size_t
+    err = bximap_sort(&threads_nb, SIZE_MAX / 2, 4, &test_compare_records);
+    CU_ASSERT_TRUE_FATAL(bxierr_isko(err));
+    CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+    bxierr_destroy(&err);
+    err = bximap_sort_by_key(&threads_nb, SIZE_MAX / 4, 2, &test_record_key);
+    CU_ASSERT_TRUE_FATAL(bxierr_isko(err));
+    CU_ASSERT_EQUAL(err->code, BXIMAP_ARG_ERROR);
+    bxierr_destroy(&err);
+
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    DEBUG(TEST_LOGGER, "End test");
+}
+
+void test_map_scan(void) {
+    DEBUG(TEST_LOGGER, "Starting test");
+
+    int64_t value = 0;
+    bxierr_p err = bximap_scan(&value, &value, 1, true);
+    CU_ASSERT_EQUAL(err->code, BXIMAP_NOT_INITIALIZED);
+    bxierr_destroy(&err);
+
+    bximap_thrd_idx_t threads_nb = 4;
+    CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+    size_t sizes[] = {1, 1000, 20 * BXIMAP_SORT_BLOCK + 5};
+    for (size_t s = 0; s < ARRAYLEN(sizes); s++) {
+        size_t n = sizes[s];
+        int64_t * in = bximem_calloc(n * sizeof(*in));
+        int64_t * out = bximem_calloc(n * sizeof(*out));
+        for (size_t i = 0; i < n; i++) in[i] = (int64_t)(i % 7) - 2;
+
+        CU_ASSERT_TRUE(bxierr_isok(bximap_scan(in, out, n, false)));
+        int64_t sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            CU_ASSERT_EQUAL(out[i], sum);
+            sum += in[i];
+        }
+        // In place
+        CU_ASSERT_TRUE(bxierr_isok(bximap_scan(in, in, n, true)));
+        sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += (int64_t)(i % 7) - 2;
+            CU_ASSERT_EQUAL(in[i], sum);
+        }
+        BXIFREE(in);
+        BXIFREE(out);
+    }
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    DEBUG(TEST_LOGGER, "End test");
+}
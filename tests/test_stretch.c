@@ -16,14 +16,23 @@
 // *********************************************************************************
 // ********************************** Defines **************************************
 // *********************************************************************************
+#define STRETCH_THREADS 4
+#define STRETCH_APPENDS 5000
 
 // *********************************************************************************
 // ********************************** Types ****************************************
 // *********************************************************************************
+typedef struct {
+    bxistretch_p sarray;
+    size_t rank;
+    size_t * first;
+    size_t * indexes;
+} test_stretch_thread_s;
 
 // *********************************************************************************
 // ********************************** Static Functions  ****************************
 // *********************************************************************************
+static void * _test_stretch_thread(void * data);
 
 // *********************************************************************************
 // ********************************** Global Variables *****************************
@@ -97,9 +106,357 @@ void test_stretch(void) {
     bxistretch_destroy(&sarray);
     CU_ASSERT_PTR_NULL(sarray);
 
+    // Appending to a default stretch
+    sarray = bxistretch_new(10, sizeof(size_t), 0);
+    for (size_t i = 0; i < 100; i++) {
+        size_t index;
+        size_t * element = bxistretch_append(sarray, &index);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(element);
+        CU_ASSERT_EQUAL(index, i);
+        *element = i;
+    }
+    for (size_t i = 0; i < 100; i++) {
+        size_t * element = bxistretch_get(sarray, i);
+        CU_ASSERT_EQUAL(*element, i);
+    }
+    bxistretch_destroy(&sarray);
+}
+
+void test_stretch_concurrent(void) {
+    bxistretch_p sarray = bxistretch_new_concurrent(10, sizeof(int), 20);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sarray);
+    int * test = bxistretch_get(sarray, 19);
+    CU_ASSERT_PTR_NOT_NULL(test);
+    test = bxistretch_get(sarray, 20);
+    CU_ASSERT_PTR_NULL(test);
+    test = bxistretch_hit(sarray, 0);
+    *test = 10;
+    test = bxistretch_hit(sarray, 300);
+    CU_ASSERT_PTR_NOT_NULL(test);
+    size_t index;
+    test = bxistretch_append(sarray, &index);
+    CU_ASSERT_PTR_NOT_NULL(test);
+    CU_ASSERT_EQUAL(index, 301);
+    test = bxistretch_get(sarray, 0);
+    CU_ASSERT_EQUAL(*test, 10);
+    test = bxistretch_hit(sarray, BXISTRETCH_DIRECTORY_SIZE
+                                  * BXISTRETCH_DIRECTORY_SIZE * 10);
+    CU_ASSERT_PTR_NULL(test);
+    bxistretch_destroy(&sarray);
+    CU_ASSERT_PTR_NULL(sarray);
+
+    // Several threads append while the others read
+    sarray = bxistretch_new_concurrent(64, sizeof(size_t), 0);
+    size_t * first = bxistretch_hit(sarray, 0);
+    *first = 0;
+    pthread_t threads[STRETCH_THREADS];
+    test_stretch_thread_s data[STRETCH_THREADS];
+    for (int t = 0; t < STRETCH_THREADS; t++) {
+        data[t].sarray = sarray;
+        data[t].rank = (size_t)t;
+        data[t].first = first;
+        data[t].indexes = bximem_calloc(STRETCH_APPENDS * sizeof(*data[t].indexes));
+        int rc = pthread_create(&threads[t], NULL, &_test_stretch_thread, &data[t]);
+        CU_ASSERT_EQUAL(rc, 0);
+    }
+    for (int t = 0; t < STRETCH_THREADS; t++) {
+        CU_ASSERT_EQUAL(pthread_join(threads[t], NULL), 0);
+    }
+    size_t total = STRETCH_THREADS * STRETCH_APPENDS + 1;
+    CU_ASSERT_PTR_NOT_NULL(bxistretch_get(sarray, total - 1));
+    CU_ASSERT_PTR_NULL(bxistretch_get(sarray, total));
+    CU_ASSERT_PTR_EQUAL(bxistretch_get(sarray, 0), first);
+    // Each index was given once and holds what its thread wrote
+    for (int t = 0; t < STRETCH_THREADS; t++) {
+        for (size_t i = 0; i < STRETCH_APPENDS; i++) {
+            size_t * element = bxistretch_get(sarray, data[t].indexes[i]);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(element);
+            CU_ASSERT_EQUAL(*element, (size_t)t * STRETCH_APPENDS + i + 1);
+        }
+        BXIFREE(data[t].indexes);
+    }
+    bxistretch_destroy(&sarray);
+}
+
+void test_stretch_reserved(void) {
+    bxistretch_p sarray = bxistretch_new_reserved(10, sizeof(int), 20, 100000);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sarray);
+    int * data = bxistretch_data(sarray);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+    CU_ASSERT_PTR_EQUAL(bxistretch_get(sarray, 0), data);
+    CU_ASSERT_PTR_NOT_NULL(bxistretch_get(sarray, 19));
+    CU_ASSERT_PTR_NULL(bxistretch_get(sarray, 20));
+    data[0] = 10;
+
+    // Elements are contiguous and don't move when the array grows
+    int * test = bxistretch_hit(sarray, 50000);
+    CU_ASSERT_PTR_EQUAL(test, data + 50000);
+    for (int i = 0; i <= 50000; i++) data[i] = i;
+    for (size_t i = 0; i <= 50000; i += 1000) {
+        test = bxistretch_get(sarray, i);
+        CU_ASSERT_EQUAL(*test, (int)i);
+    }
+    size_t index;
+    test = bxistretch_append(sarray, &index);
+    CU_ASSERT_EQUAL(index, 50001);
+    CU_ASSERT_PTR_EQUAL(test, data + 50001);
+    CU_ASSERT_PTR_EQUAL(bxistretch_data(sarray), data);
+
+    // The array can't grow beyond element_max, even in the rounded up space
+    CU_ASSERT_PTR_NOT_NULL(bxistretch_hit(sarray, 99999));
+    CU_ASSERT_PTR_NULL(bxistretch_hit(sarray, 100000));
+    CU_ASSERT_PTR_NULL(bxistretch_hit(sarray, 10000000));
+    bxistretch_destroy(&sarray);
+    CU_ASSERT_PTR_NULL(sarray);
+
+    // Nor be reserved beyond the address space
+    CU_ASSERT_PTR_NULL(bxistretch_new_reserved(10, sizeof(int), 0, SIZE_MAX / 2));
+
+    sarray = bxistretch_new(10, sizeof(int), 2);
+    CU_ASSERT_PTR_NULL(bxistretch_data(sarray));
+    bxistretch_destroy(&sarray);
+}
+
+void test_stretch_file(void) {
+    char * dir = NULL;
+    bxierr_p err = bximisc_mkdtemp("stretch-XXXXXX", &dir);
+    CU_ASSERT_TRUE_FATAL(bxierr_isok(err));
+    char * file = bxistr_new("%s/stretch", dir);
+    char * other = bxistr_new("%s/other", dir);
+
+    bxistretch_p sarray = NULL;
+    err = bxistretch_new_file(file, 10, sizeof(size_t), 995, &sarray);
+    CU_ASSERT_TRUE_FATAL(bxierr_isok(err));
+    CU_ASSERT_PTR_NULL(bxistretch_get(sarray, 0));
+    for (size_t i = 0; i < 500; i++) {
+        size_t * element = bxistretch_hit(sarray, i);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(element);
+        *element = i;
+    }
+    size_t index;
+    size_t * element = bxistretch_append(sarray, &index);
+    CU_ASSERT_EQUAL(index, 500);
+    *element = 500;
+    bxistretch_destroy(&sarray);
+    CU_ASSERT_PTR_NULL(sarray);
+
+    // The file can't be created twice
+    err = bxistretch_new_file(file, 10, sizeof(size_t), 995, &sarray);
+    CU_ASSERT_TRUE(bxierr_isko(err));
+    bxierr_destroy(&err);
+
+    // Reopen the elements hit in the file
+    err = bxistretch_open_file(file, sizeof(size_t), &sarray);
+    CU_ASSERT_TRUE_FATAL(bxierr_isok(err));
+    size_t * data = bxistretch_data(sarray);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+    for (size_t i = 0; i <= 500; i++) {
+        CU_ASSERT_PTR_EQUAL(bxistretch_get(sarray, i), data + i);
+        CU_ASSERT_EQUAL(data[i], i);
+    }
+    CU_ASSERT_PTR_NULL(bxistretch_get(sarray, 501));
+    // The capacity is rounded up to a whole chunk
+    CU_ASSERT_PTR_NOT_NULL(bxistretch_hit(sarray, 999));
+    CU_ASSERT_PTR_NULL(bxistretch_hit(sarray, 1000));
+    bxistretch_destroy(&sarray);
+
+    // The header is checked
+    err = bxistretch_open_file(file, sizeof(int), &sarray);
+    CU_ASSERT_TRUE(bxierr_isko(err));
+    CU_ASSERT_EQUAL(err->code, BXISTRETCH_HEADER_ERROR);
+    bxierr_destroy(&err);
+    char * addr = NULL;
+    err = bximisc_file_map(other, 4096, false, true, PROT_READ | PROT_WRITE, &addr);
+    CU_ASSERT_TRUE_FATAL(bxierr_isok(err));
+    munmap(addr, 4096);
+    err = bxistretch_open_file(other, sizeof(size_t), &sarray);
+    CU_ASSERT_TRUE(bxierr_isko(err));
+    CU_ASSERT_EQUAL(err->code, BXISTRETCH_HEADER_ERROR);
+    bxierr_destroy(&err);
+    unlink(other);
+    err = bxistretch_open_file(other, sizeof(size_t), &sarray);
+    CU_ASSERT_TRUE(bxierr_isko(err));
+    bxierr_destroy(&err);
+    // A capacity whose size wraps around to the size of the file
+    err = bximisc_file_map(other, 64 + sizeof(size_t), false, true,
+                           PROT_READ | PROT_WRITE, &addr);
+    CU_ASSERT_TRUE_FATAL(bxierr_isok(err));
+    uint64_t * header = (uint64_t *)(void *)addr;
+    memcpy(header, "BXISTRCH", 8);
+    header[1] = 1;                                  // version
+    header[2] = sizeof(size_t);                     // element_size
+    header[3] = 1;                                  // chunk_size
+    header[4] = 0;                                  // element_nb
+    header[5] = (UINT64_MAX / sizeof(size_t)) + 2;  // element_max
+    munmap(addr, 64 + sizeof(size_t));
+    err = bxistretch_open_file(other, sizeof(size_t), &sarray);
+    CU_ASSERT_TRUE(bxierr_isko(err));
+    CU_ASSERT_EQUAL(err->code, BXISTRETCH_HEADER_ERROR);
+    bxierr_destroy(&err);
+    unlink(other);
+    err = bxistretch_new_file(other, 10, sizeof(size_t), SIZE_MAX / 4, &sarray);
+    CU_ASSERT_TRUE(bxierr_isko(err));
+    bxierr_destroy(&err);
+
+    unlink(file);
+    unlinkat(0, dir, AT_REMOVEDIR);
+    BXIFREE(other);
+    BXIFREE(file);
+    BXIFREE(dir);
+}
+
+void test_stretch_sparse(void) {
+    bxistretch_p sarray = bxistretch_new_sparse(1024, sizeof(size_t));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sarray);
+    size_t count, index = 0;
+    CU_ASSERT_PTR_NULL(bxistretch_next_chunk(sarray, &index, &count));
+
+    // Only the chunks hit are allocated
+    size_t * element = bxistretch_hit(sarray, 1000000000);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(element);
+    *element = 42;
+    element = bxistretch_hit(sarray, 5);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(element);
+    *element = 5;
+    CU_ASSERT_PTR_NULL(bxistretch_get(sarray, 2048));
+    CU_ASSERT_PTR_NULL(bxistretch_get(sarray, 1000000001));
+    element = bxistretch_get(sarray, 1000000000);
+    CU_ASSERT_EQUAL(*element, 42);
+    element = bxistretch_get(sarray, 1023);
+    CU_ASSERT_PTR_NOT_NULL(element);
+    CU_ASSERT_EQUAL(*element, 0);
+
+    // Walk the two chunks hit
+    index = 0;
+    element = bxistretch_next_chunk(sarray, &index, &count);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(element);
+    CU_ASSERT_EQUAL(index, 0);
+    CU_ASSERT_EQUAL(count, 1024);
+    CU_ASSERT_EQUAL(element[5], 5);
+    index += count;
+    element = bxistretch_next_chunk(sarray, &index, &count);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(element);
+    CU_ASSERT_EQUAL(index, 1000000000 / 1024 * 1024);
+    CU_ASSERT_EQUAL(index + count, 1000000001);
+    CU_ASSERT_EQUAL(element[count - 1], 42);
+    index += count;
+    CU_ASSERT_PTR_NULL(bxistretch_next_chunk(sarray, &index, &count));
+    bxistretch_destroy(&sarray);
+    CU_ASSERT_PTR_NULL(sarray);
+
+    // Every chunk of the other stretches is walked
+    sarray = bxistretch_new(10, sizeof(size_t), 25);
+    index = 3;
+    element = bxistretch_next_chunk(sarray, &index, &count);
+    CU_ASSERT_PTR_EQUAL(element, bxistretch_get(sarray, 3));
+    CU_ASSERT_EQUAL(index, 3);
+    CU_ASSERT_EQUAL(count, 7);
+    size_t total = 0;
+    index = 0;
+    for (char * data = bxistretch_next_chunk(sarray, &index, &count);
+         NULL != data;
+         index += count, data = bxistretch_next_chunk(sarray, &index, &count)) {
+        total += count;
+    }
+    CU_ASSERT_EQUAL(total, 25);
+    bxistretch_destroy(&sarray);
+
+    sarray = bxistretch_new_reserved(10, sizeof(size_t), 25, 100);
+    index = 20;
+    element = bxistretch_next_chunk(sarray, &index, &count);
+    CU_ASSERT_PTR_EQUAL(element, bxistretch_get(sarray, 20));
+    CU_ASSERT_EQUAL(count, 5);
+    bxistretch_destroy(&sarray);
+}
+
+void test_stretch_span(void) {
+    size_t * buf = bximem_calloc(5000 * sizeof(*buf));
+    size_t * out = bximem_calloc(5000 * sizeof(*out));
+    for (size_t i = 0; i < 5000; i++) buf[i] = i + 1;
+
+    // Chunk sizes with and without a power of 2, in each mode
+    size_t chunk_sizes[] = {64, 100};
+    for (size_t c = 0; c < ARRAYLEN(chunk_sizes); c++) {
+        bxistretch_p sarrays[] = {
+            bxistretch_new(chunk_sizes[c], sizeof(size_t), 0),
+            bxistretch_new_concurrent(chunk_sizes[c], sizeof(size_t), 0),
+            bxistretch_new_reserved(chunk_sizes[c], sizeof(size_t), 0, 10000),
+            bxistretch_new_sparse(chunk_sizes[c], sizeof(size_t)),
+        };
+        for (size_t s = 0; s < ARRAYLEN(sarrays); s++) {
+            bxistretch_p sarray = sarrays[s];
+            CU_ASSERT_PTR_NOT_NULL_FATAL(sarray);
+            CU_ASSERT_EQUAL(bxistretch_write(sarray, 10, 4990, buf), 4990);
+            for (size_t i = 10; i < 5000; i += 7) {
+                size_t * element = bxistretch_get(sarray, i);
+                CU_ASSERT_PTR_NOT_NULL_FATAL(element);
+                CU_ASSERT_EQUAL(*element, i - 9);
+            }
+            CU_ASSERT_PTR_NULL(bxistretch_get(sarray, 5000));
+
+            CU_ASSERT_EQUAL(bxistretch_read(sarray, 0, 5000, out), 5000);
+            CU_ASSERT_EQUAL(out[0], 0);
+            CU_ASSERT_EQUAL(memcmp(out + 10, buf, 4990 * sizeof(*buf)), 0);
+            CU_ASSERT_EQUAL(bxistretch_read(sarray, 4000, 5000, out), 1000);
+            CU_ASSERT_EQUAL(out[999], 4990);
+            CU_ASSERT_EQUAL(bxistretch_read(sarray, 5000, 10, out), 0);
+
+            // The spans cover every element once, in order
+            size_t index = 0, count, total = 0;
+            for (size_t * data = bxistretch_next_span(sarray, &index, &count);
+                 NULL != data;
+                 index += count, data = bxistretch_next_span(sarray, &index, &count)) {
+                CU_ASSERT_EQUAL(index, total);
+                CU_ASSERT_PTR_EQUAL(data, bxistretch_get(sarray, index));
+                CU_ASSERT_EQUAL(data[count - 1], index + count - 1 < 10 ? 0 : index + count - 10);
+                total += count;
+            }
+            CU_ASSERT_EQUAL(total, 5000);
+            bxistretch_destroy(&sarray);
+        }
+    }
+
+    // All the elements of a reserved stretch form one span
+    bxistretch_p sarray = bxistretch_new_reserved(64, sizeof(size_t), 1000, 1000);
+    size_t index = 5, count;
+    CU_ASSERT_PTR_NOT_NULL(bxistretch_next_span(sarray, &index, &count));
+    CU_ASSERT_EQUAL(count, 995);
+    // Only the elements within the capacity are written
+    CU_ASSERT_EQUAL(bxistretch_write(sarray, 900, 200, buf), 100);
+    CU_ASSERT_EQUAL(*(size_t *)bxistretch_get(sarray, 999), buf[99]);
+    CU_ASSERT_EQUAL(bxistretch_write(sarray, 1000, 10, buf), 0);
+    bxistretch_destroy(&sarray);
+
+    // The holes of a sparse stretch are read as zeros
+    sarray = bxistretch_new_sparse(64, sizeof(size_t));
+    CU_ASSERT_EQUAL(bxistretch_write(sarray, 1000, 10, buf), 10);
+    CU_ASSERT_EQUAL(bxistretch_read(sarray, 0, 1010, out), 1010);
+    CU_ASSERT_EQUAL(out[0], 0);
+    CU_ASSERT_EQUAL(out[999], 0);
+    CU_ASSERT_EQUAL(out[1009], 10);
+    index = 0;
+    CU_ASSERT_PTR_NOT_NULL(bxistretch_next_span(sarray, &index, &count));
+    CU_ASSERT_EQUAL(index, 960);
+    CU_ASSERT_EQUAL(count, 50);
+    bxistretch_destroy(&sarray);
+
+    BXIFREE(out);
+    BXIFREE(buf);
 }
 
 // *********************************************************************************
 // ********************************** Static Functions Implementation  *************
 // *********************************************************************************
 
+void * _test_stretch_thread(void * data) {
+    test_stretch_thread_s * thread = data;
+    for (size_t i = 0; i < STRETCH_APPENDS; i++) {
+        size_t * element = bxistretch_append(thread->sarray, &thread->indexes[i]);
+        bxiassert(NULL != element);
+        *element = thread->rank * STRETCH_APPENDS + i + 1;
+        // Growth must neither move nor lose the elements already there
+        bxiassert(bxistretch_get(thread->sarray, 0) == thread->first);
+        bxiassert(NULL != bxistretch_get(thread->sarray, thread->indexes[i]));
+    }
+    return NULL;
+}
@@ -90,3 +90,56 @@ void test_vector(void) {
 }
 
 
+
+typedef struct {
+    size_t calls;
+    bool fail;              // Elements multiple of 5 fail
+} test_apply_s;
+
+static bxierr_p test_vector_increment(void * elem, void * data) {
+    size_t * value = elem;
+    test_apply_s * test = data;
+    __sync_fetch_and_add(&test->calls, 1);
+    if (test->fail && *value % 5 == 0) return bxierr_gen("Element %zu failed", *value);
+    (*value)++;
+    return BXIERR_OK;
+}
+
+void test_vector_apply_parallel(void) {
+    size_t MAX = 10000;
+    bxivector_p array = bxivector_new(0, NULL);
+    for (size_t i = 0; i < MAX; i++){
+        size_t * allocated = bximem_calloc(sizeof(*allocated));
+        *allocated = i;
+        bxivector_push(array, allocated);
+    }
+
+    // Sequentially without bximap, then on its threads
+    bximap_thrd_idx_t threads_nb = 4;
+    test_apply_s test = {.calls = 0, .fail = false};
+    for (size_t r = 1; r <= 2; r++) {
+        test.calls = 0;
+        bxierr_p err = bxivector_apply_parallel(array, test_vector_increment, &test);
+        CU_ASSERT_TRUE(bxierr_isok(err));
+        CU_ASSERT_EQUAL(test.calls, MAX);
+        for (size_t i = 0; i < MAX; i++) {
+            size_t * get = bxivector_get_elem(array, i);
+            CU_ASSERT_EQUAL(*get, i + r);
+        }
+        if (1 == r) CU_ASSERT_TRUE(bxierr_isok(bximap_init(&threads_nb)));
+    }
+
+    // Every error is reported
+    test.calls = 0;
+    test.fail = true;
+    bxierr_p err = bxivector_apply_parallel(array, test_vector_increment, &test);
+    CU_ASSERT_TRUE_FATAL(bxierr_isko(err));
+    CU_ASSERT_EQUAL(err->code, BXIVECTOR_APPLY_ERR);
+    bxierr_list_p list = err->data;
+    CU_ASSERT_EQUAL(list->errors_nb, MAX / 5);
+    bxierr_destroy(&err);
+    CU_ASSERT_EQUAL(test.calls, MAX);
+
+    CU_ASSERT_TRUE(bxierr_isok(bximap_finalize()));
+    bxivector_destroy(&array, (void (*)(void **))bximem_destroy);
+}
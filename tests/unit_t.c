@@ -136,11 +136,37 @@ int main(int argc, char * argv[]) {
         || (NULL == CU_add_test(pSuite, "test bitarray", test_bitarray))
 
         || (NULL == CU_add_test(pSuite, "test vector", test_vector))
+        || (NULL == CU_add_test(pSuite, "test vector apply parallel", test_vector_apply_parallel))
         || (NULL == CU_add_test(pSuite, "test stretch", test_stretch))
+        || (NULL == CU_add_test(pSuite, "test stretch concurrent", test_stretch_concurrent))
+        || (NULL == CU_add_test(pSuite, "test stretch reserved", test_stretch_reserved))
+        || (NULL == CU_add_test(pSuite, "test stretch file", test_stretch_file))
+        || (NULL == CU_add_test(pSuite, "test stretch sparse", test_stretch_sparse))
+        || (NULL == CU_add_test(pSuite, "test stretch span", test_stretch_span))
 
         || (NULL == CU_add_test(pSuite, "test map", test_map))
         || (NULL == CU_add_test(pSuite, "test map scheduler", test_scheduler))
         || (NULL == CU_add_test(pSuite, "test map fork", test_mapper_fork))
+        || (NULL == CU_add_test(pSuite, "test map steal", test_map_steal))
+        || (NULL == CU_add_test(pSuite, "test map bounds", test_map_bounds))
+        || (NULL == CU_add_test(pSuite, "test map nested", test_map_nested))
+        || (NULL == CU_add_test(pSuite, "test map async", test_map_async))
+        || (NULL == CU_add_test(pSuite, "test map reduce", test_map_reduce))
+        || (NULL == CU_add_test(pSuite, "test map spin", test_map_spin))
+        || (NULL == CU_add_test(pSuite, "test map policies", test_map_policies))
+        || (NULL == CU_add_test(pSuite, "test map stats", test_map_stats))
+        || (NULL == CU_add_test(pSuite, "test map placement", test_map_placement))
+        || (NULL == CU_add_test(pSuite, "test map affinity", test_map_affinity))
+        || (NULL == CU_add_test(pSuite, "test map cancel", test_map_cancel))
+        || (NULL == CU_add_test(pSuite, "test map nd", test_map_nd))
+        || (NULL == CU_add_test(pSuite, "test map resize", test_map_resize))
+        || (NULL == CU_add_test(pSuite, "test map resize placed", test_map_resize_placed))
+        || (NULL == CU_add_test(pSuite, "test map submit", test_map_submit))
+        || (NULL == CU_add_test(pSuite, "test map graph", test_map_graph))
+        || (NULL == CU_add_test(pSuite, "test map pipeline", test_map_pipeline))
+        || (NULL == CU_add_test(pSuite, "test map weights", test_map_weights))
+        || (NULL == CU_add_test(pSuite, "test map sort", test_map_sort))
+        || (NULL == CU_add_test(pSuite, "test map scan", test_map_scan))
 
         || (NULL == CU_add_test(pSuite, "test rng", test_rng))
 